@@ -3961,6 +3961,19 @@ FRESULT f_read (
 			if (cc > 0) {						/* Read maximum contiguous sectors directly */
 				if (csect + cc > fs->csize) {	/* Clip at cluster boundary */
 					cc = fs->csize - csect;
+					while (btr / SS(fs) >= cc + fs->csize) {	/* Extend over following clusters that are contiguous on the volume, so the run is read with one multiple block command */
+#if FF_USE_FASTSEEK
+						if (fp->cltbl) {
+							clst = clmt_clust(fp, fp->fptr + (FSIZE_t)cc * SS(fs));
+						} else
+#endif
+						{
+							clst = get_fat(&fp->obj, fp->clust);
+						}
+						if (clst != fp->clust + 1) break;
+						fp->clust = clst;
+						cc += fs->csize;
+					}
 				}
 				if (disk_read(fs->pdrv, rbuff, sect, cc) != RES_OK) ABORT(fs, FR_DISK_ERR);
 #if !FF_FS_READONLY && FF_FS_MINIMIZE <= 2		/* Replace one of the read sectors with cached data if it contains a dirty sector */
@@ -184,6 +184,16 @@ specific language governing permissions and limitations under the License.
 static bool crc_on = true;
 #endif
 
+/* SCK ladder. The card is initialized at spi->baud_rate (step 0), then SCK
+ * is stepped up through these rates while reads at each step pass their
+ * CRC check. A transfer that fails its CRC or times out drops SCK one step
+ * and is retried. The rates are ceilings: the actual SCK is clk_peri
+ * divided by an even number. Needs CRC, so stays at step 0 without it. */
+static const uint sd_sck_steps[] = {31250 * 1000, 41666 * 1000, 62500 * 1000};
+
+/* Blocks read at each step of the ladder before settling on it */
+#define SD_SCK_PROBE_BLOCKS 8
+
 #define TRACE_PRINTF(fmt, args...)
 //#define TRACE_PRINTF printf
 
@@ -294,10 +304,7 @@ typedef enum {
 
 #define SPI_CMD(x) (0x40 | (x & 0x3f))
 
-static uint8_t sd_cmd_spi(sd_card_t *pSD, cmdSupported cmd, uint32_t arg) {
-    uint8_t response;
-    char cmdPacket[PACKET_SIZE];
-
+static void sd_cmd_packet(cmdSupported cmd, uint32_t arg, char *cmdPacket) {
     // Prepare the command packet
     cmdPacket[0] = SPI_CMD(cmd);
     cmdPacket[1] = (arg >> 24);
@@ -325,6 +332,13 @@ static uint8_t sd_cmd_spi(sd_card_t *pSD, cmdSupported cmd, uint32_t arg) {
                 break;
         }
     }
+}
+
+static uint8_t sd_cmd_spi(sd_card_t *pSD, cmdSupported cmd, uint32_t arg) {
+    uint8_t response;
+    char cmdPacket[PACKET_SIZE];
+
+    sd_cmd_packet(cmd, arg, cmdPacket);
     // send a command
     for (int i = 0; i < PACKET_SIZE; i++) {
         sd_spi_write(pSD, cmdPacket[i]);
@@ -373,9 +387,12 @@ static void sd_unlock(sd_card_t *pSD) {
     mutex_exit(&pSD->mutex);
 }
 
+static void sd_async_wait(sd_card_t *pSD);
+
 // Locks the SD card and acquires its SPI
 static void sd_acquire(sd_card_t *pSD) {
     sd_lock(pSD);
+    sd_async_wait(pSD);
     sd_spi_acquire(pSD);
 }
 static void sd_release(sd_card_t *pSD) {
@@ -809,15 +826,21 @@ static int sd_read_bytes(sd_card_t *pSD, uint8_t *buffer, uint32_t length) {
 }
 static int sd_read_block(sd_card_t *pSD, uint8_t *buffer, uint32_t length) {
     uint16_t crc;
+    uint16_t crc_result = 0;
+    uint16_t *pCrc = NULL;
 
     // read until start byte (0xFE)
     if (false == sd_wait_token(pSD, SPI_START_BLOCK)) {
         DBG_PRINTF("%s:%d Read timeout\r\n", __FILE__, __LINE__);
         return SD_BLOCK_DEVICE_ERROR_NO_RESPONSE;
     }
+#if SD_CRC_ENABLED
+    // The DMA sniffer computes the checksum as the data arrives
+    if (crc_on) pCrc = &crc_result;
+#endif
     // read data
     // bool spi_transfer(const uint8_t *tx, uint8_t *rx, size_t length)
-    if (!sd_spi_transfer(pSD, NULL, buffer, length)) {
+    if (!sd_spi_transfer_crc(pSD, NULL, buffer, length, pCrc)) {
         return SD_BLOCK_DEVICE_ERROR_NO_RESPONSE;
     }
     // Read the CRC16 checksum for the data block
@@ -826,10 +849,8 @@ static int sd_read_block(sd_card_t *pSD, uint8_t *buffer, uint32_t length) {
 
 #if SD_CRC_ENABLED
     if (crc_on) {
-        uint32_t crc_result;
-        // Compute and verify checksum
-        crc_result = crc16((void *)buffer, length);
-        if ((uint16_t)crc_result != crc) {
+        // Verify checksum
+        if (crc_result != crc) {
             DBG_PRINTF("%s: Invalid CRC received 0x%" PRIx16
                        " result of computation 0x%" PRIx16 "\r\n",
                        __FUNCTION__, crc, (uint16_t)crc_result);
@@ -872,8 +893,8 @@ static int in_sd_read_blocks(sd_card_t *pSD, uint8_t *buffer,
     // receive the data : one block at a time
     int rd_status = 0;
     while (blockCnt) {
-        if (0 != sd_read_block(pSD, buffer, _block_size)) {
-            rd_status = SD_BLOCK_DEVICE_ERROR_NO_RESPONSE;
+        rd_status = sd_read_block(pSD, buffer, _block_size);
+        if (0 != rd_status) {
             break;
         }
         buffer += _block_size;
@@ -886,12 +907,57 @@ static int in_sd_read_blocks(sd_card_t *pSD, uint8_t *buffer,
     return rd_status ? rd_status : status;
 }
 
+static void sd_set_sck_step(sd_card_t *pSD, uint step) {
+    pSD->sck_step = step;
+    pSD->sck_hz = sd_spi_set_frequency(
+        pSD, step ? sd_sck_steps[step - 1] : pSD->spi->baud_rate);
+}
+
+// After a transfer error that a slower clock may cure, drop SCK one step.
+// Returns true if the transfer should be retried.
+static bool sd_sck_fall_back(sd_card_t *pSD, int status) {
+    if (SD_BLOCK_DEVICE_ERROR_CRC != status &&
+        SD_BLOCK_DEVICE_ERROR_NO_RESPONSE != status &&
+        SD_BLOCK_DEVICE_ERROR_NO_DEVICE != status &&
+        SD_BLOCK_DEVICE_ERROR_WRITE != status)
+        return false;
+    if (0 == pSD->sck_step)
+        return false;
+    sd_set_sck_step(pSD, pSD->sck_step - 1);
+    pSD->sck_fallbacks++;
+    DBG_PRINTF("Transfer error %d, SCK down to %u Hz\r\n", status, pSD->sck_hz);
+    return true;
+}
+
+// Step SCK up the ladder while reads at each step pass their CRC check.
+static void sd_sck_step_up(sd_card_t *pSD) {
+#if SD_CRC_ENABLED
+    static uint8_t probe[BLOCK_SIZE_HC];
+
+    if (!crc_on) return;
+    while (pSD->sck_step < count_of(sd_sck_steps)) {
+        sd_set_sck_step(pSD, pSD->sck_step + 1);
+        for (uint32_t i = 0; i < SD_SCK_PROBE_BLOCKS; i++) {
+            if (SD_BLOCK_DEVICE_ERROR_NONE != in_sd_read_blocks(pSD, probe, i, 1)) {
+                sd_set_sck_step(pSD, pSD->sck_step - 1);
+                DBG_PRINTF("SCK settled at %u Hz\r\n", pSD->sck_hz);
+                return;
+            }
+        }
+    }
+    DBG_PRINTF("SCK settled at %u Hz\r\n", pSD->sck_hz);
+#endif
+}
+
 int sd_read_blocks(sd_card_t *pSD, uint8_t *buffer, uint64_t ulSectorNumber,
                    uint32_t ulSectorCount) {
     sd_acquire(pSD);
     TRACE_PRINTF("sd_read_blocks(0x%p, 0x%llx, 0x%lx)\r\n", buffer,
                  ulSectorNumber, ulSectorCount);
-    int status = in_sd_read_blocks(pSD, buffer, ulSectorNumber, ulSectorCount);
+    int status;
+    do {
+        status = in_sd_read_blocks(pSD, buffer, ulSectorNumber, ulSectorCount);
+    } while (sd_sck_fall_back(pSD, status));
     sd_release(pSD);
     return status;
 }
@@ -899,22 +965,21 @@ int sd_read_blocks(sd_card_t *pSD, uint8_t *buffer, uint64_t ulSectorNumber,
 static uint8_t sd_write_block(sd_card_t *pSD, const uint8_t *buffer,
                               uint8_t token, uint32_t length) {
     uint16_t crc = (~0);
+    uint16_t *pCrc = NULL;
     uint8_t response = 0xFF;
 
     // indicate start of block
     sd_spi_write(pSD, token);
 
-    // write the data
-    bool ret = sd_spi_transfer(pSD, buffer, NULL, length);
-    myASSERT(ret);
-
 #if SD_CRC_ENABLED
-    if (crc_on) {
-        // Compute CRC
-        crc = crc16((void *)buffer, length);
-    }
+    // The DMA sniffer computes the CRC as the data goes out
+    if (crc_on) pCrc = &crc;
 #endif
 
+    // write the data
+    bool ret = sd_spi_transfer_crc(pSD, buffer, NULL, length, pCrc);
+    myASSERT(ret);
+
     // write the checksum CRC16
     sd_spi_write(pSD, crc >> 8);
     sd_spi_write(pSD, crc);
@@ -1008,8 +1073,9 @@ static int in_sd_write_blocks(sd_card_t *pSD, const uint8_t *buffer,
     uint32_t stat = 0;
     // Some SD cards want to be deselected between every bus transaction:
     sd_spi_deselect_pulse(pSD);
-    status = sd_cmd(pSD, CMD13_SEND_STATUS, 0, false, &stat);
-    return status;
+    int st = sd_cmd(pSD, CMD13_SEND_STATUS, 0, false, &stat);
+    // Keep a rejected block's error, so that it is retried
+    return status ? status : st;
 }
 
 int sd_write_blocks(sd_card_t *pSD, const uint8_t *buffer,
@@ -1017,11 +1083,332 @@ int sd_write_blocks(sd_card_t *pSD, const uint8_t *buffer,
     sd_acquire(pSD);
     TRACE_PRINTF("sd_write_blocks(0x%p, 0x%llx, 0x%lx)\r\n", buffer,
                  ulSectorNumber, blockCnt);
-    int status = in_sd_write_blocks(pSD, buffer, ulSectorNumber, blockCnt);
+    int status;
+    do {
+        status = in_sd_write_blocks(pSD, buffer, ulSectorNumber, blockCnt);
+    } while (sd_sck_fall_back(pSD, status));
     sd_release(pSD);
     return status;
 }
 
+/* Asynchronous block I/O
+ *
+ * The command is sent by the caller, which takes a few bytes' time, and the
+ * rest runs from interrupts. Each block moves by DMA, and the DMA interrupt
+ * moves the state machine on. Waits for the card, for the start token
+ * before each block read and while it programs each block written, read a
+ * few bytes at a time from a timer alarm, leaving the CPU free between
+ * polls. Bytes exchanged in interrupt context poll the SPI directly, as
+ * sd_spi_write() waits for the DMA interrupt.
+ */
+enum {
+    SD_ASYNC_IDLE,
+    SD_ASYNC_READ_TOKEN,  // Waiting for the start token of a block
+    SD_ASYNC_READ_DATA,   // Block coming in by DMA
+    SD_ASYNC_WRITE_DATA,  // Block going out by DMA
+    SD_ASYNC_WRITE_BUSY,  // Card programming a block
+    SD_ASYNC_STOP_BUSY    // Card finishing after a multiple block transfer
+};
+
+#define SD_ASYNC_POLL_BYTES 8  /*!< Bytes read each time the card is polled */
+#define SD_ASYNC_POLL_US 20    /*!< Time between polls */
+
+static void sd_async_wait_card(sd_card_t *pSD);
+
+static uint8_t sd_async_xchg(sd_card_t *pSD, uint8_t value) {
+    uint8_t received;
+    spi_write_read_blocking(pSD->spi->hw_inst, &value, &received, 1);
+    return received;
+}
+
+static void sd_async_finish(sd_card_t *pSD, int status) {
+    sd_async_t *a = &pSD->async;
+
+    if (SD_BLOCK_DEVICE_ERROR_NONE == a->status) a->status = status;
+    sd_spi_deselect(pSD);
+    pSD->spi->async_done = NULL;
+    // SCK is changed by the next caller, not from the interrupt
+    a->fall_back = SD_BLOCK_DEVICE_ERROR_NONE != a->status;
+    a->state = SD_ASYNC_IDLE;
+    a->busy = false;
+    a->callback(a->status, a->context);
+}
+
+// End the transfer, stopping a multiple block transfer first
+static void sd_async_stop(sd_card_t *pSD, int status) {
+    sd_async_t *a = &pSD->async;
+
+    if (SD_BLOCK_DEVICE_ERROR_NONE == a->status) a->status = status;
+    if (!a->multi) {
+        sd_async_finish(pSD, status);
+        return;
+    }
+    if (a->write) {
+        sd_async_xchg(pSD, SPI_STOP_TRAN);
+        sd_async_xchg(pSD, SPI_FILL_CHAR);  // The card goes busy after a byte
+    } else {
+        char cmdPacket[PACKET_SIZE];
+        uint8_t response = R1_NO_RESPONSE;
+
+        sd_cmd_packet(CMD12_STOP_TRANSMISSION, 0, cmdPacket);
+        for (int i = 0; i < PACKET_SIZE; i++) {
+            sd_async_xchg(pSD, cmdPacket[i]);
+        }
+        sd_async_xchg(pSD, SPI_FILL_CHAR);  // Stuff byte
+        for (int i = 0; i < 0x10 && (response & R1_RESPONSE_RECV); i++) {
+            response = sd_async_xchg(pSD, SPI_FILL_CHAR);
+        }
+        if (response & R1_RESPONSE_RECV) {
+            sd_async_finish(pSD, SD_BLOCK_DEVICE_ERROR_NO_RESPONSE);
+            return;
+        }
+    }
+    a->state = SD_ASYNC_STOP_BUSY;
+    a->timeout = make_timeout_time_ms(SD_COMMAND_TIMEOUT);
+    sd_async_wait_card(pSD);
+}
+
+static void sd_async_write_block(sd_card_t *pSD) {
+    sd_async_t *a = &pSD->async;
+    bool crc = false;
+
+#if SD_CRC_ENABLED
+    crc = crc_on;
+#endif
+    a->state = SD_ASYNC_WRITE_DATA;
+    sd_async_xchg(pSD, a->multi ? SPI_START_BLK_MUL_WRITE : SPI_START_BLOCK);
+    spi_transfer_start(pSD->spi, a->buffer, NULL, _block_size, crc);
+}
+
+static void sd_async_read_block(sd_card_t *pSD) {
+    sd_async_t *a = &pSD->async;
+    bool crc = false;
+
+#if SD_CRC_ENABLED
+    crc = crc_on;
+#endif
+    a->state = SD_ASYNC_READ_DATA;
+    spi_transfer_start(pSD->spi, NULL, a->buffer, _block_size, crc);
+}
+
+// The card sent the start token or stopped being busy
+static void sd_async_card_ready(sd_card_t *pSD) {
+    sd_async_t *a = &pSD->async;
+
+    switch (a->state) {
+        case SD_ASYNC_READ_TOKEN:
+            sd_async_read_block(pSD);
+            break;
+        case SD_ASYNC_WRITE_BUSY:
+            a->buffer += _block_size;
+            if (SD_BLOCK_DEVICE_ERROR_NONE == a->status && --a->blocks) {
+                sd_async_write_block(pSD);
+            } else {
+                sd_async_stop(pSD, SD_BLOCK_DEVICE_ERROR_NONE);
+            }
+            break;
+        case SD_ASYNC_STOP_BUSY:
+            sd_async_finish(pSD, SD_BLOCK_DEVICE_ERROR_NONE);
+            break;
+    }
+}
+
+// Read a few bytes from the card. Returns true if it needs polling again.
+static bool sd_async_poll(sd_card_t *pSD) {
+    sd_async_t *a = &pSD->async;
+
+    for (int i = 0; i < SD_ASYNC_POLL_BYTES; i++) {
+        uint8_t response = sd_async_xchg(pSD, SPI_FILL_CHAR);
+
+        if (SD_ASYNC_READ_TOKEN == a->state) {
+            if (SPI_START_BLOCK == response) {
+                sd_async_card_ready(pSD);
+                return false;
+            }
+            if (response && !(response & ~SPI_DATA_READ_ERROR_MASK)) {
+                // Data error token
+                sd_async_stop(pSD, SD_BLOCK_DEVICE_ERROR_NO_RESPONSE);
+                return false;
+            }
+        } else if (0x00 != response) {
+            sd_async_card_ready(pSD);
+            return false;
+        }
+    }
+    if (0 >= absolute_time_diff_us(get_absolute_time(), a->timeout)) {
+        DBG_PRINTF("%s: timeout in state %d\r\n", __FUNCTION__, a->state);
+        if (SD_ASYNC_STOP_BUSY == a->state) {
+            sd_async_finish(pSD, SD_BLOCK_DEVICE_ERROR_NO_RESPONSE);
+        } else {
+            sd_async_stop(pSD, SD_BLOCK_DEVICE_ERROR_NO_RESPONSE);
+        }
+        return false;
+    }
+    return true;
+}
+
+static int64_t sd_async_alarm(alarm_id_t id, void *user_data) {
+    (void)id;
+    // Negative: poll again this long after now
+    return sd_async_poll(user_data) ? -SD_ASYNC_POLL_US : 0;
+}
+
+static void sd_async_wait_card(sd_card_t *pSD) {
+    if (sd_async_poll(pSD)) {
+        if (add_alarm_in_us(SD_ASYNC_POLL_US, sd_async_alarm, pSD, true) < 0) {
+            sd_async_finish(pSD, SD_BLOCK_DEVICE_ERROR_NO_INIT);
+        }
+    }
+}
+
+// DMA interrupt: a block has been transferred
+static void sd_async_dma_done(void *context) {
+    sd_card_t *pSD = context;
+    sd_async_t *a = &pSD->async;
+    uint16_t crc = 0xFFFF;
+    bool crc_checked = false;
+
+#if SD_CRC_ENABLED
+    if (crc_on) {
+        crc = spi_transfer_crc_result();
+        crc_checked = true;
+    }
+#endif
+    if (SD_ASYNC_READ_DATA == a->state) {
+        uint16_t received = sd_async_xchg(pSD, SPI_FILL_CHAR) << 8;
+        received |= sd_async_xchg(pSD, SPI_FILL_CHAR);
+        if (crc_checked && received != crc) {
+            DBG_PRINTF("%s: Invalid CRC received 0x%" PRIx16
+                       " result of computation 0x%" PRIx16 "\r\n",
+                       __FUNCTION__, received, crc);
+            sd_async_stop(pSD, SD_BLOCK_DEVICE_ERROR_CRC);
+            return;
+        }
+        a->buffer += _block_size;
+        if (--a->blocks) {
+            a->state = SD_ASYNC_READ_TOKEN;
+            a->timeout = make_timeout_time_ms(SD_COMMAND_TIMEOUT);
+            sd_async_wait_card(pSD);
+        } else {
+            sd_async_stop(pSD, SD_BLOCK_DEVICE_ERROR_NONE);
+        }
+    } else {
+        sd_async_xchg(pSD, crc >> 8);
+        sd_async_xchg(pSD, crc);
+        uint8_t response = sd_async_xchg(pSD, SPI_FILL_CHAR);
+        // Only CRC and general write error are communicated via response token
+        if ((response & SPI_DATA_RESPONSE_MASK) != SPI_DATA_ACCEPTED) {
+            DBG_PRINTF("%s: Block write failed: 0x%x\r\n", __FUNCTION__, response);
+            a->status = SD_BLOCK_DEVICE_ERROR_WRITE;
+        }
+        a->state = SD_ASYNC_WRITE_BUSY;
+        a->timeout = make_timeout_time_ms(SD_COMMAND_TIMEOUT);
+        sd_async_wait_card(pSD);
+    }
+}
+
+// Wait for an asynchronous transfer to finish, then apply a fall back it
+// asked for. Called with the card locked.
+static void sd_async_wait(sd_card_t *pSD) {
+    sd_async_t *a = &pSD->async;
+
+    while (a->busy) tight_loop_contents();
+    if (a->fall_back) {
+        a->fall_back = false;
+        sd_sck_fall_back(pSD, a->status);
+    }
+}
+
+static int sd_async_start(sd_card_t *pSD, bool write, uint8_t *buffer,
+                          uint64_t ulSectorNumber, uint32_t blockCnt,
+                          sd_async_callback_t callback, void *context) {
+    sd_async_t *a = &pSD->async;
+    int status;
+    uint64_t addr;
+
+    if (0 == blockCnt || NULL == callback)
+        return SD_BLOCK_DEVICE_ERROR_PARAMETER;
+
+    sd_lock(pSD);
+    sd_async_wait(pSD);
+    if (ulSectorNumber + blockCnt > pSD->sectors ||
+        (pSD->m_Status & (STA_NOINIT | STA_NODISK))) {
+        sd_unlock(pSD);
+        return SD_BLOCK_DEVICE_ERROR_PARAMETER;
+    }
+    sd_spi_acquire(pSD);
+
+    // SDSC Card (CCS=0) uses byte unit address
+    // SDHC and SDXC Cards (CCS=1) use block unit address (512 Bytes unit)
+    if (SDCARD_V2HC == pSD->card_type) {
+        addr = ulSectorNumber;
+    } else {
+        addr = ulSectorNumber * _block_size;
+    }
+    if (write && blockCnt > 1) {
+        // Pre-erase setting prior to multiple block write operation
+        sd_cmd(pSD, ACMD23_SET_WR_BLK_ERASE_COUNT, blockCnt, 1, 0);
+        // Some SD cards want to be deselected between every bus transaction:
+        sd_spi_deselect_pulse(pSD);
+        status = sd_cmd(pSD, CMD25_WRITE_MULTIPLE_BLOCK, addr, false, 0);
+    } else if (write) {
+        status = sd_cmd(pSD, CMD24_WRITE_BLOCK, addr, false, 0);
+    } else if (blockCnt > 1) {
+        status = sd_cmd(pSD, CMD18_READ_MULTIPLE_BLOCK, addr, false, 0);
+    } else {
+        status = sd_cmd(pSD, CMD17_READ_SINGLE_BLOCK, addr, false, 0);
+    }
+    if (SD_BLOCK_DEVICE_ERROR_NONE != status) {
+        sd_release(pSD);
+        return status;
+    }
+
+    a->write = write;
+    a->multi = blockCnt > 1;
+    a->buffer = buffer;
+    a->blocks = blockCnt;
+    a->status = SD_BLOCK_DEVICE_ERROR_NONE;
+    a->callback = callback;
+    a->context = context;
+    a->busy = true;
+    pSD->spi->async_context = pSD;
+    pSD->spi->async_done = sd_async_dma_done;
+
+    if (write) {
+        sd_async_write_block(pSD);
+    } else {
+        a->state = SD_ASYNC_READ_TOKEN;
+        a->timeout = make_timeout_time_ms(SD_COMMAND_TIMEOUT);
+        sd_async_wait_card(pSD);
+    }
+
+    // CS stays asserted until the transfer finishes. Synchronous calls wait
+    // for it in sd_acquire().
+    spi_unlock(pSD->spi);
+    sd_unlock(pSD);
+    return SD_BLOCK_DEVICE_ERROR_NONE;
+}
+
+int sd_read_blocks_async(sd_card_t *pSD, uint8_t *buffer, uint64_t ulSectorNumber,
+                         uint32_t blockCnt, sd_async_callback_t callback, void *context) {
+    TRACE_PRINTF("%s(0x%p, 0x%llx, 0x%lx)\r\n", __FUNCTION__, buffer,
+                 ulSectorNumber, blockCnt);
+    return sd_async_start(pSD, false, buffer, ulSectorNumber, blockCnt,
+                          callback, context);
+}
+
+int sd_write_blocks_async(sd_card_t *pSD, const uint8_t *buffer, uint64_t ulSectorNumber,
+                          uint32_t blockCnt, sd_async_callback_t callback, void *context) {
+    TRACE_PRINTF("%s(0x%p, 0x%llx, 0x%lx)\r\n", __FUNCTION__, buffer,
+                 ulSectorNumber, blockCnt);
+    return sd_async_start(pSD, true, (uint8_t *)buffer, ulSectorNumber, blockCnt,
+                          callback, context);
+}
+
+bool sd_async_busy(sd_card_t *pSD) {
+    return pSD->async.busy;
+}
+
 static int sd_init_medium(sd_card_t *pSD) {
     int32_t status = SD_BLOCK_DEVICE_ERROR_NONE;
     uint32_t response, arg;
@@ -1139,6 +1526,7 @@ int sd_init(sd_card_t *pSD) {
 
     if (!mutex_is_initialized(&pSD->mutex)) mutex_init(&pSD->mutex);
     sd_lock(pSD);
+    sd_async_wait(pSD);
 
     // Make sure there's a card in the socket before proceeding
     sd_card_detect(pSD);
@@ -1179,11 +1567,14 @@ int sd_init(sd_card_t *pSD) {
         return pSD->m_Status;
     }
     // Set SCK for data transfer
-    sd_spi_go_high_frequency(pSD);
+    sd_set_sck_step(pSD, 0);
 
     // The card is now initialized
     pSD->m_Status &= ~STA_NOINIT;
 
+    // Then find out how fast it can go
+    sd_sck_step_up(pSD);
+
     sd_spi_release(pSD);
     sd_unlock(pSD);
 
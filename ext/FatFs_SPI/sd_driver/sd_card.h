@@ -22,6 +22,7 @@ specific language governing permissions and limitations under the License.
 //
 #include "hardware/gpio.h"
 #include "pico/mutex.h"
+#include "pico/time.h"
 //
 #include "ff.h"
 //
@@ -31,6 +32,25 @@ specific language governing permissions and limitations under the License.
 extern "C" {
 #endif
 
+// Called from interrupt context when an asynchronous transfer finishes, with
+// SD_BLOCK_DEVICE_ERROR_NONE or the error. It must not start another transfer.
+typedef void (*sd_async_callback_t)(int status, void *context);
+
+// State of an asynchronous transfer
+typedef struct {
+    volatile bool busy;         // A transfer is in progress
+    volatile uint8_t state;
+    bool write;
+    bool multi;                 // CMD18/CMD25, stopped when done
+    bool fall_back;             // Drop SCK a step before the next transfer
+    uint8_t *buffer;            // Next block
+    uint32_t blocks;            // Blocks left, including the current one
+    int status;                 // First error
+    absolute_time_t timeout;    // For the current wait on the card
+    sd_async_callback_t callback;
+    void *context;
+} sd_async_t;
+
 // "Class" representing SD Cards
 typedef struct {
     const char *pcName;
@@ -50,6 +70,10 @@ typedef struct {
     int m_Status;                                    // Card status
     uint64_t sectors;                                // Assigned dynamically
     int card_type;                                   // Assigned dynamically
+    uint sck_step;                                   // Current step of the SCK ladder
+    uint sck_hz;                                     // Actual SCK frequency
+    uint32_t sck_fallbacks;                          // Steps down after transfer errors
+    sd_async_t async;
     mutex_t mutex;
     FATFS fatfs;
     bool mounted;
@@ -83,6 +107,19 @@ int sd_write_blocks(sd_card_t *pSD, const uint8_t *buffer,
 int sd_read_blocks(sd_card_t *pSD, uint8_t *buffer, uint64_t ulSectorNumber,
                    uint32_t ulSectorCount);
 bool sd_card_detect(sd_card_t *pSD);
+
+// Start reading or writing blockCnt blocks and return without waiting for
+// the data. The buffer must stay valid until the callback is called. Blocks
+// move by DMA, and waits for the card are polled from a timer alarm, so the
+// caller's core is only interrupted briefly between blocks. Synchronous
+// calls wait for an asynchronous transfer to finish. Returns
+// SD_BLOCK_DEVICE_ERROR_NONE if the transfer was started, and the callback
+// is called only then.
+int sd_read_blocks_async(sd_card_t *pSD, uint8_t *buffer, uint64_t ulSectorNumber,
+                         uint32_t blockCnt, sd_async_callback_t callback, void *context);
+int sd_write_blocks_async(sd_card_t *pSD, const uint8_t *buffer, uint64_t ulSectorNumber,
+                          uint32_t blockCnt, sd_async_callback_t callback, void *context);
+bool sd_async_busy(sd_card_t *pSD);
 uint64_t sd_sectors(sd_card_t *pSD);
 
 #ifdef __cplusplus
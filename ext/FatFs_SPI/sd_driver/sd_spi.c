@@ -27,13 +27,16 @@ specific language governing permissions and limitations under the License.
 //#define TRACE_PRINTF(fmt, args...)
 #define TRACE_PRINTF printf  // task_printf
 
-void sd_spi_go_high_frequency(sd_card_t *pSD) {
-    uint actual = spi_set_baudrate(pSD->spi->hw_inst, pSD->spi->baud_rate);
+uint sd_spi_set_frequency(sd_card_t *pSD, uint hz) {
+    uint actual = spi_set_sck(pSD->spi, hz);
     TRACE_PRINTF("%s: Actual frequency: %lu\n", __FUNCTION__, (long)actual);
+    return actual;
+}
+void sd_spi_go_high_frequency(sd_card_t *pSD) {
+    pSD->sck_hz = sd_spi_set_frequency(pSD, pSD->spi->baud_rate);
 }
 void sd_spi_go_low_frequency(sd_card_t *pSD) {
-    uint actual = spi_set_baudrate(pSD->spi->hw_inst, 400 * 1000); // Actual frequency: 398089
-    TRACE_PRINTF("%s: Actual frequency: %lu\n", __FUNCTION__, (long)actual);
+    pSD->sck_hz = sd_spi_set_frequency(pSD, 400 * 1000);
 }
 
 static void sd_spi_lock(sd_card_t *pSD) {
@@ -52,7 +55,7 @@ static void sd_spi_select(sd_card_t *pSD) {
     LED_ON();
 }
 
-static void sd_spi_deselect(sd_card_t *pSD) {
+void sd_spi_deselect(sd_card_t *pSD) {
     gpio_put(pSD->ss_gpio, 1);
     LED_OFF();
     /*
@@ -86,6 +89,11 @@ bool sd_spi_transfer(sd_card_t *pSD, const uint8_t *tx, uint8_t *rx,
     return spi_transfer(pSD->spi, tx, rx, length);
 }
 
+bool sd_spi_transfer_crc(sd_card_t *pSD, const uint8_t *tx, uint8_t *rx,
+                         size_t length, uint16_t *crc) {
+    return spi_transfer_crc(pSD->spi, tx, rx, length, crc);
+}
+
 uint8_t sd_spi_write(sd_card_t *pSD, const uint8_t value) {
     // TRACE_PRINTF("%s\n", __FUNCTION__);
     uint8_t received = SPI_FILL_CHAR;
@@ -21,12 +21,20 @@ specific language governing permissions and limitations under the License.
 /* Transfer tx to SPI while receiving SPI to rx. 
 tx or rx can be NULL if not important. */
 bool sd_spi_transfer(sd_card_t *pSD, const uint8_t *tx, uint8_t *rx, size_t length);
+/* As sd_spi_transfer, also returning the CRC16 of the data in *crc. */
+bool sd_spi_transfer_crc(sd_card_t *pSD, const uint8_t *tx, uint8_t *rx, size_t length,
+                         uint16_t *crc);
 uint8_t sd_spi_write(sd_card_t *pSD, const uint8_t value);
 void sd_spi_deselect_pulse(sd_card_t *pSD);
+/* Raise CS without unlocking the SPI. Only polls the SPI, so it can be
+used from an interrupt handler. */
+void sd_spi_deselect(sd_card_t *pSD);
 void sd_spi_acquire(sd_card_t *pSD);
 void sd_spi_release(sd_card_t *pSD);
 void sd_spi_go_low_frequency(sd_card_t *this);
 void sd_spi_go_high_frequency(sd_card_t *this);
+/* Set SCK to at most hz. Returns the actual frequency. */
+uint sd_spi_set_frequency(sd_card_t *pSD, uint hz);
 
 /* 
 After power up, the host starts the clock and sends the initializing sequence on the CMD line. 
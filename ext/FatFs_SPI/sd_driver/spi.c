@@ -17,6 +17,7 @@ specific language governing permissions and limitations under the License.
 #include "pico/stdlib.h"
 #include "pico/mutex.h"
 #include "pico/sem.h"
+#include "hardware/clocks.h"
 //
 #include "my_debug.h"
 //
@@ -25,18 +26,27 @@ specific language governing permissions and limitations under the License.
 static bool irqChannel1 = false;
 static bool irqShared = true;
 
+// Wake the waiting spi_transfer(), or move an asynchronous transfer on
+static void spi_dma_done(spi_t *pSPI) {
+    if (pSPI->async_done) {
+        pSPI->async_done(pSPI->async_context);
+    } else {
+        sem_release(&pSPI->sem);
+    }
+}
+
 void spi_irq_handler(spi_t *pSPI) {
     if (irqChannel1) {
         if (dma_hw->ints1 & 1u << pSPI->rx_dma) {  // Ours?
             dma_hw->ints1 = 1u << pSPI->rx_dma;    // clear it
             myASSERT(!dma_channel_is_busy(pSPI->rx_dma));
-            sem_release(&pSPI->sem);
+            spi_dma_done(pSPI);
         }
     } else {
         if (dma_hw->ints0 & 1u << pSPI->rx_dma) {  // Ours?
             dma_hw->ints0 = 1u << pSPI->rx_dma;    // clear it
             myASSERT(!dma_channel_is_busy(pSPI->rx_dma));
-            sem_release(&pSPI->sem);
+            spi_dma_done(pSPI);
         }
     }
 }
@@ -52,10 +62,55 @@ void set_spi_dma_irq_channel(bool useChannel1, bool shared) {
 //     pass NULL as tx and then the SPI_FILL_CHAR is sent out as each data
 //     element.
 bool spi_transfer(spi_t *pSPI, const uint8_t *tx, uint8_t *rx, size_t length) {
+    return spi_transfer_crc(pSPI, tx, rx, length, NULL);
+}
+
+// If crc is not NULL, the DMA sniffer computes the CRC16 of the data on the
+// channel that carries it (rx if there is an rx buffer, tx otherwise) as it
+// is transferred, so checking a data block costs no CPU time. The sniffer is
+// shared by all channels; nothing else uses it while the SPI is locked.
+bool spi_transfer_crc(spi_t *pSPI, const uint8_t *tx, uint8_t *rx, size_t length,
+                      uint16_t *crc) {
+    spi_transfer_start(pSPI, tx, rx, length, crc != NULL);
+
+    /* Timeout 1 sec */
+    uint32_t timeOut = 1000;
+    /* Wait until master completes transfer or time out has occured. */
+    bool rc = sem_acquire_timeout_ms(
+        &pSPI->sem, timeOut);  // Wait for notification from ISR
+    if (!rc) {
+        // If the timeout is reached the function will return false
+        DBG_PRINTF("Notification wait timed out in %s\n", __FUNCTION__);
+        if (crc) dma_sniffer_disable();
+        return false;
+    }
+    // Shouldn't be necessary:
+    dma_channel_wait_for_finish_blocking(pSPI->tx_dma);
+    dma_channel_wait_for_finish_blocking(pSPI->rx_dma);
+
+    myASSERT(!dma_channel_is_busy(pSPI->tx_dma));
+    myASSERT(!dma_channel_is_busy(pSPI->rx_dma));
+
+    if (crc) *crc = spi_transfer_crc_result();
+    return true;
+}
+
+// Start the DMA for a transfer and return. Completion is signalled from the
+// DMA interrupt: to spi_transfer(), or to pSPI->async_done if it is set.
+void spi_transfer_start(spi_t *pSPI, const uint8_t *tx, uint8_t *rx, size_t length,
+                        bool crc) {
     // myASSERT(512 == length || 1 == length);
     myASSERT(tx || rx);
     // myASSERT(!(tx && rx));
 
+    channel_config_set_sniff_enable(&pSPI->tx_dma_cfg, crc && !rx);
+    channel_config_set_sniff_enable(&pSPI->rx_dma_cfg, crc && rx);
+    if (crc) {
+        dma_sniffer_enable(rx ? pSPI->rx_dma : pSPI->tx_dma,
+                           DMA_SNIFF_CTRL_CALC_VALUE_CRC16, true);
+        dma_hw->sniff_data = 0;
+    }
+
     // tx write increment is already false
     if (tx) {
         channel_config_set_read_increment(&pSPI->tx_dma_cfg, true);
@@ -92,25 +147,34 @@ bool spi_transfer(spi_t *pSPI, const uint8_t *tx, uint8_t *rx, size_t length) {
     // start them exactly simultaneously to avoid races (in extreme cases
     // the FIFO could overflow)
     dma_start_channel_mask((1u << pSPI->tx_dma) | (1u << pSPI->rx_dma));
+}
 
-    /* Timeout 1 sec */
-    uint32_t timeOut = 1000;
-    /* Wait until master completes transfer or time out has occured. */
-    bool rc = sem_acquire_timeout_ms(
-        &pSPI->sem, timeOut);  // Wait for notification from ISR
-    if (!rc) {
-        // If the timeout is reached the function will return false
-        DBG_PRINTF("Notification wait timed out in %s\n", __FUNCTION__);
-        return false;
-    }
-    // Shouldn't be necessary:
-    dma_channel_wait_for_finish_blocking(pSPI->tx_dma);
-    dma_channel_wait_for_finish_blocking(pSPI->rx_dma);
+// The CRC16 of a finished transfer started with crc set. Frees the sniffer.
+uint16_t spi_transfer_crc_result(void) {
+    uint16_t crc = (uint16_t)dma_hw->sniff_data;
+    dma_sniffer_disable();
+    return crc;
+}
 
-    myASSERT(!dma_channel_is_busy(pSPI->tx_dma));
-    myASSERT(!dma_channel_is_busy(pSPI->rx_dma));
+// Set SCK to the fastest rate that does not exceed baudrate. Unlike
+// spi_set_baudrate(), this works from the measured clk_peri, which can
+// differ from what the clock driver was told when clk_peri was configured.
+uint spi_set_sck(spi_t *pSPI, uint baudrate) {
+    const uint freq_in = pSPI->clk_peri_hz;
+    uint prescale, postdiv;
 
-    return true;
+    // Even prescale from 2 to 254, then a post divide from 1 to 256
+    for (prescale = 2; prescale < 254; prescale += 2) {
+        if ((uint64_t)prescale * 256 * baudrate >= freq_in) break;
+    }
+    postdiv = (freq_in + prescale * baudrate - 1) / (prescale * baudrate);
+    if (postdiv < 1) postdiv = 1;
+    if (postdiv > 256) postdiv = 256;
+
+    spi_get_hw(pSPI->hw_inst)->cpsr = prescale;
+    hw_write_masked(&spi_get_hw(pSPI->hw_inst)->cr0,
+                    (postdiv - 1) << SPI_SSPCR0_SCR_LSB, SPI_SSPCR0_SCR_BITS);
+    return freq_in / (prescale * postdiv);
 }
 
 void spi_lock(spi_t *pSPI) {
@@ -139,6 +203,7 @@ bool my_spi_init(spi_t *pSPI) {
         // Enable SPI at 100 kHz and connect to GPIOs
         spi_init(pSPI->hw_inst, 100 * 1000);
         spi_set_format(pSPI->hw_inst, 8, SPI_CPOL_0, SPI_CPHA_0, SPI_MSB_FIRST);
+        pSPI->clk_peri_hz = frequency_count_khz(CLOCKS_FC0_SRC_VALUE_CLK_PERI) * 1000;
 
         gpio_set_function(pSPI->miso_gpio, GPIO_FUNC_SPI);
         gpio_set_function(pSPI->mosi_gpio, GPIO_FUNC_SPI);
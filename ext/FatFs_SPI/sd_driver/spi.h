@@ -35,6 +35,7 @@ typedef struct {
     uint mosi_gpio;
     uint sck_gpio;
     uint baud_rate;
+    uint clk_peri_hz;  // Measured at init, for setting SCK
 
     // Drive strength levels for GPIO outputs.
     // enum gpio_drive_strength { GPIO_DRIVE_STRENGTH_2MA = 0, GPIO_DRIVE_STRENGTH_4MA = 1, GPIO_DRIVE_STRENGTH_8MA = 2,
@@ -49,6 +50,10 @@ typedef struct {
     dma_channel_config tx_dma_cfg;
     dma_channel_config rx_dma_cfg;
     irq_handler_t dma_isr;
+    // If set, called from the DMA interrupt when a transfer started with
+    // spi_transfer_start() completes, instead of waking spi_transfer().
+    void (*async_done)(void *context);
+    void *async_context;
     bool initialized;  
     semaphore_t sem;
     mutex_t mutex;    
@@ -62,6 +67,14 @@ extern "C" {
 void __not_in_flash_func(spi_irq_handler)(spi_t *pSPI);
   
 bool __not_in_flash_func(spi_transfer)(spi_t *pSPI, const uint8_t *tx, uint8_t *rx, size_t length);  
+// As spi_transfer, also setting *crc to the CRC16 (CCITT) of the data
+// transferred, computed by the DMA sniffer.
+bool __not_in_flash_func(spi_transfer_crc)(spi_t *pSPI, const uint8_t *tx, uint8_t *rx, size_t length,
+                                           uint16_t *crc);
+void __not_in_flash_func(spi_transfer_start)(spi_t *pSPI, const uint8_t *tx, uint8_t *rx, size_t length,
+                                             bool crc);
+uint16_t spi_transfer_crc_result(void);
+uint spi_set_sck(spi_t *pSPI, uint baudrate);
 void spi_lock(spi_t *pSPI);
 void spi_unlock(spi_t *pSPI);
 bool my_spi_init(spi_t *pSPI);
@@ -45,10 +45,12 @@ i2s_config_t i2s_get_default_config(void) {
 }
 
 /**
- * Initialize the I2S driver. Must be called before calling i2s_write or i2s_dma_write
+ * Set up the pins and the PIO state machine, leaving the state machine
+ * disabled. Used by i2s_init and by callers that drive the TX FIFO with
+ * their own DMA.
  * i2s_config: I2S context obtained by i2s_get_default_config()
  */
-void i2s_init(i2s_config_t *i2s_config) {
+void i2s_pio_init(i2s_config_t *i2s_config) {
     uint8_t func=GPIO_FUNC_PIO0;    // TODO: GPIO_FUNC_PIO0 for pio0 or GPIO_FUNC_PIO1 for pio1
     gpio_set_function(i2s_config->data_pin, GPIO_FUNC_PIO0);
     gpio_set_function(i2s_config->clock_pin_base, GPIO_FUNC_PIO0);
@@ -66,6 +68,14 @@ void i2s_init(i2s_config_t *i2s_config) {
     pio_sm_set_clkdiv_int_frac(i2s_config->pio, i2s_config->sm , divider >> 8u, divider & 0xffu);
 
     pio_sm_set_enabled(i2s_config->pio, i2s_config->sm, false);
+}
+
+/**
+ * Initialize the I2S driver. Must be called before calling i2s_write or i2s_dma_write
+ * i2s_config: I2S context obtained by i2s_get_default_config()
+ */
+void i2s_init(i2s_config_t *i2s_config) {
+    i2s_pio_init(i2s_config);
 
     /* Allocate memory for the DMA buffer */
     i2s_config->dma_buf=malloc(i2s_config->dma_trans_count*sizeof(uint32_t));
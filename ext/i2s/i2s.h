@@ -47,6 +47,7 @@ typedef struct i2s_config
 
 
 i2s_config_t i2s_get_default_config(void);
+void i2s_pio_init(i2s_config_t *i2s_config);
 void i2s_init(i2s_config_t *i2s_config);
 void i2s_write(const i2s_config_t *i2s_config,const int16_t *samples,const size_t len);
 void i2s_dma_write(i2s_config_t *i2s_config,const int16_t *samples);
@@ -14,7 +14,6 @@
 #define DMG_CLOCK_FREQ_U	((unsigned)DMG_CLOCK_FREQ)
 #define AUDIO_NSAMPLES		(AUDIO_SAMPLES * 2u)
 
-#define AUDIO_MEM_SIZE		(0xFF3F - 0xFF10 + 1)
 #define AUDIO_ADDR_COMPENSATION	0xFF10
 
 #define MAX(a, b)		( a > b ? a : b )
@@ -31,92 +30,30 @@
 
 #define MAX_CHAN_VOLUME		15
 
-/**
- * Memory holding audio registers between 0xFF10 and 0xFF3F inclusive.
- */
-static uint8_t audio_mem[AUDIO_MEM_SIZE];
-
-struct chan_len_ctr {
-	uint8_t load;
-	unsigned enabled : 1;
-	uint32_t counter;
-	uint32_t inc;
-};
-
-struct chan_vol_env {
-	uint8_t step;
-	unsigned up : 1;
-	uint32_t counter;
-	uint32_t inc;
-};
-
-struct chan_freq_sweep {
-	uint16_t freq;
-	uint8_t rate;
-	uint8_t shift;
-	unsigned up : 1;
-	uint32_t counter;
-	uint32_t inc;
-};
-
-static struct chan {
-	unsigned enabled : 1;
-	unsigned powered : 1;
-	unsigned on_left : 1;
-	unsigned on_right : 1;
-	unsigned muted : 1;
-
-	uint8_t volume;
-	uint8_t volume_init;
-
-	uint16_t freq;
-	uint32_t freq_counter;
-	uint32_t freq_inc;
-
-	int_fast16_t val;
-
-	struct chan_len_ctr    len;
-	struct chan_vol_env    env;
-	struct chan_freq_sweep sweep;
-
-	union {
-		struct {
-			uint8_t duty;
-			uint8_t duty_counter;
-		} square;
-		struct {
-			uint16_t lfsr_reg;
-			uint8_t  lfsr_wide;
-			uint8_t  lfsr_div;
-		} noise;
-		struct {
-			uint8_t sample;
-		} wave;
-	};
-} chans[4];
-
-static int32_t vol_l, vol_r;
+/* Context used by the compatibility functions. */
+static struct minigb_apu_ctx apu_ctx;
 
-static void set_note_freq(struct chan *c, const uint32_t freq)
+static void set_note_freq(struct minigb_apu_chan *c, const uint32_t freq)
 {
 	/* Lowest expected value of freq is 64. */
 	c->freq_inc = freq * (uint32_t)(FREQ_INC_REF / AUDIO_SAMPLE_RATE);
 }
 
-static void chan_enable(const uint_fast8_t i, const bool enable)
+static void chan_enable(struct minigb_apu_ctx *hnd,
+		const uint_fast8_t i, const bool enable)
 {
 	uint8_t val;
 
-	chans[i].enabled = enable;
-	val = (audio_mem[0xFF26 - AUDIO_ADDR_COMPENSATION] & 0x80) |
-		(chans[3].enabled << 3) | (chans[2].enabled << 2) |
-		(chans[1].enabled << 1) | (chans[0].enabled << 0);
+	hnd->chans[i].enabled = enable;
+	val = (hnd->audio_mem[0xFF26 - AUDIO_ADDR_COMPENSATION] & 0x80) |
+		(hnd->chans[3].enabled << 3) | (hnd->chans[2].enabled << 2) |
+		(hnd->chans[1].enabled << 1) | (hnd->chans[0].enabled << 0);
 
-	audio_mem[0xFF26 - AUDIO_ADDR_COMPENSATION] = val;
+	hnd->audio_mem[0xFF26 - AUDIO_ADDR_COMPENSATION] = val;
 	//audio_mem[0xFF26 - AUDIO_ADDR_COMPENSATION] |= 0x80 | ((uint8_t)enable) << i;
 }
 
-static void update_env(struct chan *c)
+static void update_env(struct minigb_apu_chan *c)
 {
 	c->env.counter += c->env.inc;
 
@@ -132,19 +69,19 @@ static void update_env(struct chan *c)
 	}
 }
 
-static void update_len(struct chan *c)
+static void update_len(struct minigb_apu_ctx *hnd, struct minigb_apu_chan *c)
 {
 	if (!c->len.enabled)
 		return;
 
 	c->len.counter += c->len.inc;
 	if (c->len.counter > FREQ_INC_REF) {
-		chan_enable(c - chans, 0);
+		chan_enable(hnd, c - hnd->chans, 0);
 		c->len.counter = 0;
 	}
 }
 
-static bool update_freq(struct chan *c, uint32_t *pos)
+static bool update_freq(struct minigb_apu_chan *c, uint32_t *pos)
 {
 	uint32_t inc = c->freq_inc - *pos;
 	c->freq_counter += inc;
@@ -159,7 +96,7 @@ static bool update_freq(struct chan *c, uint32_t *pos)
 	}
 }
 
-static void update_sweep(struct chan *c)
+static void update_sweep(struct minigb_apu_chan *c)
 {
 	c->sweep.counter += c->sweep.inc;
 
@@ -184,58 +121,80 @@ static void update_sweep(struct chan *c)
 	}
 }
 
-static void update_square(int16_t* samples, const bool ch2)
+static bool square_begin(struct minigb_apu_chan *c)
 {
 	uint32_t freq;
-	struct chan* c = chans + ch2;
 
 	if (!c->powered || !c->enabled)
-		return;
+		return false;
 
 	freq = DMG_CLOCK_FREQ_U / ((2048 - c->freq) << 5);
 	set_note_freq(c, freq);
 	c->freq_inc *= 8;
+	return true;
+}
 
-	for (uint_fast16_t i = 0; i < AUDIO_NSAMPLES; i += 2) {
-		update_len(c);
+/**
+ * Advance a square channel by one sample and return its output before
+ * panning and master volume are applied.
+ */
+static inline int32_t square_next(struct minigb_apu_ctx *hnd,
+		struct minigb_apu_chan *c, const bool ch2)
+{
+	update_len(hnd, c);
+
+	if (!c->enabled)
+		return 0;
+
+	update_env(c);
+	if (!ch2)
+		update_sweep(c);
+
+	uint32_t pos = 0;
+	uint32_t prev_pos = 0;
+	int32_t sample = 0;
+
+	while (update_freq(c, &pos)) {
+		c->square.duty_counter = (c->square.duty_counter + 1) & 7;
+		sample += ((pos - prev_pos) / c->freq_inc) * c->val;
+		c->val = (c->square.duty & (1 << c->square.duty_counter)) ?
+			VOL_INIT_MAX / MAX_CHAN_VOLUME :
+			VOL_INIT_MIN / MAX_CHAN_VOLUME;
+		prev_pos = pos;
+	}
 
-		if (!c->enabled)
-			continue;
+	if (c->muted)
+		return 0;
 
-		update_env(c);
-		if (!ch2)
-			update_sweep(c);
+	sample += c->val;
+	sample *= c->volume;
+	sample /= 4;
 
-		uint32_t pos = 0;
-		uint32_t prev_pos = 0;
-		int32_t sample = 0;
+	return sample;
+}
 
-		while (update_freq(c, &pos)) {
-			c->square.duty_counter = (c->square.duty_counter + 1) & 7;
-			sample += ((pos - prev_pos) / c->freq_inc) * c->val;
-			c->val = (c->square.duty & (1 << c->square.duty_counter)) ?
-				VOL_INIT_MAX / MAX_CHAN_VOLUME :
-				VOL_INIT_MIN / MAX_CHAN_VOLUME;
-			prev_pos = pos;
-		}
+static void update_square(struct minigb_apu_ctx *hnd, int16_t* samples,
+		const bool ch2, const size_t len)
+{
+	struct minigb_apu_chan* c = hnd->chans + ch2;
 
-		if (c->muted)
-			continue;
+	if (!square_begin(c))
+		return;
 
-		sample += c->val;
-		sample *= c->volume;
-		sample /= 4;
+	for (uint_fast16_t i = 0; i < len; i += 2) {
+		int32_t sample = square_next(hnd, c, ch2);
 
-		samples[i + 0] += sample * c->on_left * vol_l;
-		samples[i + 1] += sample * c->on_right * vol_r;
+		samples[i + 0] += sample * c->on_left * hnd->vol_l;
+		samples[i + 1] += sample * c->on_right * hnd->vol_r;
 	}
 }
 
-static uint8_t wave_sample(const unsigned int pos, const unsigned int volume)
+static uint8_t wave_sample(const struct minigb_apu_ctx *hnd,
+		const unsigned int pos, const unsigned int volume)
 {
 	uint8_t sample;
 
-	sample =  audio_mem[(0xFF30 + pos / 2) - AUDIO_ADDR_COMPENSATION];
+	sample =  hnd->audio_mem[(0xFF30 + pos / 2) - AUDIO_ADDR_COMPENSATION];
 	if (pos & 1) {
 		sample &= 0xF;
 	} else {
@@ -244,67 +203,82 @@ static uint8_t wave_sample(const unsigned int pos, const unsigned int volume)
 	return volume ? (sample >> (volume - 1)) : 0;
 }
 
-static void update_wave(int16_t *samples)
+static bool wave_begin(struct minigb_apu_chan *c)
 {
 	uint32_t freq;
-	struct chan *c = chans + 2;
 
 	if (!c->powered || !c->enabled)
-		return;
+		return false;
 
 	freq = (DMG_CLOCK_FREQ_U / 64) / (2048 - c->freq);
 	set_note_freq(c, freq);
 
 	c->freq_inc *= 32;
+	return true;
+}
 
-	for (uint_fast16_t i = 0; i < AUDIO_NSAMPLES; i += 2) {
-		update_len(c);
+static inline int32_t wave_next(struct minigb_apu_ctx *hnd,
+		struct minigb_apu_chan *c)
+{
+	update_len(hnd, c);
 
-		if (!c->enabled)
-			continue;
+	if (!c->enabled)
+		return 0;
 
-		uint32_t pos      = 0;
-		uint32_t prev_pos = 0;
-		int32_t sample   = 0;
+	uint32_t pos      = 0;
+	uint32_t prev_pos = 0;
+	int32_t sample   = 0;
 
-		c->wave.sample = wave_sample(c->val, c->volume);
+	c->wave.sample = wave_sample(hnd, c->val, c->volume);
 
-		while (update_freq(c, &pos)) {
-			c->val = (c->val + 1) & 31;
-			sample += ((pos - prev_pos) / c->freq_inc) *
-				((int)c->wave.sample - 8) * (INT16_MAX/64);
-			c->wave.sample = wave_sample(c->val, c->volume);
-			prev_pos  = pos;
-		}
+	while (update_freq(c, &pos)) {
+		c->val = (c->val + 1) & 31;
+		sample += ((pos - prev_pos) / c->freq_inc) *
+			((int)c->wave.sample - 8) * (INT16_MAX/64);
+		c->wave.sample = wave_sample(hnd, c->val, c->volume);
+		prev_pos  = pos;
+	}
 
-		sample += ((int)c->wave.sample - 8) * (int)(INT16_MAX/64);
+	sample += ((int)c->wave.sample - 8) * (int)(INT16_MAX/64);
 
-		if (c->volume == 0)
-			continue;
+	if (c->volume == 0)
+		return 0;
 
-		{
-			/* First element is unused. */
-			int16_t div[] = { INT16_MAX, 1, 2, 4 };
-			sample = sample / (div[c->volume]);
-		}
+	{
+		/* First element is unused. */
+		int16_t div[] = { INT16_MAX, 1, 2, 4 };
+		sample = sample / (div[c->volume]);
+	}
 
-		if (c->muted)
-			continue;
+	if (c->muted)
+		return 0;
 
-		sample /= 4;
+	sample /= 4;
 
-		samples[i + 0] += sample * c->on_left * vol_l;
-		samples[i + 1] += sample * c->on_right * vol_r;
-	}
+	return sample;
 }
 
-static void update_noise(int16_t *samples)
+static void update_wave(struct minigb_apu_ctx *hnd, int16_t *samples,
+		const size_t len)
 {
-	struct chan *c = chans + 3;
+	struct minigb_apu_chan *c = hnd->chans + 2;
 
-	if (!c->powered)
+	if (!wave_begin(c))
 		return;
 
+	for (uint_fast16_t i = 0; i < len; i += 2) {
+		int32_t sample = wave_next(hnd, c);
+
+		samples[i + 0] += sample * c->on_left * hnd->vol_l;
+		samples[i + 1] += sample * c->on_right * hnd->vol_r;
+	}
+}
+
+static bool noise_begin(struct minigb_apu_chan *c)
+{
+	if (!c->powered)
+		return false;
+
 	{
 		const uint32_t lfsr_div_lut[] = {
 			8, 16, 32, 48, 64, 80, 96, 112
@@ -318,77 +292,185 @@ static void update_noise(int16_t *samples)
 	if (c->freq >= 14)
 		c->enabled = 0;
 
-	for (uint_fast16_t i = 0; i < AUDIO_NSAMPLES; i += 2) {
-		update_len(c);
+	return true;
+}
 
-		if (!c->enabled)
-			continue;
+static inline int32_t noise_next(struct minigb_apu_ctx *hnd,
+		struct minigb_apu_chan *c)
+{
+	update_len(hnd, c);
 
-		update_env(c);
+	if (!c->enabled)
+		return 0;
 
-		uint32_t pos      = 0;
-		uint32_t prev_pos = 0;
-		int32_t sample    = 0;
+	update_env(c);
 
-		while (update_freq(c, &pos)) {
-			c->noise.lfsr_reg = (c->noise.lfsr_reg << 1) |
-				(c->val >= VOL_INIT_MAX/MAX_CHAN_VOLUME);
+	uint32_t pos      = 0;
+	uint32_t prev_pos = 0;
+	int32_t sample    = 0;
 
-			if (c->noise.lfsr_wide) {
-				c->val = !(((c->noise.lfsr_reg >> 14) & 1) ^
-						((c->noise.lfsr_reg >> 13) & 1)) ?
-					VOL_INIT_MAX / MAX_CHAN_VOLUME :
-					VOL_INIT_MIN / MAX_CHAN_VOLUME;
-			} else {
-				c->val = !(((c->noise.lfsr_reg >> 6) & 1) ^
-						((c->noise.lfsr_reg >> 5) & 1)) ?
-					VOL_INIT_MAX / MAX_CHAN_VOLUME :
-					VOL_INIT_MIN / MAX_CHAN_VOLUME;
-			}
+	while (update_freq(c, &pos)) {
+		c->noise.lfsr_reg = (c->noise.lfsr_reg << 1) |
+			(c->val >= VOL_INIT_MAX/MAX_CHAN_VOLUME);
 
-			sample += ((pos - prev_pos) / c->freq_inc) * c->val;
-			prev_pos = pos;
+		if (c->noise.lfsr_wide) {
+			c->val = !(((c->noise.lfsr_reg >> 14) & 1) ^
+					((c->noise.lfsr_reg >> 13) & 1)) ?
+				VOL_INIT_MAX / MAX_CHAN_VOLUME :
+				VOL_INIT_MIN / MAX_CHAN_VOLUME;
+		} else {
+			c->val = !(((c->noise.lfsr_reg >> 6) & 1) ^
+					((c->noise.lfsr_reg >> 5) & 1)) ?
+				VOL_INIT_MAX / MAX_CHAN_VOLUME :
+				VOL_INIT_MIN / MAX_CHAN_VOLUME;
 		}
 
-		if (c->muted)
-			continue;
+		sample += ((pos - prev_pos) / c->freq_inc) * c->val;
+		prev_pos = pos;
+	}
 
-		sample += c->val;
-		sample *= c->volume;
-		sample /= 4;
+	if (c->muted)
+		return 0;
+
+	sample += c->val;
+	sample *= c->volume;
+	sample /= 4;
+
+	return sample;
+}
 
-		samples[i + 0] += sample * c->on_left * vol_l;
-		samples[i + 1] += sample * c->on_right * vol_r;
+static void update_noise(struct minigb_apu_ctx *hnd, int16_t *samples,
+		const size_t len)
+{
+	struct minigb_apu_chan *c = hnd->chans + 3;
+
+	if (!noise_begin(c))
+		return;
+
+	for (uint_fast16_t i = 0; i < len; i += 2) {
+		int32_t sample = noise_next(hnd, c);
+
+		samples[i + 0] += sample * c->on_left * hnd->vol_l;
+		samples[i + 1] += sample * c->on_right * hnd->vol_r;
 	}
 }
 
 /**
- * SDL2 style audio callback function.
+ * Convert a mixed 16-bit sample to an unsigned 8-bit PWM level.
  */
-void audio_callback(void *userdata, int16_t *stream, size_t len)
+static inline uint8_t pwm_level(int32_t sample)
 {
-	/* Appease unused variable warning. */
-	(void)userdata;
+	sample = (sample >> 8) + 128;
+
+	if (sample < 0)
+		return 0;
+	if (sample > 255)
+		return 255;
 
+	return sample;
+}
+
+/**
+ * SDL2 style audio callback function.
+ */
+void minigb_apu_audio_callback(struct minigb_apu_ctx *hnd, int16_t *stream,
+		size_t len)
+{
 	memset(stream, 0, len);
 
-	update_square(stream, 0);
-	update_square(stream, 1);
-	update_wave(stream);
-	update_noise(stream);
+	update_square(hnd, stream, 0, AUDIO_NSAMPLES);
+	update_square(hnd, stream, 1, AUDIO_NSAMPLES);
+	update_wave(hnd, stream, AUDIO_NSAMPLES);
+	update_noise(hnd, stream, AUDIO_NSAMPLES);
+}
+
+/**
+ * Render part of a frame. Channel state carries over between calls, so a
+ * frame may be built from several calls with register writes applied in
+ * between them.
+ */
+void minigb_apu_audio_render(struct minigb_apu_ctx *hnd, int16_t *stream,
+		size_t nsamples)
+{
+	memset(stream, 0, nsamples * 2 * sizeof(int16_t));
+
+	update_square(hnd, stream, 0, nsamples * 2);
+	update_square(hnd, stream, 1, nsamples * 2);
+	update_wave(hnd, stream, nsamples * 2);
+	update_noise(hnd, stream, nsamples * 2);
+}
+
+/**
+ * Render part of a frame directly as unsigned 8-bit PWM levels centred on
+ * 128. All four channels are mixed per sample, so no intermediate buffer or
+ * conversion pass is needed. Levels are stored as bytes, or as halfwords when
+ * "wide" is set so that DMA can write them straight to a PWM CC register.
+ */
+void minigb_apu_audio_render_pwm(struct minigb_apu_ctx *hnd, void *out,
+		size_t nsamples, unsigned channels, bool wide)
+{
+	uint8_t *out8 = out;
+	uint16_t *out16 = out;
+	struct minigb_apu_chan *c = hnd->chans;
+	const bool sq1 = square_begin(c + 0);
+	const bool sq2 = square_begin(c + 1);
+	const bool wave = wave_begin(c + 2);
+	const bool noise = noise_begin(c + 3);
+
+	for (size_t i = 0; i < nsamples; i++) {
+		int32_t l = 0, r = 0, sample;
+
+		if (sq1) {
+			sample = square_next(hnd, c + 0, 0);
+			l += sample * c[0].on_left;
+			r += sample * c[0].on_right;
+		}
+		if (sq2) {
+			sample = square_next(hnd, c + 1, 1);
+			l += sample * c[1].on_left;
+			r += sample * c[1].on_right;
+		}
+		if (wave) {
+			sample = wave_next(hnd, c + 2);
+			l += sample * c[2].on_left;
+			r += sample * c[2].on_right;
+		}
+		if (noise) {
+			sample = noise_next(hnd, c + 3);
+			l += sample * c[3].on_left;
+			r += sample * c[3].on_right;
+		}
+
+		l *= hnd->vol_l;
+		r *= hnd->vol_r;
+
+		if (channels == 1) {
+			l = pwm_level((l + r) >> 1);
+			if (wide)
+				*out16++ = l;
+			else
+				*out8++ = l;
+		} else if (wide) {
+			*out16++ = pwm_level(l);
+			*out16++ = pwm_level(r);
+		} else {
+			*out8++ = pwm_level(l);
+			*out8++ = pwm_level(r);
+		}
+	}
 }
 
-static void chan_trigger(uint_fast8_t i)
+static void chan_trigger(struct minigb_apu_ctx *hnd, uint_fast8_t i)
 {
-	struct chan *c = chans + i;
+	struct minigb_apu_chan *c = hnd->chans + i;
 
-	chan_enable(i, 1);
+	chan_enable(hnd, i, 1);
 	c->volume = c->volume_init;
 
 	// volume envelope
 	{
 		uint8_t val =
-			audio_mem[(0xFF12 + (i * 5)) - AUDIO_ADDR_COMPENSATION];
+			hnd->audio_mem[(0xFF12 + (i * 5)) - AUDIO_ADDR_COMPENSATION];
 
 		c->env.step = val & 0x07;
 		c->env.up   = val & 0x08 ? 1 : 0;
@@ -400,7 +482,7 @@ static void chan_trigger(uint_fast8_t i)
 
 	// freq sweep
 	if (i == 0) {
-		uint8_t val = audio_mem[0xFF10 - AUDIO_ADDR_COMPENSATION];
+		uint8_t val = hnd->audio_mem[0xFF10 - AUDIO_ADDR_COMPENSATION];
 
 		c->sweep.freq  = c->freq;
 		c->sweep.rate  = (val >> 4) & 0x07;
@@ -431,7 +513,8 @@ static void chan_trigger(uint_fast8_t i)
  *				This is not checked in this function.
  * \return	Byte at address.
  */
-uint8_t audio_read(const uint16_t addr)
+uint8_t minigb_apu_audio_read(const struct minigb_apu_ctx *hnd,
+		const uint16_t addr)
 {
 	static const uint8_t ortab[] = {
 		0x80, 0x3f, 0x00, 0xff, 0xbf,
@@ -444,7 +527,7 @@ uint8_t audio_read(const uint16_t addr)
 		0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
 	};
 
-	return audio_mem[addr - AUDIO_ADDR_COMPENSATION] |
+	return hnd->audio_mem[addr - AUDIO_ADDR_COMPENSATION] |
 		ortab[addr - AUDIO_ADDR_COMPENSATION];
 }
 
@@ -454,129 +537,130 @@ uint8_t audio_read(const uint16_t addr)
  *				This is not checked in this function.
  * \param val	Byte to write at address.
  */
-void audio_write(const uint16_t addr, const uint8_t val)
+void minigb_apu_audio_write(struct minigb_apu_ctx *hnd,
+		const uint16_t addr, const uint8_t val)
 {
 	/* Find sound channel corresponding to register address. */
 	uint_fast8_t i;
 
 	if(addr == 0xFF26)
 	{
-		audio_mem[addr - AUDIO_ADDR_COMPENSATION] = val & 0x80;
+		hnd->audio_mem[addr - AUDIO_ADDR_COMPENSATION] = val & 0x80;
 		/* On APU power off, clear all registers apart from wave
 		 * RAM. */
 		if((val & 0x80) == 0)
 		{
-			memset(audio_mem, 0x00, 0xFF26 - AUDIO_ADDR_COMPENSATION);
-			chans[0].enabled = false;
-			chans[1].enabled = false;
-			chans[2].enabled = false;
-			chans[3].enabled = false;
+			memset(hnd->audio_mem, 0x00, 0xFF26 - AUDIO_ADDR_COMPENSATION);
+			hnd->chans[0].enabled = false;
+			hnd->chans[1].enabled = false;
+			hnd->chans[2].enabled = false;
+			hnd->chans[3].enabled = false;
 		}
 
 		return;
 	}
 
 	/* Ignore register writes if APU powered off. */
-	if(audio_mem[0xFF26 - AUDIO_ADDR_COMPENSATION] == 0x00)
+	if(hnd->audio_mem[0xFF26 - AUDIO_ADDR_COMPENSATION] == 0x00)
 		return;
 
-	audio_mem[addr - AUDIO_ADDR_COMPENSATION] = val;
+	hnd->audio_mem[addr - AUDIO_ADDR_COMPENSATION] = val;
 	i = (addr - AUDIO_ADDR_COMPENSATION) / 5;
 
 	switch (addr) {
 	case 0xFF12:
 	case 0xFF17:
 	case 0xFF21: {
-		chans[i].volume_init = val >> 4;
-		chans[i].powered     = (val >> 3) != 0;
+		hnd->chans[i].volume_init = val >> 4;
+		hnd->chans[i].powered     = (val >> 3) != 0;
 
 		// "zombie mode" stuff, needed for Prehistorik Man and probably
 		// others
-		if (chans[i].powered && chans[i].enabled) {
-			if ((chans[i].env.step == 0 && chans[i].env.inc != 0)) {
+		if (hnd->chans[i].powered && hnd->chans[i].enabled) {
+			if ((hnd->chans[i].env.step == 0 && hnd->chans[i].env.inc != 0)) {
 				if (val & 0x08) {
-					chans[i].volume++;
+					hnd->chans[i].volume++;
 				} else {
-					chans[i].volume += 2;
+					hnd->chans[i].volume += 2;
 				}
 			} else {
-				chans[i].volume = 16 - chans[i].volume;
+				hnd->chans[i].volume = 16 - hnd->chans[i].volume;
 			}
 
-			chans[i].volume &= 0x0F;
-			chans[i].env.step = val & 0x07;
+			hnd->chans[i].volume &= 0x0F;
+			hnd->chans[i].env.step = val & 0x07;
 		}
 	} break;
 
 	case 0xFF1C:
-		chans[i].volume = chans[i].volume_init = (val >> 5) & 0x03;
+		hnd->chans[i].volume = hnd->chans[i].volume_init = (val >> 5) & 0x03;
 		break;
 
 	case 0xFF11:
 	case 0xFF16:
 	case 0xFF20: {
 		const uint8_t duty_lookup[] = { 0x10, 0x30, 0x3C, 0xCF };
-		chans[i].len.load = val & 0x3f;
-		chans[i].square.duty = duty_lookup[val >> 6];
+		hnd->chans[i].len.load = val & 0x3f;
+		hnd->chans[i].square.duty = duty_lookup[val >> 6];
 		break;
 	}
 
 	case 0xFF1B:
-		chans[i].len.load = val;
+		hnd->chans[i].len.load = val;
 		break;
 
 	case 0xFF13:
 	case 0xFF18:
 	case 0xFF1D:
-		chans[i].freq &= 0xFF00;
-		chans[i].freq |= val;
+		hnd->chans[i].freq &= 0xFF00;
+		hnd->chans[i].freq |= val;
 		break;
 
 	case 0xFF1A:
-		chans[i].powered = (val & 0x80) != 0;
-		chan_enable(i, val & 0x80);
+		hnd->chans[i].powered = (val & 0x80) != 0;
+		chan_enable(hnd, i, val & 0x80);
 		break;
 
 	case 0xFF14:
 	case 0xFF19:
 	case 0xFF1E:
-		chans[i].freq &= 0x00FF;
-		chans[i].freq |= ((val & 0x07) << 8);
+		hnd->chans[i].freq &= 0x00FF;
+		hnd->chans[i].freq |= ((val & 0x07) << 8);
 		/* Intentional fall-through. */
 	case 0xFF23:
-		chans[i].len.enabled = val & 0x40 ? 1 : 0;
+		hnd->chans[i].len.enabled = val & 0x40 ? 1 : 0;
 		if (val & 0x80)
-			chan_trigger(i);
+			chan_trigger(hnd, i);
 
 		break;
 
 	case 0xFF22:
-		chans[3].freq = val >> 4;
-		chans[3].noise.lfsr_wide = !(val & 0x08);
-		chans[3].noise.lfsr_div = val & 0x07;
+		hnd->chans[3].freq = val >> 4;
+		hnd->chans[3].noise.lfsr_wide = !(val & 0x08);
+		hnd->chans[3].noise.lfsr_div = val & 0x07;
 		break;
 
 	case 0xFF24:
 	{
-		vol_l = ((val >> 4) & 0x07);
-		vol_r = (val & 0x07);
+		hnd->vol_l = ((val >> 4) & 0x07);
+		hnd->vol_r = (val & 0x07);
 		break;
 	}
 
 	case 0xFF25:
 		for (uint_fast8_t j = 0; j < 4; j++) {
-			chans[j].on_left  = (val >> (4 + j)) & 1;
-			chans[j].on_right = (val >> j) & 1;
+			hnd->chans[j].on_left  = (val >> (4 + j)) & 1;
+			hnd->chans[j].on_right = (val >> j) & 1;
 		}
 		break;
 	}
 }
 
-void audio_init(void)
+void minigb_apu_audio_init(struct minigb_apu_ctx *hnd)
 {
 	/* Initialise channels and samples. */
-	memset(chans, 0, sizeof(chans));
-	chans[0].val = chans[1].val = -1;
+	memset(hnd->chans, 0, sizeof(hnd->chans));
+	hnd->chans[0].val = hnd->chans[1].val = -1;
 
 	/* Initialise IO registers. */
 	{
@@ -587,7 +671,7 @@ void audio_init(void)
 					      0x77, 0xF3, 0xF1 };
 
 		for(uint_fast8_t i = 0; i < sizeof(regs_init); ++i)
-			audio_write(0xFF10 + i, regs_init[i]);
+			minigb_apu_audio_write(hnd, 0xFF10 + i, regs_init[i]);
 	}
 
 	/* Initialise Wave Pattern RAM. */
@@ -598,6 +682,36 @@ void audio_init(void)
 					      0xac, 0xdd, 0xda, 0x48 };
 
 		for(uint_fast8_t i = 0; i < sizeof(wave_init); ++i)
-			audio_write(0xFF30 + i, wave_init[i]);
+			minigb_apu_audio_write(hnd, 0xFF30 + i, wave_init[i]);
 	}
 }
+
+/* Compatibility functions operating on a single global context. */
+
+void audio_callback(void *userdata, int16_t *stream, size_t len)
+{
+	/* Appease unused variable warning. */
+	(void)userdata;
+
+	minigb_apu_audio_callback(&apu_ctx, stream, len);
+}
+
+void audio_render(int16_t *stream, size_t nsamples)
+{
+	minigb_apu_audio_render(&apu_ctx, stream, nsamples);
+}
+
+uint8_t audio_read(const uint16_t addr)
+{
+	return minigb_apu_audio_read(&apu_ctx, addr);
+}
+
+void audio_write(const uint16_t addr, const uint8_t val)
+{
+	minigb_apu_audio_write(&apu_ctx, addr, val);
+}
+
+void audio_init(void)
+{
+	minigb_apu_audio_init(&apu_ctx);
+}
@@ -7,6 +7,8 @@
 
 #pragma once
 
+#include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
 #define AUDIO_SAMPLE_RATE	44100
@@ -18,23 +20,124 @@
 #define AUDIO_SAMPLES		((unsigned)(AUDIO_SAMPLE_RATE / VERTICAL_SYNC))
 #define AUDIO_BUFFER_SIZE_BYTES (AUDIO_SAMPLES*4)
 
+#define AUDIO_MEM_SIZE		(0xFF3F - 0xFF10 + 1)
+
+struct minigb_apu_chan_len_ctr {
+	uint8_t load;
+	unsigned enabled : 1;
+	uint32_t counter;
+	uint32_t inc;
+};
+
+struct minigb_apu_chan_vol_env {
+	uint8_t step;
+	unsigned up : 1;
+	uint32_t counter;
+	uint32_t inc;
+};
+
+struct minigb_apu_chan_freq_sweep {
+	uint16_t freq;
+	uint8_t rate;
+	uint8_t shift;
+	unsigned up : 1;
+	uint32_t counter;
+	uint32_t inc;
+};
+
+struct minigb_apu_chan {
+	unsigned enabled : 1;
+	unsigned powered : 1;
+	unsigned on_left : 1;
+	unsigned on_right : 1;
+	unsigned muted : 1;
+
+	uint8_t volume;
+	uint8_t volume_init;
+
+	uint16_t freq;
+	uint32_t freq_counter;
+	uint32_t freq_inc;
+
+	int_fast16_t val;
+
+	struct minigb_apu_chan_len_ctr    len;
+	struct minigb_apu_chan_vol_env    env;
+	struct minigb_apu_chan_freq_sweep sweep;
+
+	union {
+		struct {
+			uint8_t duty;
+			uint8_t duty_counter;
+		} square;
+		struct {
+			uint16_t lfsr_reg;
+			uint8_t  lfsr_wide;
+			uint8_t  lfsr_div;
+		} noise;
+		struct {
+			uint8_t sample;
+		} wave;
+	};
+};
+
+/**
+ * APU context. Holds the complete state of one APU, so it may be allocated
+ * wherever the owner wants and copied to take a snapshot.
+ */
+struct minigb_apu_ctx {
+	/* Memory holding audio registers between 0xFF10 and 0xFF3F inclusive. */
+	uint8_t audio_mem[AUDIO_MEM_SIZE];
+	struct minigb_apu_chan chans[4];
+	int32_t vol_l, vol_r;
+};
+
 /**
  * Fill allocated buffer "data" with "len" number of 32-bit floating point
  * samples (native endian order) in stereo interleaved format.
  */
-void audio_callback(void *ptr, int16_t *data, size_t len);
+void minigb_apu_audio_callback(struct minigb_apu_ctx *hnd, int16_t *data,
+		size_t len);
+
+/**
+ * Fill "data" with "nsamples" stereo interleaved samples, continuing from the
+ * state left by the previous call.
+ */
+void minigb_apu_audio_render(struct minigb_apu_ctx *hnd, int16_t *data,
+		size_t nsamples);
+
+/**
+ * Fill "out" with "nsamples" unsigned 8-bit samples centred on 128, ready to
+ * be used as PWM levels. "channels" is 1 for mono (left and right mixed) or
+ * 2 for interleaved stereo. Each level is stored as a uint8_t, or as a
+ * uint16_t if "wide" is true.
+ */
+void minigb_apu_audio_render_pwm(struct minigb_apu_ctx *hnd, void *out,
+		size_t nsamples, unsigned channels, bool wide);
 
 /**
  * Read audio register at given address "addr".
  */
-uint8_t audio_read(const uint16_t addr);
+uint8_t minigb_apu_audio_read(const struct minigb_apu_ctx *hnd,
+		const uint16_t addr);
 
 /**
  * Write "val" to audio register at given address "addr".
  */
-void audio_write(const uint16_t addr, const uint8_t val);
+void minigb_apu_audio_write(struct minigb_apu_ctx *hnd,
+		const uint16_t addr, const uint8_t val);
 
 /**
  * Initialise audio driver.
  */
+void minigb_apu_audio_init(struct minigb_apu_ctx *hnd);
+
+/**
+ * Compatibility functions. These operate on a single context held within
+ * minigb_apu.
+ */
+void audio_callback(void *ptr, int16_t *data, size_t len);
+void audio_render(int16_t *data, size_t nsamples);
+uint8_t audio_read(const uint16_t addr);
+void audio_write(const uint16_t addr, const uint8_t val);
 void audio_init(void);
@@ -0,0 +1,63 @@
+#ifndef APU_CORE1_H
+#define APU_CORE1_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "audio_backend.h"
+
+/**
+ * APU synthesis on core1.
+ *
+ * Core0 does not run minigb_apu itself. Register writes made by the emulated
+ * CPU are timestamped with the cycle they occurred on within the frame and
+ * pushed into a single producer, single consumer queue. Core1 owns the APU
+ * state and, between LCD line jobs, renders samples up to each write's
+ * timestamp before applying it. Core0 answers register reads from a mirror
+ * of the readable APU state.
+ */
+
+/* Number of queued register writes. Must be a power of two. */
+#define APU_QUEUE_SIZE		1024
+
+/* Maximum number of samples rendered by one apu_core1_service() call, so
+ * that LCD line jobs are not held up for long. */
+#define APU_SERVICE_SAMPLES	64
+
+/**
+ * Initialise the APU and the register mirror. Must be called on core0 before
+ * core1 is launched. Samples are rendered on core1 in the format of "output"
+ * straight into the blocks it hands out. If "output" has no free block,
+ * samples are dropped.
+ */
+void apu_core1_init(const struct audio_backend *output);
+
+/**
+ * Core0: queue a write of "val" to APU register "addr" at "cycle" clocks
+ * since the start of the current frame.
+ */
+void apu_core1_write(uint32_t cycle, uint16_t addr, uint8_t val);
+
+/**
+ * Core0: read APU register "addr" from the mirror.
+ */
+uint8_t apu_core1_read(uint16_t addr);
+
+/**
+ * Core0: mark the end of the emulated frame.
+ */
+void apu_core1_end_frame(void);
+
+/**
+ * Core1: process queued writes and render samples. Returns true if there
+ * may be more work to do.
+ */
+bool apu_core1_service(void);
+
+/**
+ * Time core1 has spent rendering samples since apu_core1_init(), in
+ * microseconds. Wraps around.
+ */
+uint32_t apu_core1_busy_us(void);
+
+#endif /* APU_CORE1_H */
@@ -0,0 +1,90 @@
+#ifndef AUDIO_BACKEND_H
+#define AUDIO_BACKEND_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * Audio output backends.
+ *
+ * Every backend plays from the same ring of AUDIO_RING_BLOCKS blocks of
+ * AUDIO_BUFFER_SIZE samples. The producer takes the free block at the head of
+ * the ring with get_block(), renders into it in the backend's format and
+ * queues it with submit(). The backend's DMA interrupt arms the next queued
+ * block as each one finishes, or a block of silence if the ring has run dry,
+ * so output never stops and the producer never waits.
+ */
+
+/* Number of blocks in the ring. Must be a power of two. */
+#define AUDIO_RING_BLOCKS	4
+
+/* Format of the samples in a block. */
+enum audio_format {
+	/* One uint16_t PWM level per sample, 0 to 255 centred on 128. */
+	AUDIO_FORMAT_PWM_MONO,
+	/* Interleaved left and right uint16_t PWM levels per sample. */
+	AUDIO_FORMAT_PWM_STEREO,
+	/* Interleaved left and right int16_t per sample. */
+	AUDIO_FORMAT_S16_STEREO
+};
+
+struct audio_stats {
+	uint32_t blocks;			// Blocks played from the ring
+	uint32_t underruns;			// Silent blocks played while the ring was empty
+	uint32_t queued;			// Blocks submitted and not yet played
+	uint32_t irqs;				// DMA interrupts taken
+	uint32_t transfers_per_sample;		// Bus transfers made by DMA for each sample
+};
+
+struct audio_backend {
+	const char *name;
+	enum audio_format format;
+
+	/* Claim and start the hardware. Plays silence until a block is
+	 * submitted. */
+	void (*init)(unsigned sample_rate);
+
+	/* Free space at the head of the ring: a block of AUDIO_BUFFER_SIZE
+	 * samples, or NULL if every block is queued or playing. Repeated
+	 * calls return the same block until it is submitted. */
+	void *(*get_block)(void);
+
+	/* Queue the block returned by get_block(). */
+	void (*submit)(void);
+
+	/* Output volume in 8.8 fixed point, 256 being unity. */
+	void (*set_volume)(uint16_t volume);
+
+	void (*get_stats)(struct audio_stats *stats);
+};
+
+/* PWM on GPIO_AUDIO, each sample repeated by three chained DMA channels. */
+extern const struct audio_backend audio_backend_pwm;
+
+/* PWM on GPIO_AUDIO, one DMA transfer per sample paced by a DMA timer. */
+extern const struct audio_backend audio_backend_pwm_timer;
+
+/* I2S through PIO on GPIO_I2S_DATA and GPIO_I2S_CLOCK_BASE. */
+extern const struct audio_backend audio_backend_i2s;
+
+/**
+ * Ring buffer shared by the backends.
+ */
+
+/* Reset the ring and fill the silence block for "format". */
+void audio_ring_init(enum audio_format format);
+
+void *audio_ring_get_block(void);
+void audio_ring_submit(void);
+void audio_ring_set_volume(uint16_t volume);
+
+/* Called from the backend's DMA interrupt. audio_ring_next() returns the
+ * block to arm next and audio_ring_retire() releases the oldest block given
+ * out by audio_ring_next() once it has finished playing. */
+const void *audio_ring_next(void);
+void audio_ring_retire(void);
+
+/* Fill in the ring's block and underrun counts. */
+void audio_ring_get_stats(struct audio_stats *stats);
+
+#endif /* AUDIO_BACKEND_H */
@@ -18,6 +18,16 @@
 #define GPIO_LED	22
 #define GPIO_AUDIO	14
 
+/* Audio output. Number of channels driven by the PWM backends: 1 for mono on
+ * GPIO_AUDIO, 2 for stereo on both pins of its PWM slice, left on channel A
+ * and right on channel B. */
+#define AUDIO_CHANNELS	1
+
+/* I2S audio backend. The clock pins are GPIO_I2S_CLOCK_BASE and the pin
+ * after it. */
+#define GPIO_I2S_DATA		6
+#define GPIO_I2S_CLOCK_BASE	0
+
 // Options added for gameBadge3B
 #define AUTO_PALETTE	0
 #define SCREEN_HEIGHT	240
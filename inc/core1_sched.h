@@ -0,0 +1,69 @@
+#ifndef CORE1_SCHED_H
+#define CORE1_SCHED_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * Cooperative job scheduler for core1.
+ *
+ * Work is posted as a function and two words of payload into one of a few
+ * queues, one per priority. Posting never waits: it fails if the queue is
+ * full. Core1 always runs the oldest job of the highest priority queue that
+ * has one. A queue may also have a poll function, called when the queue is
+ * empty, for work that is not posted but found, such as audio synthesis.
+ *
+ * Jobs run to completion, so a long job holds up every other one. Jobs that
+ * wait on hardware should poll the higher priority work themselves, as the
+ * frame scan-out does for audio.
+ */
+
+/* Queues, from the highest priority down. */
+enum core1_prio {
+	CORE1_PRIO_DISPLAY = 0,			// LCD lines and frames
+	CORE1_PRIO_AUDIO,			// APU synthesis
+	CORE1_PRIO_STORAGE,			// Storage work, none posted yet
+	CORE1_PRIO_TELEMETRY,			// Statistics and reports
+	CORE1_PRIO_COUNT
+};
+
+/* Jobs queued per priority. Must be a power of two. */
+#define CORE1_SCHED_QUEUE_SIZE	32
+
+typedef void (*core1_job_fn)(uint32_t a, uint32_t b);
+
+struct core1_sched_stats {
+	uint32_t run[CORE1_PRIO_COUNT];		// Jobs run
+	uint32_t full[CORE1_PRIO_COUNT];	// Jobs not posted as the queue was full
+	uint32_t high_water[CORE1_PRIO_COUNT];	// Most jobs queued at once
+};
+
+/**
+ * Empty the queues and remove the poll functions. Must be called before
+ * core1 is launched, and not while it runs.
+ */
+void core1_sched_init(void);
+
+/**
+ * Call "poll" whenever queue "prio" is empty. "poll" returns true if it may
+ * have more work, in which case lower priorities wait. Core1 sleeps when no
+ * queue has a job and no poll has work, so whatever gives "poll" work must
+ * wake it with __sev(). Must be called before core1 is launched.
+ */
+void core1_sched_set_poll(enum core1_prio prio, bool (*poll)(void));
+
+/**
+ * Queue "fn" to be called on core1 with "a" and "b". May be called from
+ * either core and from interrupt handlers. Returns false if the queue is
+ * full.
+ */
+bool core1_sched_post(enum core1_prio prio, core1_job_fn fn, uint32_t a, uint32_t b);
+
+/**
+ * Core1: run jobs for ever.
+ */
+_Noreturn void core1_sched_run(void);
+
+void core1_sched_get_stats(struct core1_sched_stats *stats);
+
+#endif /* CORE1_SCHED_H */
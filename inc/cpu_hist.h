@@ -0,0 +1,116 @@
+#ifndef CPU_HIST_H
+#define CPU_HIST_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * Execution histograms of the emulated CPU.
+ *
+ * With CPU_HISTOGRAMS set, core0 counts each opcode executed, with the
+ * CB-prefixed ones apart, each read and write per 256-byte page of the
+ * address space, and each switch to a ROM bank. The counts are taken by the
+ * hooks of peanut_gb.h, which main.c points at the functions below.
+ *
+ * On the device, cpu_hist_dump() prints the counts as CSV on stdio, a few
+ * lines per core1 telemetry job, and starts counting again. Host builds
+ * instead append them to a file with cpu_hist_save(), so that the counts
+ * of many ROMs may be added up by tools/cpu_hist.py.
+ *
+ * With CPU_HISTOGRAMS set to 0, the default, the hooks and functions compile
+ * to nothing.
+ */
+
+#ifndef CPU_HISTOGRAMS
+# define CPU_HISTOGRAMS	0
+#endif
+
+/* ROM banks counted, as selectable by MBC5. */
+#define CPU_HIST_BANKS		512
+
+#if CPU_HISTOGRAMS
+
+struct cpu_hist {
+	uint32_t frames;
+	uint32_t bank_writes;			// Writes to the ROM bank registers, switching or not
+	uint32_t opcodes[256];
+	uint32_t cb_opcodes[256];
+	uint32_t reads[256];			// Per page, by the CPU and OAM DMA
+	uint32_t writes[256];
+	uint32_t bank_switches[CPU_HIST_BANKS];	// Switches to each bank
+};
+
+/* The histograms being counted into, written only by core0. */
+extern struct cpu_hist *cpu_hist_live;
+extern uint_fast16_t cpu_hist_bank_last;
+
+static inline void cpu_hist_opcode(uint8_t op)
+{
+	cpu_hist_live->opcodes[op]++;
+}
+
+static inline void cpu_hist_cb_opcode(uint8_t op)
+{
+	cpu_hist_live->cb_opcodes[op]++;
+}
+
+static inline void cpu_hist_read(uint_fast16_t addr)
+{
+	cpu_hist_live->reads[addr >> 8]++;
+}
+
+static inline void cpu_hist_write(uint_fast16_t addr)
+{
+	cpu_hist_live->writes[addr >> 8]++;
+}
+
+static inline void cpu_hist_bank(uint_fast16_t bank)
+{
+	struct cpu_hist *h = cpu_hist_live;
+
+	h->bank_writes++;
+	if(bank == cpu_hist_bank_last)
+		return;
+
+	h->bank_switches[bank & (CPU_HIST_BANKS - 1)]++;
+	cpu_hist_bank_last = bank;
+}
+
+static inline void cpu_hist_frame(void)
+{
+	cpu_hist_live->frames++;
+}
+
+/**
+ * Core0: clear the histograms of a new game.
+ */
+void cpu_hist_reset(void);
+
+#if PICO_ON_DEVICE
+/**
+ * Core0: start dumping the histograms and count afresh. Returns false if a
+ * dump is already running or could not be queued.
+ */
+bool cpu_hist_dump(void);
+#else
+/**
+ * Append the histograms to the file at "path", headed by "title", and count
+ * afresh. Returns false if the file could not be written.
+ */
+bool cpu_hist_save(const char *path, const char *title);
+#endif
+
+#else
+
+static inline void cpu_hist_opcode(uint8_t op) { (void)op; }
+static inline void cpu_hist_cb_opcode(uint8_t op) { (void)op; }
+static inline void cpu_hist_read(uint_fast16_t addr) { (void)addr; }
+static inline void cpu_hist_write(uint_fast16_t addr) { (void)addr; }
+static inline void cpu_hist_bank(uint_fast16_t bank) { (void)bank; }
+static inline void cpu_hist_frame(void) {}
+static inline void cpu_hist_reset(void) {}
+static inline bool cpu_hist_dump(void) { return false; }
+
+#endif
+
+#endif /* CPU_HIST_H */
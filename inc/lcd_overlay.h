@@ -0,0 +1,36 @@
+#ifndef LCD_OVERLAY_H
+#define LCD_OVERLAY_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * Rows of text drawn in the border above the unscaled Game Boy image.
+ *
+ * Core0 hands over the text with lcd_overlay_post() and core1 draws it as a
+ * display job, in between the lines or frames it sends, so that the two never
+ * drive the LCD at once. Glyphs are rendered once from the st7789 font and
+ * kept, so drawing only copies pixels. Each row is drawn as one window, a
+ * scanline at a time.
+ */
+
+#define LCD_OVERLAY_ROWS	3
+#define LCD_OVERLAY_COLS	29		// Characters per row; shorter rows are blanked to this
+
+/**
+ * Core0: draw "text" at the next chance. Returns false, without drawing, if
+ * the previous text is still being drawn or the job could not be queued.
+ */
+bool lcd_overlay_post(const char text[LCD_OVERLAY_ROWS][LCD_OVERLAY_COLS + 1]);
+
+/**
+ * Core0: wait until core1 has drawn the text last posted.
+ */
+void lcd_overlay_drain(void);
+
+/**
+ * Forget text that was being drawn when core1 was reset.
+ */
+void lcd_overlay_reset(void);
+
+#endif /* LCD_OVERLAY_H */
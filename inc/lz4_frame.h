@@ -0,0 +1,57 @@
+#ifndef LZ4_FRAME_H
+#define LZ4_FRAME_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * LZ4 frame decoding for compressed ROMs.
+ *
+ * Only frames with independent blocks are accepted, so that any block can
+ * be decompressed on its own. ROMs written by tools/romlz4.py have one
+ * 16 KiB bank per block, which lets the ROM cache decompress a bank
+ * straight into its slot. Checksums are skipped, not verified.
+ */
+
+#define LZ4_FRAME_MAGIC		0x184D2204
+
+/* Most bytes of frame header before the first block. */
+#define LZ4_FRAME_HEADER_MAX	19
+
+/* Largest block accepted, compressed or not: one ROM bank, as written by
+ * tools/romlz4.py. */
+#define LZ4_ROM_BLOCK_SIZE	0x4000
+
+/* Set in a block's size word when the block is stored uncompressed. */
+#define LZ4_BLOCK_UNCOMPRESSED	0x80000000u
+
+struct lz4_frame {
+	uint32_t header_size;			// Bytes before the first block
+	uint32_t block_max;			// Largest decompressed block allowed
+	uint32_t content_size;			// Decompressed size, or 0 if not given
+	bool block_checksum;			// Each block is followed by 4 bytes of checksum
+};
+
+/**
+ * Returns true if "name" is a compressed ROM: *.gbz or *.gb.lz4.
+ */
+bool lz4_is_rom_name(const char *name);
+
+/**
+ * Parse the frame header in the first "len" bytes of "p". Returns false if
+ * it is not an LZ4 frame this decoder can handle.
+ */
+bool lz4_frame_parse(const uint8_t *p, size_t len, struct lz4_frame *frame);
+
+/**
+ * Decompress the LZ4 block of "src_len" bytes at "src" into "dst", writing
+ * at most "dst_cap" bytes. Returns the number of bytes written, or -1 if the
+ * block is corrupt or does not fit. With "partial", running out of input or
+ * output just stops decoding, so a prefix of a block can be decoded from a
+ * prefix of its data.
+ */
+int32_t lz4_block_decompress(const uint8_t *src, size_t src_len, uint8_t *dst, size_t dst_cap,
+	bool partial);
+
+#endif /* LZ4_FRAME_H */
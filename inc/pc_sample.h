@@ -0,0 +1,79 @@
+#ifndef PC_SAMPLE_H
+#define PC_SAMPLE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * Statistical profiler of the emulated code.
+ *
+ * With PC_SAMPLING set, a repeating timer interrupts core0 every
+ * PC_SAMPLE_PERIOD_US and counts the program counter of the emulated CPU,
+ * along with the selected ROM bank when it lies in the switchable bank,
+ * in a hash table of PC_SAMPLE_BUCKETS. Samples taken while core0 is not
+ * emulating, for instance waiting to send a frame, are only counted as
+ * idle. pc_sample_dump() prints the PC_SAMPLE_TOP busiest addresses, to
+ * find the routines worth speeding up, and starts again.
+ *
+ * Each sample takes a couple of microseconds of core0, so about 2% of it
+ * at 10 kHz.
+ *
+ * With PC_SAMPLING set to 0, the default, the functions compile to nothing.
+ */
+
+#ifndef PC_SAMPLING
+# define PC_SAMPLING		0
+#endif
+
+#define PC_SAMPLE_PERIOD_US	100
+/* Addresses told apart. Must be a power of two. */
+#define PC_SAMPLE_BUCKETS	1024
+/* Addresses printed by a dump. */
+#define PC_SAMPLE_TOP		32
+
+#if PC_SAMPLING
+
+extern volatile bool pc_sample_running;
+
+/**
+ * Core0: start sampling the emulated CPU whose program counter and ROM
+ * bank are at "pc" and "bank", from an empty table.
+ */
+void pc_sample_start(const volatile uint16_t *pc, const volatile uint16_t *bank);
+
+/**
+ * Core0: stop sampling, before the emulated CPU goes away.
+ */
+void pc_sample_stop(void);
+
+/**
+ * Core0: bracket the emulation of a frame. Samples outside count as idle.
+ */
+static inline void pc_sample_resume(void)
+{
+	pc_sample_running = true;
+}
+
+static inline void pc_sample_pause(void)
+{
+	pc_sample_running = false;
+}
+
+/**
+ * Core0: start printing the busiest addresses and empty the table. Returns
+ * false if a dump is already running or could not be queued.
+ */
+bool pc_sample_dump(void);
+
+#else
+
+static inline void pc_sample_start(const volatile uint16_t *pc,
+		const volatile uint16_t *bank) { (void)pc; (void)bank; }
+static inline void pc_sample_stop(void) {}
+static inline void pc_sample_resume(void) {}
+static inline void pc_sample_pause(void) {}
+static inline bool pc_sample_dump(void) { return false; }
+
+#endif
+
+#endif /* PC_SAMPLE_H */
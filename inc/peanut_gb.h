@@ -43,6 +43,7 @@
 
 #include <stdlib.h>	/* Required for qsort and abort */
 #include <stdint.h>	/* Required for int types */
+#include <stddef.h>	/* Required for offsetof */
 #include <string.h>	/* Required for memset */
 #include <time.h>	/* Required for tm struct */
 
@@ -83,6 +84,52 @@
 # define ENABLE_SOUND 0
 #endif
 
+/* Calls used to access the APU registers when ENABLE_SOUND is set. A
+ * front-end may redirect these, for example to hand the writes to another
+ * core. */
+#ifndef PEANUT_GB_AUDIO_READ
+# define PEANUT_GB_AUDIO_READ(gb, addr)		audio_read(addr)
+#endif
+#ifndef PEANUT_GB_AUDIO_WRITE
+# define PEANUT_GB_AUDIO_WRITE(gb, addr, val)	audio_write(addr, val)
+#endif
+
+/* Called after a write to the MBC may have changed selected_rom_bank. A
+ * front-end that does not hold the whole ROM in memory may use this to fetch
+ * the bank before it is read. */
+#ifndef PEANUT_GB_ROM_BANK_SELECT
+# define PEANUT_GB_ROM_BANK_SELECT(gb)
+#endif
+
+/* Called for each opcode executed, with CB-prefixed ones apart, and each
+ * memory access by the CPU or OAM DMA. A front-end may define these to
+ * count what a game does. */
+#ifndef PEANUT_GB_COUNT_OPCODE
+# define PEANUT_GB_COUNT_OPCODE(gb, op)
+#endif
+#ifndef PEANUT_GB_COUNT_CB_OPCODE
+# define PEANUT_GB_COUNT_CB_OPCODE(gb, op)
+#endif
+#ifndef PEANUT_GB_COUNT_READ
+# define PEANUT_GB_COUNT_READ(gb, addr)
+#endif
+#ifndef PEANUT_GB_COUNT_WRITE
+# define PEANUT_GB_COUNT_WRITE(gb, addr)
+#endif
+
+/* Placed on the lookup tables read on every instruction. A front-end may
+ * define it as a section attribute to keep them in faster memory. */
+#ifndef PEANUT_GB_HOT_TABLE
+# define PEANUT_GB_HOT_TABLE
+#endif
+
+/* Bracket the rendering of each line. A front-end may define these to time
+ * it. */
+#ifndef PROFILE_BEGIN
+# define PROFILE_BEGIN(id)
+# define PROFILE_END(id)
+#endif
+
 /* Enable LCD drawing. On by default. May be turned off for testing purposes. */
 #ifndef ENABLE_LCD
 # define ENABLE_LCD 1
@@ -490,6 +537,42 @@ enum gb_serial_rx_ret_e
  */
 struct gb_s
 {
+	/* The fields used by nearly every instruction come first. Thumb-1, as
+	 * run by the RP2040, only has immediate offsets of up to 31 bytes for
+	 * byte loads, 62 for halfwords and 124 for words. Further fields need
+	 * their offset loaded into a register first, so the large arrays and
+	 * the callbacks used once in a while are last. */
+	struct cpu_registers_s cpu_reg;
+
+	/* Cartridge information:
+	 * Memory Bank Controller (MBC) type. */
+	int8_t mbc;
+	/* Cartridge ROM/RAM mode select. */
+	uint8_t cart_mode_select;
+	/* Whether the MBC has internal RAM. */
+	uint8_t cart_ram;
+	uint8_t enable_cart_ram;
+
+	uint16_t selected_rom_bank;
+	/* WRAM and VRAM bank selection not available. */
+	uint8_t cart_ram_bank;
+	/* Number of RAM banks in cartridge. Ignore for MBC2. */
+	uint8_t num_ram_banks;
+
+	struct
+	{
+		unsigned gb_halt	: 1;
+		unsigned gb_ime		: 1;
+		unsigned gb_frame	: 1; /* New frame drawn. */
+		unsigned lcd_blank	: 1;
+	};
+
+	/* Number of ROM banks in cartridge. */
+	uint16_t num_rom_banks_mask;
+
+	//struct gb_registers_s gb_reg;
+	struct count_s counter;
+
 	/**
 	 * Return byte from ROM at given address.
 	 *
@@ -518,46 +601,10 @@ struct gb_s
 	void (*gb_cart_ram_write)(struct gb_s*, const uint_fast32_t addr,
 				  const uint8_t val);
 
-	/**
-	 * Notify front-end of error.
-	 *
-	 * \param gb_s			emulator context
-	 * \param gb_error_e	error code
-	 * \param addr			address of where error occurred
-	 */
-	void (*gb_error)(struct gb_s*, const enum gb_error_e, const uint16_t addr);
-
-	/* Transmit one byte and return the received byte. */
-	void (*gb_serial_tx)(struct gb_s*, const uint8_t tx);
-	enum gb_serial_rx_ret_e (*gb_serial_rx)(struct gb_s*, uint8_t* rx);
-
-	/* Read byte from boot ROM at given address. */
-	uint8_t (*gb_bootrom_read)(struct gb_s*, const uint_fast16_t addr);
-
-	struct
-	{
-		unsigned gb_halt	: 1;
-		unsigned gb_ime		: 1;
-		unsigned gb_frame	: 1; /* New frame drawn. */
-		unsigned lcd_blank	: 1;
-	};
-
-	/* Cartridge information:
-	 * Memory Bank Controller (MBC) type. */
-	int8_t mbc;
-	/* Whether the MBC has internal RAM. */
-	uint8_t cart_ram;
-	/* Number of ROM banks in cartridge. */
-	uint16_t num_rom_banks_mask;
-	/* Number of RAM banks in cartridge. Ignore for MBC2. */
-	uint8_t num_ram_banks;
+	/* The I/O registers, read by the PPU and timers on every step, are
+	 * within 255 bytes of the start, an offset a single MOVS loads. */
+	uint8_t hram_io[HRAM_IO_SIZE];
 
-	uint16_t selected_rom_bank;
-	/* WRAM and VRAM bank selection not available. */
-	uint8_t cart_ram_bank;
-	uint8_t enable_cart_ram;
-	/* Cartridge ROM/RAM mode select. */
-	uint8_t cart_mode_select;
 	union
 	{
 		struct
@@ -571,16 +618,6 @@ struct gb_s
 		uint8_t cart_rtc[5];
 	};
 
-	struct cpu_registers_s cpu_reg;
-	//struct gb_registers_s gb_reg;
-	struct count_s counter;
-
-	/* TODO: Allow implementation to allocate WRAM, VRAM and Frame Buffer. */
-	uint8_t wram[WRAM_SIZE];
-	uint8_t vram[VRAM_SIZE];
-	uint8_t oam[OAM_SIZE];
-	uint8_t hram_io[HRAM_IO_SIZE];
-
 	struct
 	{
 		/**
@@ -606,6 +643,15 @@ struct gb_s
 				const uint8_t *pixels,
 				const uint_fast8_t line);
 
+		/**
+		 * Optional. Return the buffer of 160 pixels that line
+		 * "line" is to be rendered into. The same buffer is then
+		 * passed to lcd_draw_line. If NULL, lines are rendered
+		 * into a buffer on the stack.
+		 */
+		uint8_t *(*lcd_line_buffer)(struct gb_s *gb,
+				const uint_fast8_t line);
+
 		/* Palettes */
 		uint8_t bg_palette[4];
 		uint8_t sp_palette[8];
@@ -652,6 +698,28 @@ struct gb_s
 		/* Implementation defined data. Set to NULL if not required. */
 		void *priv;
 	} direct;
+
+	/**
+	 * Notify front-end of error.
+	 *
+	 * \param gb_s			emulator context
+	 * \param gb_error_e	error code
+	 * \param addr			address of where error occurred
+	 */
+	void (*gb_error)(struct gb_s*, const enum gb_error_e, const uint16_t addr);
+
+	/* Transmit one byte and return the received byte. */
+	void (*gb_serial_tx)(struct gb_s*, const uint8_t tx);
+	enum gb_serial_rx_ret_e (*gb_serial_rx)(struct gb_s*, uint8_t* rx);
+
+	/* Read byte from boot ROM at given address. */
+	uint8_t (*gb_bootrom_read)(struct gb_s*, const uint_fast16_t addr);
+
+	uint8_t oam[OAM_SIZE];
+
+	/* TODO: Allow implementation to allocate WRAM, VRAM and Frame Buffer. */
+	uint8_t wram[WRAM_SIZE];
+	uint8_t vram[VRAM_SIZE];
 };
 
 #ifndef PEANUT_GB_HEADER_ONLY
@@ -680,6 +748,17 @@ struct gb_s
 #define IO_BANK	0x50
 #define IO_IE	0xFF
 
+#if defined(__STDC_VERSION__) && __STDC_VERSION__ >= 201112L && UINTPTR_MAX == UINT32_MAX
+/* Keep the hot fields of struct gb_s within the reach of Thumb-1 loads. */
+_Static_assert(offsetof(struct gb_s, num_ram_banks) < 32,
+		"CPU registers and MBC state out of byte load range");
+_Static_assert(offsetof(struct gb_s, counter) + sizeof(struct count_s) <= 128 &&
+		offsetof(struct gb_s, gb_cart_ram_write) <= 124,
+		"Counters and cartridge callbacks out of word load range");
+_Static_assert(offsetof(struct gb_s, hram_io) + 0x80 <= 256,
+		"I/O registers out of MOVS offset range");
+#endif
+
 #define IO_TAC_RATE_MASK	0x3
 #define IO_TAC_ENABLE_MASK	0x4
 
@@ -696,6 +775,8 @@ struct gb_s
  */
 uint8_t __gb_read(struct gb_s *gb, uint16_t addr)
 {
+	PEANUT_GB_COUNT_READ(gb, addr);
+
 	switch(PEANUT_GB_GET_MSN16(addr))
 	{
 	case 0x0:
@@ -772,7 +853,7 @@ uint8_t __gb_read(struct gb_s *gb, uint16_t addr)
 		if((addr >= 0xFF10) && (addr <= 0xFF3F))
 		{
 #if ENABLE_SOUND
-			return audio_read(addr);
+			return PEANUT_GB_AUDIO_READ(gb, addr);
 #else
 			static const uint8_t ortab[] = {
 				0x80, 0x3f, 0x00, 0xff, 0xbf,
@@ -804,6 +885,8 @@ uint8_t __gb_read(struct gb_s *gb, uint16_t addr)
  */
 void __gb_write(struct gb_s *gb, uint_fast16_t addr, uint8_t val)
 {
+	PEANUT_GB_COUNT_WRITE(gb, addr);
+
 	switch(PEANUT_GB_GET_MSN16(addr))
 	{
 	case 0x0:
@@ -822,6 +905,7 @@ void __gb_write(struct gb_s *gb, uint_fast16_t addr, uint8_t val)
 			gb->selected_rom_bank = (gb->selected_rom_bank & 0x100) | val;
 			gb->selected_rom_bank =
 				gb->selected_rom_bank & gb->num_rom_banks_mask;
+			PEANUT_GB_ROM_BANK_SELECT(gb);
 			return;
 		}
 
@@ -863,6 +947,7 @@ void __gb_write(struct gb_s *gb, uint_fast16_t addr, uint8_t val)
 			gb->selected_rom_bank = (val & 0x01) << 8 | (gb->selected_rom_bank & 0xFF);
 
 		gb->selected_rom_bank = gb->selected_rom_bank & gb->num_rom_banks_mask;
+		PEANUT_GB_ROM_BANK_SELECT(gb);
 		return;
 
 	case 0x4:
@@ -872,6 +957,7 @@ void __gb_write(struct gb_s *gb, uint_fast16_t addr, uint8_t val)
 			gb->cart_ram_bank = (val & 3);
 			gb->selected_rom_bank = ((val & 3) << 5) | (gb->selected_rom_bank & 0x1F);
 			gb->selected_rom_bank = gb->selected_rom_bank & gb->num_rom_banks_mask;
+			PEANUT_GB_ROM_BANK_SELECT(gb);
 		}
 		else if(gb->mbc == 3)
 			gb->cart_ram_bank = val;
@@ -955,7 +1041,7 @@ void __gb_write(struct gb_s *gb, uint_fast16_t addr, uint8_t val)
 		if((addr >= 0xFF10) && (addr <= 0xFF3F))
 		{
 #if ENABLE_SOUND
-			audio_write(addr, val);
+			PEANUT_GB_AUDIO_WRITE(gb, addr, val);
 #else
 			gb->hram_io[addr - IO_ADDR] = val;
 #endif
@@ -1137,6 +1223,7 @@ uint8_t __gb_execute_cb(struct gb_s *gb)
 	uint8_t val;
 	uint8_t writeback = 1;
 
+	PEANUT_GB_COUNT_CB_OPCODE(gb, cbop);
 	inst_cycles = 8;
 	/* Add an additional 8 cycles to these sets of instructions. */
 	switch(cbop & 0xC7)
@@ -1345,7 +1432,8 @@ static int compare_sprites(const void *in1, const void *in2)
 
 void __gb_draw_line(struct gb_s *gb)
 {
-	uint8_t pixels[160] = {0};
+	uint8_t line_pixels[160];
+	uint8_t *pixels = line_pixels;
 
 	/* If LCD not initialised by front-end, don't render anything. */
 	if(gb->display.lcd_draw_line == NULL)
@@ -1373,6 +1461,11 @@ void __gb_draw_line(struct gb_s *gb)
 		}
 	}
 
+	if(gb->display.lcd_line_buffer != NULL)
+		pixels = gb->display.lcd_line_buffer(gb, gb->hram_io[IO_LY]);
+
+	memset(pixels, 0, 160);
+
 	/* If background is enabled, draw it. */
 	if(gb->hram_io[IO_LCDC] & LCDC_BG_ENABLE)
 	{
@@ -1655,7 +1748,7 @@ void __gb_step_cpu(struct gb_s *gb)
 {
 	uint8_t opcode;
 	uint_fast16_t inst_cycles;
-	static const uint8_t op_cycles[0x100] =
+	static const uint8_t op_cycles[0x100] PEANUT_GB_HOT_TABLE =
 	{
 		/* *INDENT-OFF* */
 		/*0 1 2  3  4  5  6  7  8  9  A  B  C  D  E  F	*/
@@ -1677,7 +1770,7 @@ void __gb_step_cpu(struct gb_s *gb)
 		12,12,8, 4, 0,16, 8,16,12, 8,16, 4, 0, 0, 8,16	/* 0xF0 */
 		/* *INDENT-ON* */
 	};
-	static const uint_fast16_t TAC_CYCLES[4] = {1024, 16, 64, 256};
+	static const uint_fast16_t TAC_CYCLES[4] PEANUT_GB_HOT_TABLE = {1024, 16, 64, 256};
 
 	/* Handle interrupts */
 	/* If gb_halt is positive, then an interrupt must have occured by the
@@ -1731,6 +1824,7 @@ void __gb_step_cpu(struct gb_s *gb)
 	/* Obtain opcode */
 	opcode = __gb_read(gb, gb->cpu_reg.pc.reg++);
 	inst_cycles = op_cycles[opcode];
+	PEANUT_GB_COUNT_OPCODE(gb, opcode);
 
 	/* Execute opcode */
 	switch(opcode)
@@ -3376,7 +3470,11 @@ void __gb_step_cpu(struct gb_s *gb)
 				(gb->hram_io[IO_STAT] & ~STAT_MODE) | IO_STAT_MODE_SEARCH_TRANSFER;
 #if ENABLE_LCD
 			if(!gb->lcd_blank)
+			{
+				PROFILE_BEGIN(PROFILE_PPU_LINE);
 				__gb_draw_line(gb);
+				PROFILE_END(PROFILE_PPU_LINE);
+			}
 #endif
 			/* If halted immediately jump to next LCD mode. */
 			if (gb->counter.lcd_count < LCD_MODE_0_CYCLES)
@@ -3594,6 +3692,7 @@ enum gb_init_error_e gb_init(struct gb_s *gb,
 
 	gb->lcd_blank = 0;
 	gb->display.lcd_draw_line = NULL;
+	gb->display.lcd_line_buffer = NULL;
 
 	gb_reset(gb);
 
@@ -3642,6 +3741,13 @@ void gb_init_lcd(struct gb_s *gb,
 
 	return;
 }
+
+void gb_init_lcd_line_buffer(struct gb_s *gb,
+		uint8_t *(*lcd_line_buffer)(struct gb_s *gb,
+			const uint_fast8_t line))
+{
+	gb->display.lcd_line_buffer = lcd_line_buffer;
+}
 #endif
 
 void gb_set_bootrom(struct gb_s *gb,
@@ -3765,6 +3871,20 @@ void gb_init_lcd(struct gb_s *gb,
 		void (*lcd_draw_line)(struct gb_s *gb,
 			const uint8_t *pixels,
 			const uint_fast8_t line));
+
+/**
+ * Lets the front-end choose where each line is rendered, so that the pixels
+ * passed to lcd_draw_line need not be copied. "lcd_line_buffer" returns the
+ * buffer of 160 pixels for line "line", or is NULL to render into a buffer on
+ * the stack. gb_init() resets it to NULL.
+ *
+ * \param gb	An initialised emulator context. Must not be NULL.
+ * \param lcd_line_buffer Pointer to function that returns the buffer to render
+ *		line "line" into.
+ */
+void gb_init_lcd_line_buffer(struct gb_s *gb,
+		uint8_t *(*lcd_line_buffer)(struct gb_s *gb,
+			const uint_fast8_t line));
 #endif
 
 /**
@@ -0,0 +1,110 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stdint.h>
+
+/**
+ * Scoped profiling of the hot paths.
+ *
+ * PROFILE_BEGIN(id) and PROFILE_END(id) bracket a span in one block. The
+ * time between them is added to the running total of "id" for the core it
+ * ran on, along with a call count. Spans may nest, in which case the outer
+ * one includes the inner. profile_frame(), called by core0 once per frame,
+ * takes the totals of the frame just ended, which profile_report() prints.
+ *
+ * Time is read from the microsecond timer. Spans shorter than a microsecond,
+ * such as a single CPU instruction, mostly read as 0 or 1, but the totals
+ * over a frame are right on average. Host builds read clock_gettime() in the
+ * same unit, so that results are comparable.
+ *
+ * With PROFILING set to 0, the default, the macros and functions compile to
+ * nothing.
+ */
+
+#ifndef PROFILING
+# define PROFILING	0
+#endif
+
+enum profile_id {
+	PROFILE_CPU = 0,			// Core0: __gb_step_cpu(), including the PPU
+	PROFILE_PPU_LINE,			// Core0: __gb_draw_line()
+	PROFILE_LCD_QUEUE,			// Core0: lcd_draw_line()
+	PROFILE_LCD_SEND,			// Core1: sending a line or frame to the LCD
+	PROFILE_APU,				// Core1: synthesising samples
+	PROFILE_ROM_BANK,			// Reading a ROM bank from the SD card
+	PROFILE_STORAGE,			// Reading and writing cart RAM
+	PROFILE_COUNT
+};
+
+#if PROFILING
+
+#if PICO_ON_DEVICE
+# include <pico/time.h>
+# include <pico/platform.h>
+
+static inline uint32_t profile_now(void)
+{
+	return time_us_32();
+}
+
+static inline uint_fast8_t profile_core(void)
+{
+	return get_core_num();
+}
+#else
+# include <time.h>
+
+static inline uint32_t profile_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint32_t)ts.tv_sec * 1000000u + ts.tv_nsec / 1000;
+}
+
+static inline uint_fast8_t profile_core(void)
+{
+	return 0;
+}
+#endif
+
+/* Running totals, written only by the core they belong to. */
+struct profile_totals {
+	uint32_t us[PROFILE_COUNT];
+	uint32_t calls[PROFILE_COUNT];
+};
+extern struct profile_totals profile_running[2];
+
+static inline void profile_add(enum profile_id id, uint32_t us)
+{
+	struct profile_totals *t = &profile_running[profile_core()];
+
+	t->us[id] += us;
+	t->calls[id]++;
+}
+
+# define PROFILE_BEGIN(id)	const uint32_t profile_start_##id = profile_now()
+# define PROFILE_END(id)	profile_add(id, profile_now() - profile_start_##id)
+
+/**
+ * Core0: close the frame just emulated.
+ */
+void profile_frame(void);
+
+/**
+ * Print the totals of the last frame and the largest of each since the
+ * last report, then start again.
+ */
+void profile_report(void);
+
+#else
+
+# define PROFILE_BEGIN(id)	do {} while(0)
+# define PROFILE_END(id)	do {} while(0)
+
+static inline void profile_frame(void) {}
+static inline void profile_report(void) {}
+
+#endif
+
+#endif /* PROFILE_H */
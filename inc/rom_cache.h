@@ -0,0 +1,81 @@
+#ifndef ROM_CACHE_H
+#define ROM_CACHE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * Demand paged ROM.
+ *
+ * Instead of copying the whole ROM to flash before play, the ROM file is
+ * kept open on the SD card. Bank 0 is held in RAM and switchable banks are
+ * read into an LRU cache of ROM_CACHE_SLOTS 16 KiB slots. When the MBC
+ * selects a bank that is not cached, it is read ahead by DMA while the game
+ * carries on, and core0 only waits if the game reads from the bank before it
+ * has arrived. FatFs fast seek is used so that seeking to a bank does not
+ * walk the cluster chain.
+ */
+
+#define ROM_CACHE_BANK_SIZE	0x4000
+
+/* Number of switchable banks held in RAM. */
+#define ROM_CACHE_SLOTS		4
+
+/* Largest ROM supported, in banks (8 MiB, the MBC5 limit). */
+#define ROM_CACHE_MAX_BANKS	512
+
+struct rom_cache_stats {
+	uint32_t misses;		// Banks read from the SD card
+	uint32_t miss_us;		// Time core0 spent waiting for banks
+	uint32_t prefetches;		// Banks read ahead without waiting
+};
+
+/* Bank 0 and the currently selected bank. Only to be used by the inline
+ * functions below. */
+extern uint8_t rom_cache_bank0[ROM_CACHE_BANK_SIZE];
+extern uint_fast16_t rom_cache_bank;
+extern const uint8_t *rom_cache_slot;
+
+/**
+ * Open the ROM at "path" on the SD card and load bank 0. The previously
+ * opened ROM, if any, is closed. Returns false on error.
+ */
+bool rom_cache_open(const char *path);
+
+/**
+ * Open the last ROM passed to rom_cache_open() again, for example after the
+ * SD card has been remounted. Returns false if there is none.
+ */
+bool rom_cache_reopen(void);
+
+/**
+ * Called when the MBC selects "bank". If it is not cached, starts reading it
+ * from the SD card without waiting, if the card is free.
+ */
+void rom_cache_select(uint_fast16_t bank);
+
+/**
+ * Make "bank" the current bank, waiting for it to be read from the SD card
+ * if it is not cached yet.
+ */
+void rom_cache_load(uint_fast16_t bank);
+
+void rom_cache_get_stats(struct rom_cache_stats *stats);
+
+/**
+ * Read the byte at "addr" within the ROM.
+ */
+static inline uint8_t rom_cache_read(const uint_fast32_t addr)
+{
+	const uint_fast16_t bank = addr / ROM_CACHE_BANK_SIZE;
+
+	if(bank == 0)
+		return rom_cache_bank0[addr];
+
+	if(bank != rom_cache_bank)
+		rom_cache_load(bank);
+
+	return rom_cache_slot[addr % ROM_CACHE_BANK_SIZE];
+}
+
+#endif /* ROM_CACHE_H */
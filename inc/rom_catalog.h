@@ -0,0 +1,81 @@
+#ifndef ROM_CATALOG_H
+#define ROM_CATALOG_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Catalogue of the ROMs in ROM_CATALOG_DIR, plain (*.gb) or LZ4 compressed
+ * (*.gbz, *.gb.lz4).
+ *
+ * Listing the directory for every page of the ROM selector costs a mount and
+ * a directory walk that grows with the page number. Instead, the directory is
+ * scanned once into ROM_CATALOG_FILE, which holds one record per ROM with the
+ * fields of its cartridge header, followed by the record numbers in name
+ * order. The catalogue is rebuilt only when the directory's timestamp, its
+ * number of ROMs or a hash of their names, sizes and timestamps no longer
+ * match the ones recorded in the file. Once open, the sort order is held in
+ * RAM and each record is a single seek and read away.
+ *
+ * If the file cannot be written, as on a full or write-protected card, the
+ * ROMs are found by walking the directory instead, in directory order and
+ * without the cartridge header fields.
+ */
+
+#define ROM_CATALOG_DIR		"\\gb"
+#define ROM_CATALOG_PATTERN	"*.gb*"
+#define ROM_CATALOG_FILE	ROM_CATALOG_DIR "\\.index"
+
+/* Most ROMs listed. */
+#define ROM_CATALOG_MAX_ENTRIES	4096
+
+/* Space for a file name in a record, including the terminator. Longer
+ * names are truncated and the file is opened by its 8.3 name. */
+#define ROM_CATALOG_NAME_LEN	64
+
+/* The record's name was truncated, use altname to open the file. */
+#define ROM_CATALOG_TRUNCATED	0x01
+
+/* The ROM is LZ4 compressed (*.gbz or *.gb.lz4). */
+#define ROM_CATALOG_COMPRESSED	0x02
+
+struct rom_catalog_entry {
+	char name[ROM_CATALOG_NAME_LEN];	// File name
+	char altname[13];			// 8.3 file name, if the name has one
+	char title[17];				// Title from the cartridge header
+	uint8_t cart_type;			// Cartridge type (MBC) at 0x147
+	uint8_t flags;
+	uint16_t checksum;			// Global checksum at 0x14E
+	uint32_t size;				// ROM size in bytes, once decompressed
+};
+
+/**
+ * Open the catalogue on the SD card, rebuilding it first if the
+ * directory has changed, or walking the directory if the catalogue cannot
+ * be written. Returns false if the directory cannot be read.
+ */
+bool rom_catalog_open(void);
+
+/**
+ * Close the catalogue and free the sort order.
+ */
+void rom_catalog_close(void);
+
+/**
+ * Number of ROMs in the open catalogue.
+ */
+uint16_t rom_catalog_count(void);
+
+/**
+ * Read the "index"th ROM in name order into "entry". Returns false if there
+ * is no such ROM or it could not be read.
+ */
+bool rom_catalog_get(uint16_t index, struct rom_catalog_entry *entry);
+
+/**
+ * Write the path used to open the ROM described by "entry" into "path".
+ */
+void rom_catalog_path(const struct rom_catalog_entry *entry, char *path, size_t len);
+
+#endif /* ROM_CATALOG_H */
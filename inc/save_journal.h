@@ -0,0 +1,65 @@
+#ifndef SAVE_JOURNAL_H
+#define SAVE_JOURNAL_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * Cart RAM saved to a journal in on-board flash.
+ *
+ * The last SAVE_JOURNAL_SIZE bytes of flash are a ring of 4 KiB sectors.
+ * The first page of each sector holds a header and one 16-byte entry for
+ * each of the other fifteen pages, which hold copies of 256-byte pages of
+ * cart RAM. Changed pages are appended, data first and entry second, each
+ * entry carrying a sequence number, so that after a power loss the newest
+ * complete copy of each page is the one replayed. Sectors are reused
+ * round the ring: before one is erased, the pages it still holds the
+ * newest copy of are appended again.
+ *
+ * The binary runs from RAM (copy_to_ram), core1 never reads flash and the
+ * interrupt handlers are all in RAM, so flash is programmed from core0
+ * without pausing the display core or masking interrupts.
+ *
+ * The journal holds the save of one game at a time. Opening it for another
+ * game discards the previous game's pages.
+ */
+
+#define SAVE_JOURNAL_SIZE	(128 * 1024)
+#define SAVE_JOURNAL_OFFSET	(PICO_FLASH_SIZE_BYTES - SAVE_JOURNAL_SIZE)
+#define SAVE_JOURNAL_PAGE_SIZE	256
+
+/* Largest cart RAM supported. */
+#define SAVE_JOURNAL_MAX_RAM	32768
+
+struct save_journal_stats {
+	uint32_t pages_written;			// Pages appended for writes
+	uint32_t pages_unchanged;		// Pages not written as flash already held them
+	uint32_t pages_moved;			// Pages appended again to free a sector
+	uint32_t erases;			// Sectors erased
+};
+
+/**
+ * Replay the journal for the game identified by "game_id" into "ram", which
+ * is "size" bytes long. Pages never saved are left as they are. Also erases
+ * sectors ahead of time, as save_journal_poll() does. Returns the number of
+ * pages restored.
+ */
+uint_fast16_t save_journal_open(uint32_t game_id, uint8_t *ram, uint32_t size);
+
+/**
+ * Append the pages of "len" bytes of cart RAM at "offset", both multiples of
+ * SAVE_JOURNAL_PAGE_SIZE, that differ from their newest copy in flash.
+ * Returns false if flash could not be written.
+ */
+bool save_journal_write(uint32_t offset, const uint8_t *data, uint32_t len);
+
+/**
+ * Free sectors ahead of time until a few are erased. Each erase takes tens
+ * of milliseconds, and may take hundreds, so only call this where a stall
+ * is expected, such as when a game ends.
+ */
+void save_journal_poll(void);
+
+void save_journal_get_stats(struct save_journal_stats *stats);
+
+#endif /* SAVE_JOURNAL_H */
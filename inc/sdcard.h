@@ -34,7 +34,7 @@ static spi_t spis[]={
         .miso_gpio=12,
         .mosi_gpio=15,
         .sck_gpio=10,
-        .baud_rate=12500*1000,
+        .baud_rate=25000*1000,
         .dma_isr=spi_dma_isr
     }
 };
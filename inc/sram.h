@@ -0,0 +1,60 @@
+#ifndef SRAM_H
+#define SRAM_H
+
+#include <pico/platform.h>
+
+/**
+ * Placement of data in the RP2040's SRAM banks.
+ *
+ * Main SRAM is four 64 KiB banks, striped word by word, so that code and
+ * data spread over all of them. Each core also has a 4 KiB scratch bank to
+ * itself, which also holds its stack: SCRATCH_Y for core0, SCRATCH_X for
+ * core1. A bank serves one access per cycle, so an access to a bank that
+ * another core or DMA is using waits.
+ *
+ * memmap_gb.ld leaves the top 4 KiB of each main bank out of the striped
+ * RAM, as striping needs banks of the same size, and addresses them through
+ * the non-striped alias. A buffer streamed from there only meets the
+ * quarter of striped accesses that land in its bank, instead of every bank
+ * in turn. Each top holds one stream:
+ *
+ *  SRAM3	Audio ring, read by DMA
+ *  SRAM2	LCD line queue, or the frame pipeline's DMA rows, and the
+ *		silence block audio DMA plays when the ring runs dry
+ *  SRAM1	APU record queue, from core0 to core1
+ *  SRAM0	Overlay glyph cache, core1 only
+ *
+ * The tops are not cleared at boot, so only buffers written before they are
+ * read go there.
+ *
+ * The emulator's own state stays striped. The gb_s context, cart RAM and
+ * bank 0 of the ROM, or the ROM cache, are each larger than a bank's top,
+ * and core0 reads all over them on every instruction, which striping
+ * spreads over the four banks.
+ *
+ *  CORE0_DATA(group)		Small data core0 uses on every instruction
+ *  CORE1_DATA(group)		Small data core1 uses on every pixel
+ *  BANK_DATA(bank, group)	Buffer in the top of main bank "bank", 0-3
+ *
+ * The bus performance counters report the contested accesses of each bank
+ * with the 'a' serial command. With SRAM_PLACEMENT set to 0 in
+ * CMakeLists.txt, everything is left in striped RAM and the SDK's linker
+ * script is used.
+ */
+
+#ifndef SRAM_PLACEMENT
+# define SRAM_PLACEMENT	0
+#endif
+
+#if SRAM_PLACEMENT
+# define CORE0_DATA(group)	__scratch_y(group)
+# define CORE1_DATA(group)	__scratch_x(group)
+# define BANK_DATA(bank, group)	\
+	__attribute__((section(".sram" #bank "_top." group)))
+#else
+# define CORE0_DATA(group)
+# define CORE1_DATA(group)
+# define BANK_DATA(bank, group)
+#endif
+
+#endif /* SRAM_H */
@@ -0,0 +1,118 @@
+#ifndef STORAGE_H
+#define STORAGE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "ff.h"
+
+/**
+ * SD card storage session.
+ *
+ * The card is mounted once with storage_init() and stays mounted. Users call
+ * storage_ready() before touching the file system, which only checks the
+ * drive status (a GPIO read at most) and remounts if a previous operation
+ * reported the card lost through storage_error().
+ *
+ * The save file is kept open between saves. It is allocated as one
+ * contiguous extent, so whole sectors of it are written in place straight to
+ * the card without going through the FAT or the directory entry.
+ */
+
+#define STORAGE_SECTOR_SIZE	512
+
+struct storage_stats {
+	uint32_t mounts;			// Times the volume was mounted
+	uint32_t save_writes;			// Calls to storage_save_write()
+	uint32_t save_bytes;			// Bytes written to the save file
+	uint32_t sck_hz;			// SPI clock the card settled at
+	uint32_t sck_fallbacks;			// Clock steps dropped after transfer errors
+};
+
+/**
+ * Mount the SD card. Returns false if it could not be mounted.
+ */
+bool storage_init(void);
+
+/**
+ * Returns true if the card is mounted, mounting it again if it was lost.
+ */
+bool storage_ready(void);
+
+/**
+ * Returns the number of times the card has been mounted. Files opened before
+ * it last changed are no longer valid.
+ */
+uint32_t storage_mount_count(void);
+
+/**
+ * Report the result of a file system operation. Errors that mean the card
+ * has gone away cause it to be mounted again by the next storage_ready().
+ */
+void storage_error(FRESULT fr);
+
+/**
+ * Open the save file at "path", creating it and allocating "size" bytes
+ * contiguously if it does not exist. Any save file already open is closed.
+ * Returns false on error.
+ */
+bool storage_save_open(const char *path, uint32_t size);
+
+/**
+ * Read "len" bytes from the start of the open save file into "buf". Returns
+ * the number of bytes read.
+ */
+uint32_t storage_save_read(void *buf, uint32_t len);
+
+/**
+ * Write "len" bytes from "data" at "offset" in the open save file. If the
+ * file is contiguous and the range is whole sectors, this is a single write
+ * to the card. Returns false on error.
+ */
+bool storage_save_write(uint32_t offset, const void *data, uint32_t len);
+
+/**
+ * Start writing "len" bytes from "data" at "offset" in the open save file
+ * and return without waiting for the card. Only whole sectors of a
+ * contiguous file can be written this way. "data" is read while the write
+ * is in progress. Returns false if the write was not started, in which case
+ * storage_save_write() can be used instead.
+ */
+bool storage_save_write_async(uint32_t offset, const void *data, uint32_t len);
+
+/**
+ * Returns true while a write started by storage_save_write_async() is in
+ * progress. Otherwise sets "ok" to whether the last one succeeded.
+ */
+bool storage_save_pending(bool *ok);
+
+/**
+ * Called from interrupt context when a read started by storage_read_async()
+ * finishes, with "ok" set if it succeeded.
+ */
+typedef void (*storage_read_done_t)(bool ok, void *context);
+
+/**
+ * Returns the sector holding byte "offset" of "fp" if the "len" bytes from
+ * there are contiguous on the card, from the file's fast seek link map.
+ * Returns 0 if they are not, or if the file has no link map.
+ */
+LBA_t storage_file_lba(FIL *fp, FSIZE_t offset, FSIZE_t len);
+
+/**
+ * Start reading "count" sectors from "lba" into "buf" and return without
+ * waiting for the card. "done" is called once they have been read. Returns
+ * false, without starting, if the card is busy with another transfer or the
+ * read could not be started.
+ */
+bool storage_read_async(LBA_t lba, void *buf, uint32_t count,
+	storage_read_done_t done, void *context);
+
+/**
+ * Close the open save file, if any.
+ */
+void storage_save_close(void);
+
+void storage_get_stats(struct storage_stats *stats);
+
+#endif /* STORAGE_H */
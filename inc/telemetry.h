@@ -0,0 +1,95 @@
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * Per-frame performance records.
+ *
+ * Core0 fills in one record per emulated frame, kept in a ring of the last
+ * TELEMETRY_FRAMES frames. A dump prints the ring as CSV on stdio, one
+ * record per core1 telemetry job, so that the game carries on meanwhile.
+ * Recording pauses while any dump is printed. tools/telemetry.py reads a dump
+ * and reports percentiles of each column.
+ *
+ * The other dumps print through the same core1 printer, telemetry_print(),
+ * one at a time.
+ */
+
+/* Frames kept. Must be a power of two. */
+#define TELEMETRY_FRAMES	256
+
+/* Flags of a frame. */
+#define TELEMETRY_FRAME_SKIP	0x01		// Frame skip was on
+#define TELEMETRY_DROPPED	0x02		// The frame was not shown, core1 being busy
+#define TELEMETRY_SAVE_FLUSH	0x04		// Cart RAM was written out after the frame
+#define TELEMETRY_ROM_MISS	0x08		// A ROM bank was read from the SD card
+#define TELEMETRY_UNDERRUN	0x10		// Audio ran dry since the previous frame
+
+struct telemetry_frame {
+	uint32_t frame;				// Frames since recording started
+	uint32_t emu_us;			// Core0 time emulating the frame
+	uint32_t ppu_us;			// Part of it spent rendering lines
+	uint32_t lcd_wait_us;			// Part of it spent waiting for a free line slot
+	uint32_t apu_us;			// Core1 time synthesising audio since the previous frame
+	uint32_t storage_us;			// Core0 time reading ROM banks and writing cart RAM
+	uint8_t audio_queued;			// Audio blocks waiting to be played at the end of the frame
+	uint8_t flags;
+};
+
+/**
+ * Empty the ring.
+ */
+void telemetry_reset(void);
+
+/**
+ * Core0: the record for the current frame, cleared, or NULL while a dump is
+ * being printed.
+ */
+struct telemetry_frame *telemetry_begin(void);
+
+/**
+ * Core0: add the record returned by telemetry_begin() to the ring.
+ */
+void telemetry_commit(void);
+
+/**
+ * Start dumping the ring. Returns false if a dump is already running or
+ * could not be queued.
+ */
+bool telemetry_dump(void);
+
+/**
+ * Core1: print the lines of a dump from "pos" on, and return the position
+ * to carry on from. Called once per telemetry job.
+ */
+typedef uint32_t (*telemetry_print_fn)(uint32_t pos);
+
+/**
+ * Core1, or core0 for an empty dump: the dump is over, "complete" false if
+ * it was cut short.
+ */
+typedef void (*telemetry_done_fn)(bool complete);
+
+/**
+ * Core0: print a dump on core1 while the game carries on, calling "print"
+ * from "pos" until it returns "end", then "# end", then "done" if not NULL.
+ * Returns false if a dump is already running or could not be queued.
+ */
+bool telemetry_print(telemetry_print_fn print, uint32_t pos, uint32_t end,
+	telemetry_done_fn done);
+
+/**
+ * Core0: returns true while a dump is being printed.
+ */
+bool telemetry_printing(void);
+
+/**
+ * Core0: cut short any dump being printed and wait until core1 is done with
+ * stdio. Must be called before core1 is reset, which would otherwise leave
+ * the stdio mutex or the scheduler's spin lock held.
+ */
+void telemetry_print_stop(void);
+
+#endif /* TELEMETRY_H */
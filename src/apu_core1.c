@@ -0,0 +1,329 @@
+/**
+ * APU synthesis on core1, fed by a queue of timestamped register writes
+ * from the emulation core.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#include <pico/stdlib.h>
+#include <hardware/sync.h>
+
+#include "minigb_apu.h"
+#include "audio.h"
+#include "apu_core1.h"
+#include "profile.h"
+#include "sram.h"
+
+#define APU_REG_BASE		0xFF10
+#define APU_REG_COUNT		(0xFF3F - APU_REG_BASE + 1)
+#define APU_REG_NR52		(0xFF26 - APU_REG_BASE)
+
+/* Register offset used to mark the end of a frame in the queue. */
+#define APU_QUEUE_END_FRAME	0x3F
+
+/* Queue records are packed into 32 bits:
+ * bits 31-14: cycle within the frame,
+ * bits 13-8:  register offset from APU_REG_BASE,
+ * bits 7-0:   value written. */
+#define APU_QUEUE_RECORD(cycle, reg, val) \
+	(((uint32_t)(cycle) << 14) | ((uint32_t)(reg) << 8) | (val))
+
+static uint32_t queue[APU_QUEUE_SIZE] BANK_DATA(1, "apu_queue");
+static uint32_t queue_head;					// Written by core0 only
+static uint32_t queue_tail;					// Written by core1 only
+
+/* Core0 mirror of the readable APU state. Values are stored with the
+ * unreadable bits already set. */
+static uint8_t mirror[APU_REG_COUNT];
+static uint8_t predicted_status;				// NR52 channel bits as seen by core0
+static uint32_t status_seq[4];					// Queue index that makes each predicted bit valid
+
+/* Channel enable bits of NR52 published by core1. */
+static uint8_t apu_status;
+
+/* Core1 frame state. The APU context is only touched by core1 once it has
+ * been launched. */
+static struct minigb_apu_ctx apu;
+static uint_fast16_t frame_pos;					// Samples rendered in this frame
+static uint32_t busy_us;					// Time spent rendering
+
+/* Output. Samples are rendered straight into the blocks handed out by the
+ * backend. */
+static const struct audio_backend *out;
+static uint8_t *out_block;
+static uint_fast16_t out_pos;					// Samples written to out_block
+static uint32_t out_discard[APU_SERVICE_SAMPLES];		// Used when no block is free
+
+/* Bits that always read back as 1. */
+static const uint8_t ortab[APU_REG_COUNT] = {
+	0x80, 0x3f, 0x00, 0xff, 0xbf,
+	0xff, 0x3f, 0x00, 0xff, 0xbf,
+	0x7f, 0xff, 0x9f, 0xff, 0xbf,
+	0xff, 0xff, 0x00, 0x00, 0xbf,
+	0x00, 0x00, 0x70,
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
+};
+
+void apu_core1_init(const struct audio_backend *output)
+{
+	minigb_apu_audio_init(&apu);
+
+	for(uint_fast8_t i = 0; i < APU_REG_COUNT; i++)
+		mirror[i] = minigb_apu_audio_read(&apu, APU_REG_BASE + i);
+
+	apu_status = mirror[APU_REG_NR52] & 0x0F;
+	predicted_status = apu_status;
+	mirror[APU_REG_NR52] &= 0xF0;
+
+	for(uint_fast8_t i = 0; i < 4; i++)
+		status_seq[i] = 0;
+
+	queue_head = 0;
+	queue_tail = 0;
+	frame_pos = 0;
+	busy_us = 0;
+
+	out = output;
+	out_block = NULL;
+	out_pos = 0;
+}
+
+static void queue_push(uint32_t record)
+{
+	const uint32_t head = queue_head;
+
+	/* Wait for core1 if the queue is full. */
+	while(head - __atomic_load_n(&queue_tail, __ATOMIC_ACQUIRE) >= APU_QUEUE_SIZE)
+		tight_loop_contents();
+
+	queue[head & (APU_QUEUE_SIZE - 1)] = record;
+	__atomic_store_n(&queue_head, head + 1, __ATOMIC_RELEASE);
+	__sev();						// Core1 may be waiting for work
+}
+
+/**
+ * Record the state core0 expects channel "i" to be in once the write about
+ * to be queued has been processed by core1.
+ */
+static void predict_channel(uint_fast8_t i, bool enabled)
+{
+	if(enabled)
+		predicted_status |= 1 << i;
+	else
+		predicted_status &= ~(1 << i);
+
+	status_seq[i] = queue_head + 1;
+}
+
+void apu_core1_write(uint32_t cycle, uint16_t addr, uint8_t val)
+{
+	const uint_fast8_t reg = addr - APU_REG_BASE;
+
+	if(reg == APU_REG_NR52)
+	{
+		mirror[reg] = (val & 0x80) | ortab[reg];
+
+		/* On APU power off, all registers apart from wave RAM are
+		 * cleared. */
+		if((val & 0x80) == 0)
+		{
+			for(uint_fast8_t i = 0; i < APU_REG_NR52; i++)
+				mirror[i] = ortab[i];
+
+			for(uint_fast8_t i = 0; i < 4; i++)
+				predict_channel(i, false);
+		}
+	}
+	else
+	{
+		/* Writes are ignored while the APU is powered off. */
+		if((mirror[APU_REG_NR52] & 0x80) == 0)
+			return;
+
+		mirror[reg] = val | ortab[reg];
+
+		switch(addr)
+		{
+		case 0xFF14:
+		case 0xFF19:
+		case 0xFF1E:
+		case 0xFF23:
+			if(val & 0x80)
+				predict_channel(reg / 5, true);
+			break;
+
+		case 0xFF1A:
+			predict_channel(2, val & 0x80);
+			break;
+		}
+	}
+
+	queue_push(APU_QUEUE_RECORD(cycle, reg, val));
+}
+
+uint8_t apu_core1_read(uint16_t addr)
+{
+	const uint_fast8_t reg = addr - APU_REG_BASE;
+	uint32_t tail;
+	uint8_t status;
+
+	if(reg != APU_REG_NR52)
+		return mirror[reg];
+
+	/* Use core1's view of the channels, unless a write that changes a
+	 * channel is still in the queue. */
+	tail = __atomic_load_n(&queue_tail, __ATOMIC_ACQUIRE);
+	status = __atomic_load_n(&apu_status, __ATOMIC_RELAXED);
+
+	for(uint_fast8_t i = 0; i < 4; i++)
+	{
+		if((int32_t)(status_seq[i] - tail) > 0)
+			status = (status & ~(1 << i)) | (predicted_status & (1 << i));
+	}
+
+	return mirror[reg] | status;
+}
+
+void apu_core1_end_frame(void)
+{
+	queue_push(APU_QUEUE_RECORD(0, APU_QUEUE_END_FRAME, 0));
+}
+
+/**
+ * Render "n" samples in the output's format.
+ */
+static void render_to(void *buf, uint_fast16_t n)
+{
+	switch(out->format)
+	{
+	case AUDIO_FORMAT_PWM_MONO:
+		minigb_apu_audio_render_pwm(&apu, buf, n, 1, true);
+		break;
+
+	case AUDIO_FORMAT_PWM_STEREO:
+		minigb_apu_audio_render_pwm(&apu, buf, n, 2, true);
+		break;
+
+	case AUDIO_FORMAT_S16_STEREO:
+		minigb_apu_audio_render(&apu, buf, n);
+		break;
+	}
+}
+
+/**
+ * Render "n" samples of the current frame to the output.
+ */
+static void render(uint_fast16_t n)
+{
+	const unsigned sample_bytes =
+		(out->format == AUDIO_FORMAT_PWM_MONO) ? 2 : 4;
+
+	while(n > 0)
+	{
+		uint_fast16_t chunk = n;
+
+		if(out_block == NULL)
+		{
+			out_block = out->get_block();
+			out_pos = 0;
+		}
+
+		if(out_block == NULL)
+		{
+			/* Output is full. Keep the APU running, but drop the
+			 * samples. */
+			render_to(out_discard, n);
+			return;
+		}
+
+		if(chunk > AUDIO_BUFFER_SIZE - out_pos)
+			chunk = AUDIO_BUFFER_SIZE - out_pos;
+
+		render_to(out_block + out_pos * sample_bytes, chunk);
+		out_pos += chunk;
+		n -= chunk;
+
+		if(out_pos == AUDIO_BUFFER_SIZE)
+		{
+			out->submit();
+			out_block = NULL;
+		}
+	}
+}
+
+/**
+ * Convert a cycle within the frame to the index of the sample it falls on.
+ */
+static uint_fast16_t cycle_to_sample(uint32_t cycle)
+{
+	uint32_t sample = (cycle * AUDIO_SAMPLES) / (uint32_t)SCREEN_REFRESH_CYCLES;
+
+	if(sample > AUDIO_SAMPLES)
+		sample = AUDIO_SAMPLES;
+
+	return sample;
+}
+
+bool apu_core1_service(void)
+{
+	const uint32_t head = __atomic_load_n(&queue_head, __ATOMIC_ACQUIRE);
+	uint_fast16_t budget = APU_SERVICE_SAMPLES;
+	bool more = false;
+
+	while(queue_tail != head)
+	{
+		const uint32_t record = queue[queue_tail & (APU_QUEUE_SIZE - 1)];
+		const uint_fast8_t reg = (record >> 8) & 0x3F;
+		uint_fast16_t target = AUDIO_SAMPLES;
+
+		if(reg != APU_QUEUE_END_FRAME)
+			target = cycle_to_sample(record >> 14);
+
+		/* Render up to the sample this record applies at. */
+		if(frame_pos < target)
+		{
+			uint_fast16_t n = target - frame_pos;
+			uint32_t start;
+
+			if(n > budget)
+				n = budget;
+
+			PROFILE_BEGIN(PROFILE_APU);
+			start = time_us_32();
+			render(n);
+			busy_us += time_us_32() - start;
+			PROFILE_END(PROFILE_APU);
+			frame_pos += n;
+			budget -= n;
+
+			if(frame_pos < target)
+			{
+				more = true;
+				break;
+			}
+		}
+
+		if(reg == APU_QUEUE_END_FRAME)
+			frame_pos = 0;
+		else
+			minigb_apu_audio_write(&apu, APU_REG_BASE + reg, record & 0xFF);
+
+		/* Publish the channel state before the record is retired, so
+		 * that core0 never pairs a new tail with an old state. */
+		__atomic_store_n(&apu_status, minigb_apu_audio_read(&apu, 0xFF26) & 0x0F, __ATOMIC_RELAXED);
+		__atomic_store_n(&queue_tail, queue_tail + 1, __ATOMIC_RELEASE);
+	}
+
+	/* Length counters may have expired while rendering. */
+	__atomic_store_n(&apu_status, minigb_apu_audio_read(&apu, 0xFF26) & 0x0F, __ATOMIC_RELAXED);
+	return more;
+}
+
+uint32_t apu_core1_busy_us(void)
+{
+	return __atomic_load_n(&busy_us, __ATOMIC_RELAXED);
+}
@@ -1,4 +1,3 @@
-#include <string.h>
 #include <stdio.h>
 #include "pico/stdlib.h"
 #include "hardware/dma.h"
@@ -7,46 +6,61 @@
 #include "hardware/sync.h"
 #include "hardware/clocks.h"
 #include "audio.h"
+#include "audio_backend.h"
+#include "config.h"
 
 #define REPETITION_RATE 8
 
+#if AUDIO_CHANNELS == 1
+#define PWM_FORMAT AUDIO_FORMAT_PWM_MONO
+#elif AUDIO_CHANNELS == 2
+#define PWM_FORMAT AUDIO_FORMAT_PWM_STEREO
+#else
+#error "AUDIO_CHANNELS must be 1 or 2"
+#endif
+
+/*
+ * Route GPIO_AUDIO, and for stereo the other pin of its slice, to the PWM.
+ */
+static void pwm_audio_pins(void)
+{
+#if AUDIO_CHANNELS == 2
+  gpio_set_function(GPIO_AUDIO & ~1u, GPIO_FUNC_PWM);      // channel A, left
+  gpio_set_function(GPIO_AUDIO | 1u, GPIO_FUNC_PWM);       // channel B, right
+#else
+  gpio_set_function(GPIO_AUDIO, GPIO_FUNC_PWM);
+#endif
+}
+
+/*
+ * PWM backend. The PWM slice wraps REPETITION_RATE times per sample and
+ * each wrap triggers a copy of single_sample into the CC register, then a
+ * copy of the next sample from the ring into single_sample.
+ */
 static uint32_t single_sample = 0;
 static uint32_t *single_sample_ptr = &single_sample;
 static int pwm_dma_chan, trigger_dma_chan, sample_dma_chan;
-
-static uint8_t audio_buffers[2][AUDIO_BUFFER_SIZE];
-static volatile int cur_audio_buffer;
-static volatile int last_audio_buffer;
-
-
-struct MIXER_SOURCE {
-  const uint16_t *samples;
-  int len;
-  int loop_start;
-  int pos;
-  bool active;
-  bool loop;
-  uint16_t volume; // 8.8 fixed point
-};
-
-static struct MIXER_SOURCE mixer_sources[AUDIO_MAX_SOURCES];
-static int16_t mixer_buffer[AUDIO_BUFFER_SIZE];
+static volatile uint32_t pwm_irqs;
 
 static void __isr __time_critical_func(dma_handler)()
 {
-  cur_audio_buffer = 1 - cur_audio_buffer;
-  dma_hw->ch[sample_dma_chan].al1_read_addr       = (intptr_t) &audio_buffers[cur_audio_buffer][0];
-  dma_hw->ch[trigger_dma_chan].al3_read_addr_trig = (intptr_t) &single_sample_ptr;
-
+  if (!(dma_hw->ints1 & (1u << trigger_dma_chan))) return;
   dma_hw->ints1 = 1u << trigger_dma_chan;
+  pwm_irqs++;
+
+  audio_ring_retire();
+  dma_hw->ch[sample_dma_chan].al1_read_addr       = (intptr_t) audio_ring_next();
+  dma_hw->ch[trigger_dma_chan].al3_read_addr_trig = (intptr_t) &single_sample_ptr;
 }
 
-void audio_init2(int audio_pin, int sample_freq)
+static void pwm_init_backend(unsigned sample_freq)
 {
-  gpio_set_function(audio_pin, GPIO_FUNC_PWM);
+  pwm_audio_pins();
 
-  int audio_pin_slice = pwm_gpio_to_slice_num(audio_pin);
-  int audio_pin_chan = pwm_gpio_to_channel(audio_pin);
+  int audio_pin_slice = pwm_gpio_to_slice_num(GPIO_AUDIO);
+#if AUDIO_CHANNELS == 1
+  int audio_pin_chan = pwm_gpio_to_channel(GPIO_AUDIO);
+#endif
 
   uint f_clk_sys = frequency_count_khz(CLOCKS_FC0_SRC_VALUE_CLK_SYS);
   float clock_div = ((float)f_clk_sys * 1000.0f) / 254.0f / (float) sample_freq / (float) REPETITION_RATE;
@@ -56,6 +70,9 @@ void audio_init2(int audio_pin, int sample_freq)
   pwm_config_set_wrap(&config, 254);
   pwm_init(audio_pin_slice, &config, true);
 
+  audio_ring_init(PWM_FORMAT);
+  pwm_irqs = 0;
+
   pwm_dma_chan     = dma_claim_unused_channel(true);
   trigger_dma_chan = dma_claim_unused_channel(true);
   sample_dma_chan  = dma_claim_unused_channel(true);
@@ -89,160 +106,152 @@ void audio_init2(int audio_pin, int sample_freq)
                         false                                             // don't start yet
                         );
   dma_channel_set_irq1_enabled(trigger_dma_chan, true);    // fire interrupt when trigger DMA channel is done
-  irq_set_exclusive_handler(DMA_IRQ_1, dma_handler);
+  irq_add_shared_handler(DMA_IRQ_1, dma_handler, PICO_SHARED_IRQ_HANDLER_DEFAULT_ORDER_PRIORITY);
   irq_set_enabled(DMA_IRQ_1, true);
 
   // setup sample DMA channel
   dma_channel_config sample_dma_chan_config = dma_channel_get_default_config(sample_dma_chan);
-  channel_config_set_transfer_data_size(&sample_dma_chan_config, DMA_SIZE_8);  // transfer 8-bits at a time
+#if AUDIO_CHANNELS == 2
+  channel_config_set_transfer_data_size(&sample_dma_chan_config, DMA_SIZE_32); // transfer the left and right levels at once
+#else
+  channel_config_set_transfer_data_size(&sample_dma_chan_config, DMA_SIZE_16); // transfer one 16-bit level at a time
+#endif
   channel_config_set_read_increment(&sample_dma_chan_config, true);            // increment read address to go through audio buffer
   channel_config_set_write_increment(&sample_dma_chan_config, false);          // always write to the same address
   dma_channel_configure(sample_dma_chan,
                         &sample_dma_chan_config,
-                        (char*)&single_sample + 2*audio_pin_chan,  // write to single_sample
-                        audio_get_buffer(),//&audio_buffers[0][0],                      // read from audio buffer
-                        1,                                         // only do one transfer (once per PWM DMA completion due to chaining)
-                        false                                      // don't start yet
+#if AUDIO_CHANNELS == 2
+                        &single_sample,                              // write both halves of single_sample
+#else
+                        (uint16_t*)&single_sample + audio_pin_chan,  // write to this channel's half of single_sample
+#endif
+                        audio_ring_next(),                           // read from the first block
+                        1,                                           // only do one transfer (once per PWM DMA completion due to chaining)
+                        false                                        // don't start yet
                         );
 
-
-  // clear audio buffers
-  memset(audio_buffers[0], 128, AUDIO_BUFFER_SIZE);
-  memset(audio_buffers[1], 128, AUDIO_BUFFER_SIZE);
-
   // kick things off with the trigger DMA channel
   dma_channel_start(trigger_dma_chan);
 }
 
-uint8_t *audio_get_buffer(void)
+static void pwm_get_stats(struct audio_stats *stats)
 {
-  if (last_audio_buffer == cur_audio_buffer) {
-    return NULL;
-  }
-
-  uint8_t *buf = audio_buffers[last_audio_buffer];
-  last_audio_buffer = cur_audio_buffer;
-  return buf;
-}
-
-static int audio_claim_unused_source(void)
-{
-  for (int i = 0; i < AUDIO_MAX_SOURCES; i++) {
-    if (! mixer_sources[i].active) {
-      mixer_sources[i].active = true;
-      return i;
-    }
-  }
-  return -1;
+  audio_ring_get_stats(stats);
+  stats->irqs = pwm_irqs;
+  // 8 PWM and 8 trigger transfers (a read and a write each) plus the sample copy
+  stats->transfers_per_sample = REPETITION_RATE * 4 + 2;
 }
 
-int audio_play_once(const uint16_t *samples, int len)
-{
-  int source_id = audio_claim_unused_source();
-  if (source_id < 0) {
-    return -1;
-  }
-  struct MIXER_SOURCE *source = &mixer_sources[source_id];
-  source->samples = samples;
-  source->len = len;
-  source->pos = 0;
-  source->loop = false;
-  source->volume = 256;
-  return source_id;
-}
+const struct audio_backend audio_backend_pwm = {
+  .name = "pwm",
+  .format = PWM_FORMAT,
+  .init = pwm_init_backend,
+  .get_block = audio_ring_get_block,
+  .submit = audio_ring_submit,
+  .set_volume = audio_ring_set_volume,
+  .get_stats = pwm_get_stats,
+};
 
-int audio_play_loop(const uint16_t *samples, int len, int loop_start)
+/*
+ * Timer paced PWM backend. DMA timer ticks at the sample rate and each tick
+ * moves one 16-bit level from the ring straight into the PWM CC register, so
+ * a sample costs one SRAM read and one APB write. Two channels are chained
+ * ping-pong, each playing every other block. For mono the CC write is 16 bits
+ * wide because narrow APB writes are replicated across byte lanes; a halfword
+ * lands in both the A and B compare values. For stereo it is 32 bits, the
+ * left level in A and the right in B.
+ */
+static int timer_dma_chan[2];
+static volatile uint32_t timer_irqs;
+
+static void __isr __time_critical_func(timer_dma_handler)()
 {
-  int source_id = audio_play_once(samples, len);
-  if (source_id < 0) {
-    return -1;
+  for (int i = 0; i < 2; i++) {
+    uint32_t mask = 1u << timer_dma_chan[i];
+    if (!(dma_hw->ints1 & mask)) continue;
+    dma_hw->ints1 = mask;
+    timer_irqs++;
+
+    // The other channel is already playing. Re-arm this one without
+    // triggering it; it is started by the chain.
+    audio_ring_retire();
+    dma_hw->ch[timer_dma_chan[i]].read_addr = (intptr_t) audio_ring_next();
   }
-  struct MIXER_SOURCE *source = &mixer_sources[source_id];
-  source->loop = true;
-  source->loop_start = loop_start;
-  return source_id;
 }
 
-void audio_source_stop(int source_id)
+static void pwm_timer_init(unsigned sample_freq)
 {
-  mixer_sources[source_id].active = false;
-}
+  pwm_audio_pins();
 
-void audio_source_set_volume(int source_id, uint16_t volume)
-{
-  mixer_sources[source_id].volume = volume;
-}
-
-void audio_mixer_step(void)
-{
-  uint8_t *audio_buffer = audio_get_buffer();
-  if (! audio_buffer) return;
+  int audio_pin_slice = pwm_gpio_to_slice_num(GPIO_AUDIO);
 
-  // setup mixer buffer
-  memset(mixer_buffer, 0, sizeof(mixer_buffer));              // Clear the mixer buffer
-
-  // mix to 16-bit mixer buffer
-  for (int i = 0; i < AUDIO_MAX_SOURCES; i++) {
-    if (! mixer_sources[i].active) continue;                  // Skip sources that aren't active
-    struct MIXER_SOURCE *source = &mixer_sources[i];          // Get the source
+  pwm_config config = pwm_get_default_config();
+  pwm_config_set_wrap(&config, 254);
+  pwm_init(audio_pin_slice, &config, true);
 
-    // mix source
-    int mix_len = source->len - source->pos;                  // Length of the source remaining to mix
-    if (mix_len > AUDIO_BUFFER_SIZE) {                        // If the remaining length is greater than the buffer size
-      mix_len = AUDIO_BUFFER_SIZE;                            // ...Set the mix length to the buffer size
-    }
-    for (int i = 0; i < mix_len; i++) {                // For each sample element to process
-      uint16_t idx = (i + source->pos) << 1;                  // Index is doubled to skip every other element due to stereo interleaving
-      uint16_t lsample = source->samples[idx];                 // Get the left channel sample (first in the interleave)
-      uint16_t rsample = source->samples[idx + 1];             // Get the right channel sample (second in the interleave)
-      uint16_t lsample8 = lsample >> 8;                        // Convert the 16-bit sample to 8-bit
-      uint16_t rsample8 = rsample >> 8;                        // Convert the 16-bit sample to 8-bit
-      //uint8_t lsample8 = Convert16To8(lsample);
-      //uint8_t rsample8 = Convert16To8(rsample);
-      mixer_buffer[i] += (lsample8 * source->volume) >> 8;      // Add the left channel sample to the mixer buffer
-      mixer_buffer[i] += (rsample8 * source->volume) >> 8;
-    }
-    source->pos += mix_len;                                   // Advance the source position by the amount we read in
-
-    // handle source termination
-    if (source->pos == source->len) {                         // If we've reached the end of the audio source
-      if (source->loop) {                                     // ...and if loop is enabled
-        source->pos = source->loop_start;                     // ...then reset the position to the loop start
-      } else {                                                // Otherwise
-        source->active = false;                               // ...disable the source
-      }
+  // Find the DMA timer fraction X/Y closest to the sample rate
+  uint32_t f_clk_sys = clock_get_hz(clk_sys);
+  uint32_t best_x = 1, best_y = 0xffff, best_err = UINT32_MAX;
+  for (uint32_t x = 1; x <= 0xffff; x++) {
+    uint32_t y = (uint32_t)(((uint64_t)f_clk_sys * x + sample_freq / 2) / sample_freq);
+    if (y > 0xffff) break;
+    uint32_t rate = (uint32_t)((uint64_t)f_clk_sys * x / y);
+    uint32_t err = rate > sample_freq ? rate - sample_freq : sample_freq - rate;
+    if (err < best_err) {
+      best_x = x;
+      best_y = y;
+      best_err = err;
     }
   }
 
-  // convert 16-bit mixer buffer to 8-bit output buffer
-  for (int i = 0; i < AUDIO_BUFFER_SIZE; i++) {
-    int sample = mixer_buffer[i] + 128;
-    if (sample < 0) {
-     audio_buffer[i] = 0;
-    } else if (sample > 255) {
-     audio_buffer[i] = 255;
-    } else {
-     audio_buffer[i] = sample;
-    }
-    // int sample = mixer_buffer[i] + 0;
-    // if (sample < 0) {
-    //   audio_buffer[i] = 0;
-    // } else if (sample > 65535) {
-    //   audio_buffer[i] = 65535;
-    // } else {
-    //   audio_buffer[i] = sample;
-    // }
+  int timer = dma_claim_unused_timer(true);
+  dma_timer_set_fraction(timer, best_x, best_y);
+
+  audio_ring_init(PWM_FORMAT);
+  timer_irqs = 0;
+
+  timer_dma_chan[0] = dma_claim_unused_channel(true);
+  timer_dma_chan[1] = dma_claim_unused_channel(true);
+
+  for (int i = 0; i < 2; i++) {
+    dma_channel_config c = dma_channel_get_default_config(timer_dma_chan[i]);
+#if AUDIO_CHANNELS == 2
+    channel_config_set_transfer_data_size(&c, DMA_SIZE_32);          // left and right levels per transfer
+#else
+    channel_config_set_transfer_data_size(&c, DMA_SIZE_16);          // one PWM level per transfer
+#endif
+    channel_config_set_read_increment(&c, true);                     // walk through the block
+    channel_config_set_write_increment(&c, false);                   // always write to the CC register
+    channel_config_set_chain_to(&c, timer_dma_chan[1 - i]);          // play the other channel's block when done
+    channel_config_set_dreq(&c, dma_get_timer_dreq(timer));          // transfer on each timer tick
+    dma_channel_configure(timer_dma_chan[i],
+                          &c,
+                          &pwm_hw->slice[audio_pin_slice].cc,        // write to PWM slice CC register
+                          audio_ring_next(),                         // read from the next block
+                          AUDIO_BUFFER_SIZE,                         // one transfer per sample
+                          false                                      // don't start yet
+                          );
+    dma_channel_set_irq1_enabled(timer_dma_chan[i], true);
   }
+  irq_add_shared_handler(DMA_IRQ_1, timer_dma_handler, PICO_SHARED_IRQ_HANDLER_DEFAULT_ORDER_PRIORITY);
+  irq_set_enabled(DMA_IRQ_1, true);
+
+  dma_channel_start(timer_dma_chan[0]);
 }
 
-uint8_t Convert16To8(uint16_t sample) {
-  // int sample8 = sample + 128;
-  // if (sample8 < 0) {
-  //   return 0;
-  // } else if (sample8 > 255) {
-  //   return 255;
-  // } else {
-  //   return (uint8_t)sample8;
-  // }
-  return (uint8_t)(sample >> 8);
+static void pwm_timer_get_stats(struct audio_stats *stats)
+{
+  audio_ring_get_stats(stats);
+  stats->irqs = timer_irqs;
+  stats->transfers_per_sample = 2;
 }
+
+const struct audio_backend audio_backend_pwm_timer = {
+  .name = "pwm_timer",
+  .format = PWM_FORMAT,
+  .init = pwm_timer_init,
+  .get_block = audio_ring_get_block,
+  .submit = audio_ring_submit,
+  .set_volume = audio_ring_set_volume,
+  .get_stats = pwm_timer_get_stats,
+};
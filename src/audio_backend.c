@@ -0,0 +1,151 @@
+/**
+ * Ring buffer shared by the audio output backends.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#include <pico/stdlib.h>
+
+#include "audio.h"
+#include "audio_backend.h"
+#include "sram.h"
+
+/* Every format fits in 32 bits per sample. */
+static uint32_t ring[AUDIO_RING_BLOCKS][AUDIO_BUFFER_SIZE] BANK_DATA(3, "audio_ring");
+/* Streamed by DMA whenever the ring runs dry. Filled in by audio_ring_init(),
+ * as BANK_DATA is not cleared at boot. */
+static uint32_t silence[AUDIO_BUFFER_SIZE] BANK_DATA(2, "audio_silence");
+static enum audio_format ring_format;
+static uint16_t ring_volume = 256;
+
+static uint32_t ring_head;					// Blocks submitted, written by the producer only
+static uint32_t ring_armed;					// Blocks handed to DMA, written by the IRQ only
+static uint32_t ring_done;					// Blocks finished, written by the IRQ only
+
+/* Blocks handed out by audio_ring_next() that have not finished yet, oldest
+ * in bit 0. A set bit is a ring block, a clear bit is silence. */
+static uint32_t inflight;
+static uint_fast8_t inflight_count;
+
+static uint32_t underruns;
+
+void audio_ring_init(enum audio_format format)
+{
+	const uint32_t fill = (format == AUDIO_FORMAT_S16_STEREO) ? 0 : 0x00800080;
+
+	for(uint_fast16_t i = 0; i < AUDIO_BUFFER_SIZE; i++)
+		silence[i] = fill;
+
+	ring_format = format;
+	ring_head = 0;
+	ring_armed = 0;
+	ring_done = 0;
+	inflight = 0;
+	inflight_count = 0;
+	underruns = 0;
+}
+
+void *audio_ring_get_block(void)
+{
+	const uint32_t done = __atomic_load_n(&ring_done, __ATOMIC_ACQUIRE);
+
+	if(ring_head - done >= AUDIO_RING_BLOCKS)
+		return NULL;
+
+	return ring[ring_head & (AUDIO_RING_BLOCKS - 1)];
+}
+
+/**
+ * Scale a block by the output volume. Only done when the volume is not unity.
+ */
+static void apply_volume(void *block, uint16_t volume)
+{
+	if(ring_format != AUDIO_FORMAT_S16_STEREO)
+	{
+		const uint_fast16_t n = (ring_format == AUDIO_FORMAT_PWM_STEREO) ?
+			AUDIO_BUFFER_SIZE * 2 : AUDIO_BUFFER_SIZE;
+		uint16_t *s = block;
+
+		for(uint_fast16_t i = 0; i < n; i++)
+		{
+			int32_t level = 128 + ((((int32_t)s[i] - 128) * volume) >> 8);
+
+			if(level < 0)
+				level = 0;
+			else if(level > 255)
+				level = 255;
+
+			s[i] = level;
+		}
+	}
+	else
+	{
+		int16_t *s = block;
+
+		for(uint_fast16_t i = 0; i < AUDIO_BUFFER_SIZE * 2; i++)
+		{
+			int32_t sample = ((int32_t)s[i] * volume) >> 8;
+
+			if(sample < INT16_MIN)
+				sample = INT16_MIN;
+			else if(sample > INT16_MAX)
+				sample = INT16_MAX;
+
+			s[i] = sample;
+		}
+	}
+}
+
+void audio_ring_submit(void)
+{
+	const uint16_t volume = ring_volume;
+
+	if(volume != 256)
+		apply_volume(ring[ring_head & (AUDIO_RING_BLOCKS - 1)], volume);
+
+	__atomic_store_n(&ring_head, ring_head + 1, __ATOMIC_RELEASE);
+}
+
+void audio_ring_set_volume(uint16_t volume)
+{
+	ring_volume = volume;
+}
+
+const void *__time_critical_func(audio_ring_next)(void)
+{
+	const uint32_t head = __atomic_load_n(&ring_head, __ATOMIC_ACQUIRE);
+
+	if(ring_armed == head)
+	{
+		/* Nothing queued. Only count it once audio has started. */
+		if(head != 0)
+			underruns++;
+
+		inflight_count++;
+		return silence;
+	}
+
+	inflight |= 1u << inflight_count++;
+	return ring[ring_armed++ & (AUDIO_RING_BLOCKS - 1)];
+}
+
+void __time_critical_func(audio_ring_retire)(void)
+{
+	if(inflight_count == 0)
+		return;
+
+	if(inflight & 1)
+		__atomic_store_n(&ring_done, ring_done + 1, __ATOMIC_RELEASE);
+
+	inflight >>= 1;
+	inflight_count--;
+}
+
+void audio_ring_get_stats(struct audio_stats *stats)
+{
+	stats->blocks = __atomic_load_n(&ring_done, __ATOMIC_RELAXED);
+	stats->underruns = underruns;
+	stats->queued = __atomic_load_n(&ring_head, __ATOMIC_RELAXED) - stats->blocks;
+}
@@ -0,0 +1,88 @@
+#include <string.h>
+#include <stdio.h>
+#include "pico/stdlib.h"
+#include "hardware/dma.h"
+#include "hardware/irq.h"
+#include "hardware/pio.h"
+#include "i2s.h"
+#include "audio.h"
+#include "audio_backend.h"
+#include "config.h"
+
+/*
+ * I2S backend. The PIO program in ext/i2s shifts out one 32-bit word of left
+ * and right samples per frame, and two chained DMA channels feed its TX FIFO
+ * from the ring, each playing every other block.
+ */
+static i2s_config_t i2s_config;
+static int i2s_dma_chan[2];
+static volatile uint32_t i2s_irqs;
+
+static void __isr __time_critical_func(i2s_dma_handler)()
+{
+  for (int i = 0; i < 2; i++) {
+    uint32_t mask = 1u << i2s_dma_chan[i];
+    if (!(dma_hw->ints1 & mask)) continue;
+    dma_hw->ints1 = mask;
+    i2s_irqs++;
+
+    // The other channel is already playing. Re-arm this one without
+    // triggering it; it is started by the chain.
+    audio_ring_retire();
+    dma_hw->ch[i2s_dma_chan[i]].read_addr = (intptr_t) audio_ring_next();
+  }
+}
+
+static void i2s_backend_init(unsigned sample_freq)
+{
+  i2s_config = i2s_get_default_config();
+  i2s_config.sample_freq = sample_freq;
+  i2s_config.data_pin = GPIO_I2S_DATA;
+  i2s_config.clock_pin_base = GPIO_I2S_CLOCK_BASE;
+  i2s_pio_init(&i2s_config);
+
+  audio_ring_init(AUDIO_FORMAT_S16_STEREO);
+  i2s_irqs = 0;
+
+  i2s_dma_chan[0] = dma_claim_unused_channel(true);
+  i2s_dma_chan[1] = dma_claim_unused_channel(true);
+
+  for (int i = 0; i < 2; i++) {
+    dma_channel_config c = dma_channel_get_default_config(i2s_dma_chan[i]);
+    channel_config_set_transfer_data_size(&c, DMA_SIZE_32);          // one stereo frame per transfer
+    channel_config_set_read_increment(&c, true);                     // walk through the block
+    channel_config_set_write_increment(&c, false);                   // always write to the TX FIFO
+    channel_config_set_chain_to(&c, i2s_dma_chan[1 - i]);            // play the other channel's block when done
+    channel_config_set_dreq(&c, pio_get_dreq(i2s_config.pio, i2s_config.sm, true));
+    dma_channel_configure(i2s_dma_chan[i],
+                          &c,
+                          &i2s_config.pio->txf[i2s_config.sm],       // write to the state machine's TX FIFO
+                          audio_ring_next(),                         // read from the next block
+                          AUDIO_BUFFER_SIZE,                         // one transfer per sample
+                          false                                      // don't start yet
+                          );
+    dma_channel_set_irq1_enabled(i2s_dma_chan[i], true);
+  }
+  irq_add_shared_handler(DMA_IRQ_1, i2s_dma_handler, PICO_SHARED_IRQ_HANDLER_DEFAULT_ORDER_PRIORITY);
+  irq_set_enabled(DMA_IRQ_1, true);
+
+  dma_channel_start(i2s_dma_chan[0]);
+  pio_sm_set_enabled(i2s_config.pio, i2s_config.sm, true);
+}
+
+static void i2s_get_stats(struct audio_stats *stats)
+{
+  audio_ring_get_stats(stats);
+  stats->irqs = i2s_irqs;
+  stats->transfers_per_sample = 2;
+}
+
+const struct audio_backend audio_backend_i2s = {
+  .name = "i2s",
+  .format = AUDIO_FORMAT_S16_STEREO,
+  .init = i2s_backend_init,
+  .get_block = audio_ring_get_block,
+  .submit = audio_ring_submit,
+  .set_volume = audio_ring_set_volume,
+  .get_stats = i2s_get_stats,
+};
@@ -0,0 +1,150 @@
+/**
+ * Cooperative job scheduler for core1.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <pico/stdlib.h>
+#include <hardware/sync.h>
+
+#include "core1_sched.h"
+
+/* Each slot carries a sequence number saying who may use it next: "pos" when
+ * it is free for the producer that claimed position "pos", "pos + 1" once
+ * that producer has filled it. Producers claim positions under a spin lock,
+ * as the M0+ has no compare and swap, but fill them outside it, so the lock
+ * is held for a few instructions. The consumer, core1, takes no lock. */
+struct job_slot {
+	uint32_t seq;
+	core1_job_fn fn;
+	uint32_t a;
+	uint32_t b;
+};
+
+struct job_queue {
+	struct job_slot slot[CORE1_SCHED_QUEUE_SIZE];
+	uint32_t head;						// Next position to claim, under the lock
+	uint32_t tail;						// Next position to run, core1 only
+	bool (*poll)(void);
+};
+
+static struct job_queue queues[CORE1_PRIO_COUNT];
+static struct core1_sched_stats stats;
+static spin_lock_t *lock;
+
+void core1_sched_init(void)
+{
+	if(lock == NULL)
+		lock = spin_lock_instance(spin_lock_claim_unused(true));
+
+	for(uint_fast8_t p = 0; p < CORE1_PRIO_COUNT; p++)
+	{
+		struct job_queue *q = &queues[p];
+
+		for(uint_fast8_t i = 0; i < CORE1_SCHED_QUEUE_SIZE; i++)
+			q->slot[i].seq = i;
+
+		q->head = 0;
+		q->tail = 0;
+		q->poll = NULL;
+	}
+
+	memset(&stats, 0, sizeof(stats));
+}
+
+void core1_sched_set_poll(enum core1_prio prio, bool (*poll)(void))
+{
+	queues[prio].poll = poll;
+}
+
+bool core1_sched_post(enum core1_prio prio, core1_job_fn fn, uint32_t a, uint32_t b)
+{
+	struct job_queue *q = &queues[prio];
+	struct job_slot *s;
+	uint32_t save, pos, queued;
+
+	save = spin_lock_blocking(lock);
+	pos = q->head;
+	s = &q->slot[pos & (CORE1_SCHED_QUEUE_SIZE - 1)];
+
+	/* The slot is still waiting to be run from the previous lap. */
+	if(__atomic_load_n(&s->seq, __ATOMIC_ACQUIRE) != pos)
+	{
+		stats.full[prio]++;
+		spin_unlock(lock, save);
+		return false;
+	}
+
+	q->head = pos + 1;
+	queued = pos + 1 - __atomic_load_n(&q->tail, __ATOMIC_RELAXED);
+	if(queued > stats.high_water[prio])
+		stats.high_water[prio] = queued;
+	spin_unlock(lock, save);
+
+	s->fn = fn;
+	s->a = a;
+	s->b = b;
+	__atomic_store_n(&s->seq, pos + 1, __ATOMIC_RELEASE);
+	__sev();						// Wake core1 if it is waiting
+	return true;
+}
+
+/**
+ * Run the oldest job of "q", if it has been filled. Returns false if there
+ * was none.
+ */
+static bool run_one(struct job_queue *q, uint_fast8_t prio)
+{
+	const uint32_t pos = q->tail;
+	struct job_slot *s = &q->slot[pos & (CORE1_SCHED_QUEUE_SIZE - 1)];
+	core1_job_fn fn;
+	uint32_t a, b;
+
+	if(__atomic_load_n(&s->seq, __ATOMIC_ACQUIRE) != pos + 1)
+		return false;
+
+	fn = s->fn;
+	a = s->a;
+	b = s->b;
+
+	/* Hand the slot back before running, so that the job can post to its
+	 * own queue. */
+	__atomic_store_n(&q->tail, pos + 1, __ATOMIC_RELAXED);
+	__atomic_store_n(&s->seq, pos + CORE1_SCHED_QUEUE_SIZE, __ATOMIC_RELEASE);
+
+	fn(a, b);
+	stats.run[prio]++;
+	return true;
+}
+
+void core1_sched_run(void)
+{
+	for(;;)
+	{
+		uint_fast8_t p;
+
+		/* Start again from the top after each piece of work. */
+		for(p = 0; p < CORE1_PRIO_COUNT; p++)
+		{
+			struct job_queue *q = &queues[p];
+
+			if(run_one(q, p))
+				break;
+			if(q->poll != NULL && q->poll())
+				break;
+		}
+
+		/* Nothing to do: sleep until a producer signals an event. One
+		 * signalled since the queues were looked at ends the wait at
+		 * once, so a job posted meanwhile is not missed. */
+		if(p == CORE1_PRIO_COUNT)
+			__wfe();
+	}
+}
+
+void core1_sched_get_stats(struct core1_sched_stats *s)
+{
+	memcpy(s, &stats, sizeof(*s));
+}
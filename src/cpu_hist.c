@@ -0,0 +1,157 @@
+/**
+ * Execution histograms of the emulated CPU, printed as CSV.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "cpu_hist.h"
+
+#if CPU_HISTOGRAMS
+
+#if PICO_ON_DEVICE
+# include <pico/stdlib.h>
+# include "telemetry.h"
+#endif
+
+/* Lines printed per core1 job. */
+#define DUMP_LINES	16
+/* Entries of all the tables below. */
+#define ENTRIES		(4 * 256 + CPU_HIST_BANKS)
+
+static const struct {
+	const char *name;
+	size_t offset;
+	uint32_t count;
+} tables[] = {
+	{ "op",   offsetof(struct cpu_hist, opcodes),       256 },
+	{ "cb",   offsetof(struct cpu_hist, cb_opcodes),    256 },
+	{ "rd",   offsetof(struct cpu_hist, reads),         256 },
+	{ "wr",   offsetof(struct cpu_hist, writes),        256 },
+	{ "bank", offsetof(struct cpu_hist, bank_switches), CPU_HIST_BANKS },
+};
+
+static struct cpu_hist hist[2];
+struct cpu_hist *cpu_hist_live = &hist[0];
+uint_fast16_t cpu_hist_bank_last;
+#if PICO_ON_DEVICE
+static struct cpu_hist *dumped;					// Being printed by core1
+#endif
+
+void cpu_hist_reset(void)
+{
+	memset(hist, 0, sizeof(hist));
+	cpu_hist_live = &hist[0];
+	cpu_hist_bank_last = 1;					// As selected by gb_reset()
+}
+
+static void print_head(FILE *f, const struct cpu_hist *h)
+{
+	fprintf(f, "# cpu histogram: %lu frames, %lu ROM bank writes\n",
+		(unsigned long)h->frames, (unsigned long)h->bank_writes);
+	fputs("kind,index,count\n", f);
+}
+
+/**
+ * Print up to "lines" of the non-zero counts of "h", from entry "pos" of
+ * the tables taken end to end. Returns the entry to carry on from, which is
+ * past the last table once all have been printed.
+ */
+static uint32_t print_counts(FILE *f, const struct cpu_hist *h, uint32_t pos,
+		uint32_t lines)
+{
+	uint32_t base = 0;
+
+	for(size_t t = 0; t < sizeof(tables) / sizeof(tables[0]); t++)
+	{
+		const uint32_t *counts =
+			(const uint32_t *)((const uint8_t *)h + tables[t].offset);
+
+		for(; pos < base + tables[t].count; pos++)
+		{
+			const uint32_t i = pos - base;
+
+			if(counts[i] == 0)
+				continue;
+
+			if(lines-- == 0)
+				return pos;
+
+			fprintf(f, "%s,%03lx,%lu\n", tables[t].name,
+				(unsigned long)i, (unsigned long)counts[i]);
+		}
+
+		base += tables[t].count;
+	}
+
+	return pos;
+}
+
+#if PICO_ON_DEVICE
+
+/**
+ * Core1: print the next lines of the dumped histograms from entry "pos".
+ */
+static uint32_t print_dumped(uint32_t pos)
+{
+	return print_counts(stdout, dumped, pos, DUMP_LINES);
+}
+
+/**
+ * Core1: core0 counts into the dumped buffer again after the next dump.
+ */
+static void clear_dumped(bool complete)
+{
+	(void)complete;
+	memset(dumped, 0, sizeof(*dumped));
+}
+
+bool cpu_hist_dump(void)
+{
+	struct cpu_hist *h = cpu_hist_live;
+
+	if(telemetry_printing())
+		return false;
+
+	/* The other buffer was cleared by the last dump. */
+	cpu_hist_live = (h == &hist[0]) ? &hist[1] : &hist[0];
+	print_head(stdout, h);
+
+	dumped = h;
+	if(!telemetry_print(print_dumped, 0, ENTRIES, clear_dumped))
+	{
+		/* Carry on counting into the same buffer. */
+		cpu_hist_live = h;
+		return false;
+	}
+
+	return true;
+}
+
+#else
+
+bool cpu_hist_save(const char *path, const char *title)
+{
+	FILE *f = fopen(path, "a");
+	bool ok;
+
+	if(f == NULL)
+		return false;
+
+	fprintf(f, "# rom: %s\n", title);
+	print_head(f, cpu_hist_live);
+	print_counts(f, cpu_hist_live, 0, UINT32_MAX);
+	fputs("# end\n", f);
+	ok = !ferror(f);
+	ok = (fclose(f) == 0) && ok;
+
+	memset(cpu_hist_live, 0, sizeof(*cpu_hist_live));
+	return ok;
+}
+
+#endif
+
+#endif
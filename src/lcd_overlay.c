@@ -0,0 +1,118 @@
+/**
+ * Text overlay in the LCD border, drawn by core1.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <pico/stdlib.h>
+
+#include "config.h"
+#include "core1_sched.h"
+#include "pico_ST7789.h"
+#include "lcd_overlay.h"
+#include "sram.h"
+
+#define OVERLAY_X		8
+#define OVERLAY_Y		4
+#define OVERLAY_PITCH		14			// Rows apart, 8 lines of glyph and 6 of gap
+#define OVERLAY_W		(LCD_OVERLAY_COLS * 8)
+#define OVERLAY_FG		0xFFFF
+#define OVERLAY_BG		0x0000
+
+/* Glyphs kept rendered, enough for the letters, digits and punctuation
+ * the overlay shows. Characters past them are drawn blank. */
+#define GLYPH_CACHE		32
+
+static char text[LCD_OVERLAY_ROWS][LCD_OVERLAY_COLS + 1];
+static uint32_t busy;						// Set by core0, cleared by core1 when drawn
+
+static char glyph_char[GLYPH_CACHE];
+static uint16_t glyph_pixels[GLYPH_CACHE][8 * 8] BANK_DATA(0, "overlay_glyphs");
+static uint_fast8_t glyphs;
+static const uint16_t glyph_blank[8 * 8];		// All OVERLAY_BG
+
+/**
+ * Returns the 8x8 pixels of character "c".
+ */
+static const uint16_t *glyph(char c)
+{
+	uint_fast8_t i;
+
+	if(c >= 'a' && c <= 'z')
+		c -= 'a' - 'A';						// The font has capitals only
+
+	for(i = 0; i < glyphs; i++)
+	{
+		if(glyph_char[i] == c)
+			return glyph_pixels[i];
+	}
+
+	if(glyphs == GLYPH_CACHE)
+		return glyph_blank;
+
+	glyph_char[glyphs] = c;
+	st7789_get_letter(glyph_pixels[glyphs], c, OVERLAY_FG, OVERLAY_BG);
+	return glyph_pixels[glyphs++];
+}
+
+/**
+ * Core1 job: draw the posted text.
+ */
+static void overlay_job(uint32_t unused_a, uint32_t unused_b)
+{
+	static uint16_t line[OVERLAY_W];
+
+	for(uint_fast8_t r = 0; r < LCD_OVERLAY_ROWS; r++)
+	{
+		const uint_fast16_t y = OVERLAY_Y + r * OVERLAY_PITCH;
+		const uint16_t *row[LCD_OVERLAY_COLS];
+		size_t len = strlen(text[r]);
+
+		for(uint_fast8_t c = 0; c < LCD_OVERLAY_COLS; c++)
+			row[c] = glyph(c < len ? text[r][c] : ' ');
+
+		st7789_caset(OVERLAY_X, OVERLAY_X + OVERLAY_W - 1);
+		st7789_raset(y, y + 7);
+		st7789_ramwr();
+		for(uint_fast8_t gy = 0; gy < 8; gy++)
+		{
+			for(uint_fast8_t c = 0; c < LCD_OVERLAY_COLS; c++)
+				memcpy(&line[c * 8], &row[c][gy * 8], 8 * sizeof(*line));
+
+			st7789_write_pixels(line, OVERLAY_W);
+		}
+	}
+
+	/* Lines are sent without setting the columns. */
+	st7789_caset(0, SCREEN_WIDTH - 1);
+	__atomic_store_n(&busy, 0, __ATOMIC_RELEASE);
+}
+
+bool lcd_overlay_post(const char t[LCD_OVERLAY_ROWS][LCD_OVERLAY_COLS + 1])
+{
+	if(__atomic_load_n(&busy, __ATOMIC_ACQUIRE))
+		return false;
+
+	memcpy(text, t, sizeof(text));
+	busy = 1;
+	if(!core1_sched_post(CORE1_PRIO_DISPLAY, overlay_job, 0, 0))
+	{
+		busy = 0;
+		return false;
+	}
+
+	return true;
+}
+
+void lcd_overlay_drain(void)
+{
+	while(__atomic_load_n(&busy, __ATOMIC_ACQUIRE))
+		tight_loop_contents();
+}
+
+void lcd_overlay_reset(void)
+{
+	busy = 0;
+}
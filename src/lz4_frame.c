@@ -0,0 +1,160 @@
+/**
+ * LZ4 frame and block decoding.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <strings.h>
+
+#include "lz4_frame.h"
+
+/* Frame descriptor flags. */
+#define FLG_VERSION_MASK	0xC0
+#define FLG_VERSION		0x40
+#define FLG_BLOCK_INDEP		0x20
+#define FLG_BLOCK_CHECKSUM	0x10
+#define FLG_CONTENT_SIZE	0x08
+#define FLG_DICT_ID		0x01
+
+static uint32_t read_le32(const uint8_t *p)
+{
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static bool has_suffix(const char *name, const char *suffix)
+{
+	const size_t n = strlen(name);
+	const size_t s = strlen(suffix);
+
+	return n > s && strcasecmp(name + n - s, suffix) == 0;
+}
+
+bool lz4_is_rom_name(const char *name)
+{
+	return has_suffix(name, ".gbz") || has_suffix(name, ".gb.lz4");
+}
+
+bool lz4_frame_parse(const uint8_t *p, size_t len, struct lz4_frame *frame)
+{
+	uint8_t flg, bd;
+	uint32_t size = 7;
+
+	if(len < 7 || read_le32(p) != LZ4_FRAME_MAGIC)
+		return false;
+
+	flg = p[4];
+	bd = p[5];
+
+	/* Linked blocks need the previous block to decode the next. */
+	if((flg & FLG_VERSION_MASK) != FLG_VERSION || !(flg & FLG_BLOCK_INDEP))
+		return false;
+
+	if(((bd >> 4) & 7) < 4)
+		return false;
+
+	if(flg & FLG_CONTENT_SIZE)
+		size += 8;
+	if(flg & FLG_DICT_ID)
+		size += 4;
+	if(len < size)
+		return false;
+
+	frame->header_size = size;
+	frame->block_max = 1u << (2 * ((bd >> 4) & 7) + 8);
+	frame->block_checksum = (flg & FLG_BLOCK_CHECKSUM) != 0;
+	frame->content_size = 0;
+
+	if(flg & FLG_CONTENT_SIZE)
+	{
+		/* Game Boy ROMs are far below 4 GiB. */
+		if(read_le32(p + 10) != 0)
+			return false;
+		frame->content_size = read_le32(p + 6);
+	}
+
+	return true;
+}
+
+/**
+ * Read the extra length bytes that follow a length of 15 in a token.
+ * Returns false if the input runs out first.
+ */
+static bool read_length(const uint8_t **ip, const uint8_t *iend, size_t *len)
+{
+	uint8_t b;
+
+	do
+	{
+		if(*ip >= iend)
+			return false;
+		b = *(*ip)++;
+		*len += b;
+	} while(b == 255);
+
+	return true;
+}
+
+int32_t lz4_block_decompress(const uint8_t *src, size_t src_len, uint8_t *dst, size_t dst_cap,
+	bool partial)
+{
+	const uint8_t *ip = src;
+	const uint8_t *const iend = src + src_len;
+	uint8_t *op = dst;
+	uint8_t *const oend = dst + dst_cap;
+
+	while(ip < iend)
+	{
+		const uint8_t token = *ip++;
+		size_t len = token >> 4;
+		size_t n;
+		uint16_t offset;
+		const uint8_t *match;
+
+		/* Literals */
+		if(len == 15 && !read_length(&ip, iend, &len))
+			goto truncated;
+
+		n = len;
+		if(n > (size_t)(iend - ip))
+			n = iend - ip;
+		if(n > (size_t)(oend - op))
+			n = oend - op;
+		memcpy(op, ip, n);
+		ip += n;
+		op += n;
+		if(n < len)
+			goto truncated;
+		if(ip == iend)
+			break;
+
+		/* Match, which may overlap the bytes it produces. */
+		if(iend - ip < 2)
+			goto truncated;
+		offset = ip[0] | (ip[1] << 8);
+		ip += 2;
+		if(offset == 0 || offset > op - dst)
+			return -1;
+
+		len = token & 15;
+		if(len == 15 && !read_length(&ip, iend, &len))
+			goto truncated;
+		len += 4;
+
+		n = len;
+		if(n > (size_t)(oend - op))
+			n = oend - op;
+		match = op - offset;
+		for(size_t i = 0; i < n; i++)
+			op[i] = match[i];
+		op += n;
+		if(n < len)
+			goto truncated;
+	}
+
+	return op - dst;
+
+truncated:
+	return partial ? op - dst : -1;
+}
@@ -16,10 +16,14 @@
 // Peanut-GB emulator settings
 #define ENABLE_SOUND	1
 #define ENABLE_SDCARD	1
+#define ENABLE_ROM_PAGING	1	// Read ROM banks from the SD card on demand instead of copying the ROM to flash
+#define ENABLE_FLASH_SAVES	0	// Keep cart RAM in a journal in on-board flash instead of in a file on the SD card
+#define ENABLE_FRAME_PIPELINE	0	// Render whole frames and scan them out from core1 instead of sending each line as it is drawn
 #define PEANUT_GB_HIGH_LCD_ACCURACY 1
 #define PEANUT_GB_USE_BIOS 0
-#define USE_GB3_AUDIO_LIB 0
-#define AUDIO_PWM 0
+#define AUDIO_OUTPUT	audio_backend_pwm_timer	// audio_backend_pwm, audio_backend_pwm_timer or audio_backend_i2s
+#define SAVE_FLUSH_QUIET_MS	500	// Write changed cart RAM to the SD card once it has not been written for this long
+#define SAVE_FLUSH_MAX_SECTORS	8	// Most cart RAM sectors written to the SD card per frame
 
 /* C Headers */
 #include <stdio.h>
@@ -44,20 +48,70 @@
 #include <hardware/pwm.h>
 #include <hardware/gpio.h>
 #include <hardware/flash.h>
+#include <hardware/structs/bus_ctrl.h>
 #include <pico/time.h>
 
 /* Project headers */
 #include "hedley.h"
 #include "minigb_apu.h"
+#include "apu_core1.h"
+#include "rom_cache.h"
+#include "rom_catalog.h"
+#include "storage.h"
+#include "save_journal.h"
+#include "lz4_frame.h"
+#include "core1_sched.h"
+#include "telemetry.h"
+#include "profile.h"
+#include "cpu_hist.h"
+#include "pc_sample.h"
+#include "lcd_overlay.h"
+#include "sram.h"
+
+#if ENABLE_SOUND
+/* APU register accesses are handed to core1, timestamped with the cycle they
+ * occurred on within the current frame. */
+struct gb_s;
+static uint32_t gb_frame_cycle(const struct gb_s *gb);
+#define PEANUT_GB_AUDIO_READ(gb, addr)		apu_core1_read(addr)
+#define PEANUT_GB_AUDIO_WRITE(gb, addr, val)	apu_core1_write(gb_frame_cycle(gb), addr, val)
+#endif
+
+#if ENABLE_ROM_PAGING
+/* Start reading a bank as soon as the MBC selects it. */
+#define PEANUT_GB_ROM_BANK_SELECT(gb)	do {						\
+		cpu_hist_bank((gb)->selected_rom_bank);				\
+		rom_cache_select((gb)->selected_rom_bank);			\
+	} while(0)
+#elif CPU_HISTOGRAMS
+#define PEANUT_GB_ROM_BANK_SELECT(gb)	cpu_hist_bank((gb)->selected_rom_bank)
+#endif
+
+#if CPU_HISTOGRAMS
+/* Count what the game executes and touches, for the 'h' command. */
+#define PEANUT_GB_COUNT_OPCODE(gb, op)		cpu_hist_opcode(op)
+#define PEANUT_GB_COUNT_CB_OPCODE(gb, op)	cpu_hist_cb_opcode(op)
+#define PEANUT_GB_COUNT_READ(gb, addr)		cpu_hist_read(addr)
+#define PEANUT_GB_COUNT_WRITE(gb, addr)		cpu_hist_write(addr)
+#endif
+
+/* Keep the tables read on every instruction next to the core0 stack. */
+#define PEANUT_GB_HOT_TABLE	CORE0_DATA("peanut_tables")
+
 #include "peanut_gb.h"
 #include "pico_ST7789.h"
 #include "gbcolors.h"
 #include "audio.h"
-#include "gb3_audio_dma.h"
+#include "audio_backend.h"
 #include "config.h"
 #include "sdcard.h"
 #include "lcd_dma.h"
 
+#if ENABLE_ROM_PAGING && !ENABLE_SDCARD
+# error "ENABLE_ROM_PAGING reads the ROM from the SD card"
+#endif
+#define ENABLE_SAVES	(ENABLE_SDCARD || ENABLE_FLASH_SAVES)
+
 // ST7789 Configuration
 const struct st7789_config lcd_config = {
     .spi      = PICO_DEFAULT_SPI_INSTANCE,
@@ -71,34 +125,10 @@ const struct st7789_config lcd_config = {
 
 #if ENABLE_SOUND
 /**
- * Global variables for audio task
- * stream contains N=AUDIO_SAMPLES samples
- * each sample is 32 bits
- * 16 bits for the left channel + 16 bits for the right channel in stereo interleaved format)
- * This is intended to be played at AUDIO_SAMPLE_RATE Hz
+ * Output volume in 8.8 fixed point (256 = 1.0), applied by the audio
+ * backend.
  */
-uint16_t *stream;
-//static uint16_t stream[1098];
 int volume = 256;
-// struct repeating_timer timerWFGenerator;    // Timer for the waveform generator - 125KHz
-int audiopos =0;
-// bool wavegen_callback(struct repeating_timer *t) {
-// 	//audio_mixer_step();
-//     return true;
-// }
-
-#if AUDIO_PWM
-void pwm_interrupt_handler() {
-    pwm_clear_irq(pwm_gpio_to_slice_num(GPIO_AUDIO));    
-	if (audiopos < (AUDIO_SAMPLES<<3) - 1) {
-
-		pwm_set_gpio_level(GPIO_AUDIO, stream[(audiopos+1)>>3]>>8);
-		audiopos+=2;
-	} else {
-		audiopos = 0;
-	}
-}
-#endif
 #endif
 
 /** Definition of ROM data
@@ -107,24 +137,145 @@ void pwm_interrupt_handler() {
  * Game Boy DMG ROM size ranges from 32768 bytes (e.g. Tetris) to 1,048,576 bytes (e.g. Pokemod Red)
  */
 #define FLASH_TARGET_OFFSET (1024 * 1024)
+
+/** Header describing the ROM held in flash, stored in the sector before
+ * FLASH_TARGET_OFFSET. Used to skip flashing when the same ROM is loaded
+ * again.
+ */
+#define FLASH_HEADER_OFFSET (FLASH_TARGET_OFFSET - FLASH_SECTOR_SIZE)
+#define FLASH_HEADER_MAGIC 0x42474F52	/* "ROGB" */
+struct flash_rom_header {
+	uint32_t magic;
+	uint32_t size;						// Size of the ROM file
+	uint32_t date_time;					// FatFs modification date << 16 | time
+	uint32_t flashed;					// Bytes of flash written, once decompressed
+	uint32_t crc;						// CRC-32 of the flashed sectors
+	char name[FLASH_PAGE_SIZE - 20];	// Path of the ROM file
+};
 static uint8_t ram[32768];
+#if ENABLE_SAVES
+/* Cart RAM sectors changed since they were last written to the save file,
+ * one bit per STORAGE_SECTOR_SIZE bytes, and when RAM was last written. */
+static uint32_t save_dirty[sizeof(ram) / STORAGE_SECTOR_SIZE / 32];
+static uint32_t save_write_time;
+static uint_fast8_t save_sectors;
+struct save_flush_stats {
+	uint32_t flushes;					// Runs of sectors written
+	uint32_t bytes;						// Bytes written
+	uint32_t last_us;					// Time core0 spent on the last flush
+	uint32_t max_us;					// Longest flush
+};
+static struct save_flush_stats save_stats;
+/* Sectors being written in the background, marked changed again if the
+ * write fails. */
+static uint_fast8_t save_flight_first, save_flight_count;
+
+static inline bool save_is_dirty(void) {
+	for(uint_fast8_t i=0;i<count_of(save_dirty);i++) {
+		if(save_dirty[i]) return true;
+	}
+	return false;
+}
+#endif
+#if !ENABLE_ROM_PAGING
 static unsigned char rom_bank0[65536];
+#endif
 const uint8_t *rom = (const uint8_t *) (XIP_BASE + FLASH_TARGET_OFFSET);
 
 uint8_t gb_rom_read(struct gb_s *gb, const uint_fast32_t addr);
 uint8_t gb_cart_ram_read(struct gb_s *gb, const uint_fast32_t addr);
 void gb_cart_ram_write(struct gb_s *gb, const uint_fast32_t addr,const uint8_t val);
+bool open_cart_ram_file(struct gb_s *gb);
 void read_cart_ram_file(struct gb_s *gb);
 void write_cart_ram_file(struct gb_s *gb);
+uint_fast8_t flush_cart_ram(struct gb_s *gb, uint_fast8_t max_sectors, bool background);
+bool save_flush_busy(void);
 void load_cart_rom_file(char *filename);
-uint16_t rom_file_selector_display_page(char filename[22][256],uint16_t num_page);
+uint16_t rom_file_selector_display_page(char filename[22][ROM_CATALOG_NAME_LEN],uint16_t num_page);
 void rom_file_selector();
 
-static int lcd_line_busy = 0;
-static palette_t palette;						// Colour palette
+static palette_t palette CORE1_DATA("palette");			// Colour palette, read by core1 for every pixel
 static uint8_t manual_palette_selected=0;
 static uint8_t lcd_scaling = 1;
-static uint8_t pixels_buffer[LCD_WIDTH];		// Pixel data is stored in here.
+static bool lcd_overlay_on;						// Overlay shown in the border, unscaled only
+
+#if ENABLE_FRAME_PIPELINE
+/* Two whole frames of indexed pixels. Core0 renders into the back frame and,
+ * at VBLANK, hands it to core1 to be scanned out while it renders the next one
+ * into the other. If core1 is still scanning out the previous frame, the new
+ * one is dropped and rendered over instead of core0 waiting. */
+static uint8_t lcd_frame[2][LCD_HEIGHT][LCD_WIDTH];
+static uint_fast8_t lcd_frame_back;				// Frame the PPU renders into, core0 only
+static uint_fast8_t lcd_frame_lines;				// Lines rendered into it, core0 only
+static uint32_t lcd_frame_posted;				// Written by core0 only
+static uint32_t lcd_frame_shown;				// Written by core1 only
+static int lcd_frame_dma = -1;					// Channel streaming rows to the LCD
+struct lcd_frame_stats {
+	uint32_t dropped;					// Frames not shown as core1 was busy
+	uint32_t emu_last_us;					// Time core0 spent emulating the last frame
+	uint32_t emu_max_us;
+	uint32_t scan_last_us;					// Time core1 spent scanning out the last frame
+	uint32_t scan_max_us;
+};
+static struct lcd_frame_stats lcd_frame_stats;
+#else
+/* Lines rendered by core0 and waiting to be sent to the LCD by core1. The PPU
+ * renders straight into the slot at the head, so a line is never copied, and
+ * core0 only waits for core1 when every slot is full. Must be a power of
+ * two. */
+#define LCD_LINE_QUEUE	16
+struct lcd_line_slot {
+	uint8_t pixels[LCD_WIDTH];
+	uint8_t line;
+};
+static struct lcd_line_slot lcd_line_queue[LCD_LINE_QUEUE] BANK_DATA(2, "lcd_lines");
+static uint32_t lcd_line_head;					// Written by core0 only
+static uint32_t lcd_line_tail;					// Written by core1 only
+struct lcd_line_stats {
+	uint32_t high_water;					// Most lines queued at once
+	uint32_t stalls;					// Lines core0 waited for a free slot for
+	uint32_t stall_us;					// Time core0 spent waiting
+};
+static struct lcd_line_stats lcd_line_stats;
+#endif
+/* Core0 timings gathered over a frame for its telemetry record, and the
+ * running totals they are taken from. */
+static struct {
+	uint32_t line_start;					// When the PPU started on the current line
+	uint32_t ppu_us;					// Time spent rendering lines
+	uint32_t apu_us;					// Totals at the end of the previous frame
+	uint32_t stall_us;
+	uint32_t dropped;
+	uint32_t miss_us;
+	uint32_t misses;
+	uint32_t underruns;
+} frame_times;
+/* Core0 timings gathered over a second for the overlay, and the totals at
+ * its start. */
+static struct {
+	uint32_t start;						// When the second started
+	uint32_t last;						// When the last frame ended
+	uint32_t frames;
+	uint32_t min_us;					// Shortest, longest and total frame time
+	uint32_t max_us;
+	uint32_t sum_us;
+	uint32_t lines;						// Lines rendered by the PPU
+	uint32_t stall_us;
+	uint32_t dropped;
+	uint32_t underruns;
+} overlay_times;
+#if ENABLE_SOUND
+/**
+ * Returns the number of clocks since the start of the current frame. A frame
+ * starts when VBLANK is entered.
+ */
+static uint32_t gb_frame_cycle(const struct gb_s *gb)
+{
+	uint_fast8_t line = (gb->hram_io[IO_LY] + LCD_VERT_LINES - LCD_HEIGHT) % LCD_VERT_LINES;
+	return line * LCD_LINE_CYCLES + gb->counter.lcd_count;
+}
+#endif
+
 static struct
 {
 	unsigned a	: 1;
@@ -137,19 +288,6 @@ static struct
 	unsigned down	: 1;
 } prev_joypad_bits;
 
-/* Multicore command structure. */
-union core_cmd {
-    struct {
-		#define CORE_CMD_NOP		0		// Does nothing.
-		#define CORE_CMD_LCD_LINE	1		// Set line "data" on the LCD. Pixel data is in pixels_buffer.
-		uint8_t cmd;
-		uint8_t unused1;
-		uint8_t unused2;
-		uint8_t data;
-    };
-    uint32_t full;
-};
-
 /**
  * Ignore all errors.
  */
@@ -167,16 +305,16 @@ void gb_error(struct gb_s *gb, const enum gb_error_e gb_err, const uint16_t addr
 #endif
 }
 
-void core1_lcd_draw_line(const uint_fast8_t line)
+void core1_lcd_draw_line(const uint8_t pixels[LCD_WIDTH], const uint_fast8_t line)
 {
-	static uint16_t fb[LCD_WIDTH];										// 16-bit frame buffer
-	static uint16_t scaledLineBuffer[SCREEN_WIDTH];
+	static uint16_t fb[LCD_WIDTH] CORE1_DATA("lcd_line");					// 16-bit frame buffer
+	static uint16_t scaledLineBuffer[SCREEN_WIDTH] CORE1_DATA("lcd_line");
 	memset(scaledLineBuffer, 0, sizeof(scaledLineBuffer));				// Clear the scaled line buffer
 
 	for(unsigned int x = 0; x < LCD_WIDTH; x++)
 	{
-		fb[x] = palette[(pixels_buffer[x] & LCD_PALETTE_ALL) >> 4]
-				[pixels_buffer[x] & 3];
+		fb[x] = palette[(pixels[x] & LCD_PALETTE_ALL) >> 4]
+				[pixels[x] & 3];
 
 		if (lcd_scaling) {
 			scaledLineBuffer[x*3/2] = fb[x];							// Fill the scaled buffer with pixel skipping
@@ -196,15 +334,123 @@ void core1_lcd_draw_line(const uint_fast8_t line)
 	if (lcd_scaling == 2 && line % 2 != 0) {							// If we're on an odd line...
 		st7789_write_pixels(scaledLineBuffer, SCREEN_WIDTH);			// Write the scaled line buffer to the display
 	}
+}
+
+#if ENABLE_FRAME_PIPELINE
+/**
+ * Convert a line of indexed pixels to RGB565, scaled the same way as
+ * core1_lcd_draw_line() does. When scaling without filling in, the skipped
+ * columns are black.
+ */
+static void lcd_convert_line(const uint8_t pixels[LCD_WIDTH], uint16_t *out, const uint_fast8_t scaling)
+{
+	if(scaling == 1)
+		memset(out, 0, SCREEN_WIDTH * sizeof(*out));
+
+	for(unsigned int x = 0; x < LCD_WIDTH; x++)
+	{
+		const uint16_t c = palette[(pixels[x] & LCD_PALETTE_ALL) >> 4][pixels[x] & 3];
+
+		if(!scaling) {
+			out[x] = c;
+			continue;
+		}
+
+		out[x*3/2] = c;
+		if(scaling == 2 && (x & 1))
+			out[x*3/2+1] = c;										// Fill in the column skipped after odd pixels
+	}
+}
+
+/**
+ * Core1: send a whole frame to the LCD as one address window. Each row is
+ * converted while the previous one is streamed out by DMA.
+ */
+static void core1_lcd_scan_frame(const uint8_t frame[LCD_HEIGHT][LCD_WIDTH])
+{
+	static uint16_t rows[2][SCREEN_WIDTH] BANK_DATA(2, "lcd_rows");
+	const uint_fast8_t scaling = lcd_scaling;
+	const uint_fast16_t w = scaling ? SCREEN_WIDTH : LCD_WIDTH;
+	const uint_fast16_t h = scaling ? LCD_HEIGHT*3/2 : LCD_HEIGHT;
+	spi_inst_t *const spi = lcd_config.spi;
+	uint_fast8_t n = 0;
+
+	/* Same coordinates as core1_lcd_draw_line(), which does not apply the
+	 * rotation's offsets either. */
+	const uint_fast16_t x0 = scaling ? 0 : 40;
+	const uint_fast16_t y0 = scaling ? 0 : 48;
+
+	st7789_caset(x0, x0 + w - 1);
+	st7789_raset(y0, y0 + h - 1);
+	st7789_ramwr();
+
+	for(uint_fast16_t y = 0; y < h; y++)
+	{
+		uint16_t *const row = rows[n];
+
+		if(scaling == 1 && y % 3 == 2)
+			memset(row, 0, w * sizeof(*row));							// Row skipped when scaling without filling in
+		else
+			lcd_convert_line(frame[scaling ? (y*2+1)/3 : y], row, scaling);
+
+		while(dma_channel_is_busy(lcd_frame_dma)) {
+			#if ENABLE_SOUND
+				apu_core1_service();									// Keep audio going while the previous row is sent
+			#else
+				tight_loop_contents();
+			#endif
+		}
+		dma_channel_transfer_from_buffer_now(lcd_frame_dma, row, w);
+		n ^= 1;
+	}
+
+	dma_channel_wait_for_finish_blocking(lcd_frame_dma);
+	while(spi_is_busy(spi))
+		tight_loop_contents();
 
-	__atomic_store_n(&lcd_line_busy, 0, __ATOMIC_SEQ_CST);
+	/* Nothing reads back while DMA writes, so empty the receive FIFO and
+	 * clear the overrun before the next command. */
+	while(spi_is_readable(spi))
+		(void)spi_get_hw(spi)->dr;
+	spi_get_hw(spi)->icr = SPI_SSPICR_RORIC_BITS;
 }
+#endif
+
+#if ENABLE_FRAME_PIPELINE
+/**
+ * Core1 job: scan out frame "index" and hand it back to core0.
+ */
+static void core1_lcd_frame_job(uint32_t index, uint32_t unused)
+{
+	const uint32_t start = time_us_32();
+
+	PROFILE_BEGIN(PROFILE_LCD_SEND);
+	core1_lcd_scan_frame(lcd_frame[index]);
+	PROFILE_END(PROFILE_LCD_SEND);
+	lcd_frame_stats.scan_last_us = time_us_32() - start;
+	if(lcd_frame_stats.scan_last_us > lcd_frame_stats.scan_max_us)
+		lcd_frame_stats.scan_max_us = lcd_frame_stats.scan_last_us;
+	__atomic_store_n(&lcd_frame_shown, lcd_frame_shown + 1, __ATOMIC_RELEASE);
+}
+#else
+/**
+ * Core1 job: send the line in slot "index" of the line queue and hand the
+ * slot back to core0.
+ */
+static void core1_lcd_line_job(uint32_t index, uint32_t unused)
+{
+	const struct lcd_line_slot *slot = &lcd_line_queue[index];
+
+	PROFILE_BEGIN(PROFILE_LCD_SEND);
+	core1_lcd_draw_line(slot->pixels, slot->line);
+	PROFILE_END(PROFILE_LCD_SEND);
+	__atomic_store_n(&lcd_line_tail, lcd_line_tail + 1, __ATOMIC_RELEASE);
+}
+#endif
 
 _Noreturn
 void main_core1(void)
 {
-	union core_cmd cmd;
-
 	/* Initialise and control LCD on core 1. */
 	st7789_init(&lcd_config, SCREEN_WIDTH, SCREEN_HEIGHT);				// Initialize ST7789 display
 	st7789_setRotation(1);												// Ribbon cable on left side of display
@@ -212,43 +458,343 @@ void main_core1(void)
 	st7789_fill(0xFFFF);												// Clear LCD screen
 	st7789_fillRect(0, 0, SCREEN_WIDTH, SCREEN_HEIGHT, 0x0000);			// Clear the portion of the screen with the emulator window
 
-	/* Handle commands coming from core0. */
-	while(1)
-	{
-		 cmd.full = multicore_fifo_pop_blocking();						// Pull data off the queue
-		switch(cmd.cmd)
-		{
-			case CORE_CMD_LCD_LINE:										// We're being told to draw a line
-				core1_lcd_draw_line(cmd.data);							// Draw the line
-				break;
+	core1_sched_run();												// Run the jobs posted by core0
+	HEDLEY_UNREACHABLE();
+}
 
-			case CORE_CMD_NOP:
-			default:
-				break;
-		}
+#if ENABLE_FRAME_PIPELINE
+/**
+ * Hand both frames to core0 and set up the DMA channel. Core1 must not be
+ * running.
+ */
+static void lcd_frame_reset(void)
+{
+	dma_channel_config c;
+
+	if(lcd_frame_dma < 0)
+		lcd_frame_dma = dma_claim_unused_channel(true);
+
+	c = dma_channel_get_default_config(lcd_frame_dma);
+	channel_config_set_transfer_data_size(&c, DMA_SIZE_16);
+	channel_config_set_read_increment(&c, true);
+	channel_config_set_write_increment(&c, false);
+	channel_config_set_dreq(&c, spi_get_dreq(lcd_config.spi, true));
+	dma_channel_configure(lcd_frame_dma, &c, &spi_get_hw(lcd_config.spi)->dr,
+		NULL, 0, false);
+
+	lcd_frame_back = 0;
+	lcd_frame_lines = 0;
+	lcd_frame_posted = 0;
+	lcd_frame_shown = 0;
+	memset(&lcd_frame_stats, 0, sizeof(lcd_frame_stats));
+}
+
+/**
+ * Stop a scan-out cut short by resetting core1.
+ */
+static void lcd_frame_abort(void)
+{
+	dma_channel_abort(lcd_frame_dma);
+	while(spi_is_busy(lcd_config.spi))
+		tight_loop_contents();
+}
+
+/**
+ * Wait until core1 has finished scanning out the frame it was handed.
+ */
+static void lcd_frame_drain(void)
+{
+	while(__atomic_load_n(&lcd_frame_shown, __ATOMIC_ACQUIRE) != lcd_frame_posted)
+		tight_loop_contents();
+}
+
+/**
+ * Called at VBLANK: hand the frame just rendered to core1, or drop it if
+ * core1 is still busy with the previous one.
+ */
+static void lcd_frame_flip(void)
+{
+	if(lcd_frame_lines == 0)
+		return;												// Frame skipped, nothing rendered
+	lcd_frame_lines = 0;
+
+	if(__atomic_load_n(&lcd_frame_shown, __ATOMIC_ACQUIRE) != lcd_frame_posted) {
+		lcd_frame_stats.dropped++;							// The next frame is rendered over this one
+		return;
 	}
 
-	HEDLEY_UNREACHABLE();
+	/* Only one frame is ever with core1, so the post cannot fail. */
+	lcd_frame_posted++;
+	core1_sched_post(CORE1_PRIO_DISPLAY, core1_lcd_frame_job, lcd_frame_back, 0);
+	lcd_frame_back ^= 1;
+}
+
+/**
+ * Returns the line of the back frame the PPU renders line "line" into.
+ */
+uint8_t *lcd_line_buffer(struct gb_s *gb, const uint_fast8_t line)
+{
+	frame_times.line_start = time_us_32();
+	return lcd_frame[lcd_frame_back][line];
 }
 
 void lcd_draw_line(struct gb_s *gb, const uint8_t pixels[LCD_WIDTH], const uint_fast8_t line)
 {
-	union core_cmd cmd;
+	frame_times.ppu_us += time_us_32() - frame_times.line_start;
+	lcd_frame_lines++;
+	overlay_times.lines++;
+}
+#else
+/**
+ * Empty the line queue. Core1 must not be running.
+ */
+static void lcd_line_queue_reset(void)
+{
+	lcd_line_head = 0;
+	lcd_line_tail = 0;
+	memset(&lcd_line_stats, 0, sizeof(lcd_line_stats));
+}
 
-	/* Wait until previous line is sent. */
-	while(__atomic_load_n(&lcd_line_busy, __ATOMIC_SEQ_CST))
+/**
+ * Wait until core1 has sent every queued line to the LCD.
+ */
+static void lcd_line_queue_drain(void)
+{
+	while(__atomic_load_n(&lcd_line_tail, __ATOMIC_ACQUIRE) != lcd_line_head)
 		tight_loop_contents();
+}
 
-	memcpy(pixels_buffer, pixels, LCD_WIDTH);
-	
-	/* Populate command. */
-	cmd.cmd = CORE_CMD_LCD_LINE;
-	cmd.data = line;
+/**
+ * Returns the slot the PPU renders line "line" into, waiting for core1 to
+ * free one if the queue is full.
+ */
+uint8_t *lcd_line_buffer(struct gb_s *gb, const uint_fast8_t line)
+{
+	const uint32_t head = lcd_line_head;
+
+	if(head - __atomic_load_n(&lcd_line_tail, __ATOMIC_ACQUIRE) >= LCD_LINE_QUEUE) {
+		const uint32_t start = time_us_32();
+
+		while(head - __atomic_load_n(&lcd_line_tail, __ATOMIC_ACQUIRE) >= LCD_LINE_QUEUE)
+			tight_loop_contents();
+
+		lcd_line_stats.stalls++;
+		lcd_line_stats.stall_us += time_us_32() - start;
+	}
+
+	frame_times.line_start = time_us_32();
+	return lcd_line_queue[head & (LCD_LINE_QUEUE - 1)].pixels;
+}
+
+/**
+ * Queue the line rendered into the slot returned by lcd_line_buffer().
+ */
+void lcd_draw_line(struct gb_s *gb, const uint8_t pixels[LCD_WIDTH], const uint_fast8_t line)
+{
+	const uint32_t head = lcd_line_head;
+	struct lcd_line_slot *slot = &lcd_line_queue[head & (LCD_LINE_QUEUE - 1)];
+	uint32_t queued;
+
+	PROFILE_BEGIN(PROFILE_LCD_QUEUE);
+	overlay_times.lines++;
+	frame_times.ppu_us += time_us_32() - frame_times.line_start;
+	slot->line = line;
+	lcd_line_head = head + 1;
+
+	/* The display queue is deeper than the line queue, so this only waits
+	 * if the scheduler is shared with something that floods it. */
+	while(!core1_sched_post(CORE1_PRIO_DISPLAY, core1_lcd_line_job, head & (LCD_LINE_QUEUE - 1), 0))
+		tight_loop_contents();
+
+	queued = head + 1 - __atomic_load_n(&lcd_line_tail, __ATOMIC_RELAXED);
+	if(queued > lcd_line_stats.high_water)
+		lcd_line_stats.high_water = queued;
+	PROFILE_END(PROFILE_LCD_QUEUE);
+}
+#endif
+
+/**
+ * Start the telemetry of a new game. The totals the records are taken from
+ * must have been reset or be read afresh.
+ */
+static void frame_telemetry_reset(void)
+{
+	memset(&frame_times, 0, sizeof(frame_times));
+	#if ENABLE_ROM_PAGING
+	{
+		struct rom_cache_stats rc;
+
+		rom_cache_get_stats(&rc);
+		frame_times.miss_us = rc.miss_us;
+		frame_times.misses = rc.misses;
+	}
+	#endif
+	#if ENABLE_SOUND
+	{
+		struct audio_stats as;
+
+		AUDIO_OUTPUT.get_stats(&as);
+		frame_times.underruns = as.underruns;
+	}
+	#endif
+	telemetry_reset();
+}
+
+/**
+ * Add the record of the frame just emulated, which took "emu_us", to the
+ * telemetry. "storage_us" is the time spent saving after it.
+ */
+static void frame_telemetry(uint32_t emu_us, uint32_t storage_us, uint_fast8_t flags)
+{
+	struct telemetry_frame *r = telemetry_begin();
+	uint32_t v;
+
+	if(r != NULL) {
+		r->emu_us = emu_us;
+		r->ppu_us = frame_times.ppu_us;
+		r->storage_us = storage_us;
+		r->flags = flags;
+	}
+	frame_times.ppu_us = 0;
+
+	#if ENABLE_FRAME_PIPELINE
+		v = lcd_frame_stats.dropped;
+		if(r != NULL && v != frame_times.dropped)
+			r->flags |= TELEMETRY_DROPPED;
+		frame_times.dropped = v;
+	#else
+		v = lcd_line_stats.stall_us;
+		if(r != NULL)
+			r->lcd_wait_us = v - frame_times.stall_us;
+		frame_times.stall_us = v;
+	#endif
+	#if ENABLE_ROM_PAGING
+	{
+		struct rom_cache_stats rc;
+
+		rom_cache_get_stats(&rc);
+		if(r != NULL) {
+			r->storage_us += rc.miss_us - frame_times.miss_us;
+			if(rc.misses != frame_times.misses)
+				r->flags |= TELEMETRY_ROM_MISS;
+		}
+		frame_times.miss_us = rc.miss_us;
+		frame_times.misses = rc.misses;
+	}
+	#endif
+	#if ENABLE_SOUND
+	{
+		struct audio_stats as;
+
+		v = apu_core1_busy_us();
+		AUDIO_OUTPUT.get_stats(&as);
+		if(r != NULL) {
+			r->apu_us = v - frame_times.apu_us;
+			r->audio_queued = as.queued;
+			if(as.underruns != frame_times.underruns)
+				r->flags |= TELEMETRY_UNDERRUN;
+		}
+		frame_times.apu_us = v;
+		frame_times.underruns = as.underruns;
+	}
+	#endif
+
+	if(r != NULL)
+		telemetry_commit();
+}
+
+/**
+ * Start gathering the overlay's timings afresh at "now".
+ */
+static void overlay_restart(uint32_t now)
+{
+	memset(&overlay_times, 0, sizeof(overlay_times));
+	overlay_times.start = now;
+	overlay_times.last = now;
+	overlay_times.min_us = UINT32_MAX;
+	#if ENABLE_FRAME_PIPELINE
+		overlay_times.dropped = lcd_frame_stats.dropped;
+	#else
+		overlay_times.stall_us = lcd_line_stats.stall_us;
+	#endif
+	#if ENABLE_SOUND
+	{
+		struct audio_stats as;
+
+		AUDIO_OUTPUT.get_stats(&as);
+		overlay_times.underruns = as.underruns;
+	}
+	#endif
+}
+
+/**
+ * Called once per frame while the overlay is shown: time the frame and, once
+ * a second, hand the figures to core1 to draw in the border.
+ */
+static void overlay_frame(void)
+{
+	char text[LCD_OVERLAY_ROWS][LCD_OVERLAY_COLS + 1];
+	const uint32_t now = time_us_32();
+	const uint32_t frame_us = now - overlay_times.last;
+	uint32_t elapsed, fps10, avg_us, wait_us = 0, skipped, underruns = 0;
+
+	overlay_times.last = now;
+	overlay_times.frames++;
+	overlay_times.sum_us += frame_us;
+	if(frame_us < overlay_times.min_us)
+		overlay_times.min_us = frame_us;
+	if(frame_us > overlay_times.max_us)
+		overlay_times.max_us = frame_us;
+
+	elapsed = now - overlay_times.start;
+	if(elapsed < 1000000)
+		return;
+
+	fps10 = (uint64_t)overlay_times.frames * 10000000 / elapsed;
+	avg_us = overlay_times.sum_us / overlay_times.frames;
+	skipped = overlay_times.frames * LCD_HEIGHT - overlay_times.lines;
+	#if ENABLE_FRAME_PIPELINE
+		skipped += (lcd_frame_stats.dropped - overlay_times.dropped) * LCD_HEIGHT;
+	#else
+		wait_us = (lcd_line_stats.stall_us - overlay_times.stall_us) / overlay_times.frames;
+	#endif
+	#if ENABLE_SOUND
+	{
+		struct audio_stats as;
+
+		AUDIO_OUTPUT.get_stats(&as);
+		underruns = as.underruns - overlay_times.underruns;
+	}
+	#endif
 
-	__atomic_store_n(&lcd_line_busy, 1, __ATOMIC_SEQ_CST);
-	multicore_fifo_push_blocking(cmd.full);
+	/* The LCD font has no ':' or '/', and printf no floats. */
+	snprintf(text[0], sizeof(text[0]), "FPS %lu.%lu  UNDERRUNS %lu",
+		fps10 / 10, fps10 % 10, underruns);
+	snprintf(text[1], sizeof(text[1]), "MIN %lu.%lu AVG %lu.%lu MAX %lu.%lu",
+		overlay_times.min_us / 1000, overlay_times.min_us / 100 % 10,
+		avg_us / 1000, avg_us / 100 % 10,
+		overlay_times.max_us / 1000, overlay_times.max_us / 100 % 10);
+	snprintf(text[2], sizeof(text[2]), "WAIT %lu.%lu  SKIPPED LINES %lu",
+		wait_us / 1000, wait_us / 100 % 10, skipped);
+
+	/* If core1 is still drawing the last figures, these are dropped. */
+	lcd_overlay_post((const char (*)[LCD_OVERLAY_COLS + 1])text);
+	overlay_restart(now);
 }
 
+/**
+ * Point bus performance counters 2 and 3 at the contested and total accesses
+ * to SRAM bank "bank": 0-3 for main SRAM, 4 for SCRATCH_X and 5 for
+ * SCRATCH_Y.
+ */
+static void bus_sram_select(uint_fast8_t bank)
+{
+	/* The events of each bank are a pair, banks counting down. */
+	bus_ctrl_hw->counter[2].sel = arbiter_sram0_perf_event_access_contested - 2 * bank;
+	bus_ctrl_hw->counter[3].sel = arbiter_sram0_perf_event_access - 2 * bank;
+	bus_ctrl_hw->counter[2].value = 0;
+	bus_ctrl_hw->counter[3].value = 0;
+}
 
 int main(void)
 {
@@ -323,39 +869,13 @@ int main(void)
 		gpio_set_dir(26, GPIO_OUT);
 		gpio_put(26, 1);
 
-		#if AUDIO_PWM
-			gpio_set_function(GPIO_AUDIO, GPIO_FUNC_PWM);
-			int audio_pin_slice = pwm_gpio_to_slice_num(GPIO_AUDIO);
-
-			// Setup PWM interrupt to fire when PWM cycle is complete
-			pwm_clear_irq(audio_pin_slice);
-			pwm_set_irq_enabled(audio_pin_slice, true);
-			// set the handle function above
-			irq_set_exclusive_handler(PWM_IRQ_WRAP, pwm_interrupt_handler); 
-			irq_set_enabled(PWM_IRQ_WRAP, true);
-
-			pwm_config config = pwm_get_default_config();
-			pwm_config_set_clkdiv(&config, 1.0f); 
-			pwm_config_set_wrap(&config, 254); 
-			pwm_init(audio_pin_slice, &config, true);
-			pwm_set_gpio_level(GPIO_AUDIO, 0);
-		#endif
+		AUDIO_OUTPUT.init(AUDIO_SAMPLE_RATE);		// Plays silence until the APU starts
+		AUDIO_OUTPUT.set_volume(volume);
+	#endif
 
-		// Allocate memory for the stream buffer
-		//stream=malloc(AUDIO_BUFFER_SIZE_BYTES);
-		//assert(stream!=NULL);
-		//memset(stream,0,AUDIO_BUFFER_SIZE_BYTES);  // Zero out the stream buffer
-		stream=malloc(2048);
-		assert(stream!=NULL);
-		memset(stream,0,2048);  // Zero out the stream buffer
-
-		// #if !USE_GB3_AUDIO_LIB
-		 	audio_init2(GPIO_AUDIO, AUDIO_SAMPLE_RATE);
-		 	audio_source_set_volume(0, volume);
-		 	audio_play_loop(stream, 512, 0);
-		// #endif
-
-		//add_repeating_timer_us(-64, wavegen_callback, NULL, &timerWFGenerator);
+	#if ENABLE_SDCARD
+		/* Mount the SD card once. It stays mounted from here on. */
+		storage_init();
 	#endif
 
 	while(true)
@@ -372,7 +892,9 @@ int main(void)
 		#endif
 
 		/* Initialise GB context. */
-		memcpy(rom_bank0, rom, sizeof(rom_bank0));
+		#if !ENABLE_ROM_PAGING
+			memcpy(rom_bank0, rom, sizeof(rom_bank0));
+		#endif
 		ret = gb_init(&gb, &gb_rom_read, &gb_cart_ram_read, &gb_cart_ram_write, &gb_error, NULL);
 
 		if(ret != GB_INIT_NO_ERROR)
@@ -389,64 +911,96 @@ int main(void)
 		#endif
 	
 		gb_init_lcd(&gb, &lcd_draw_line);
-		multicore_launch_core1(main_core1);				// Start Core1, which processes requests to the LCD
+		gb_init_lcd_line_buffer(&gb, &lcd_line_buffer);
+		#if ENABLE_FRAME_PIPELINE
+			lcd_frame_reset();
+		#else
+			lcd_line_queue_reset();
+		#endif
+		lcd_overlay_reset();
+		overlay_restart(time_us_32());
 
+		core1_sched_init();
+		frame_telemetry_reset();
+		cpu_hist_reset();
+		pc_sample_start(&gb.cpu_reg.pc.reg, &gb.selected_rom_bank);
 		#if ENABLE_SOUND
-			// Initialize audio emulation
-			audio_init();
-
-			#if USE_GB3_AUDIO_LIB
-				dmaAudioInit();
-				playAudio(stream, 0, AUDIO_SAMPLES);
-			#endif
+			// Initialize audio emulation. Core1 owns the APU from here on.
+			apu_core1_init(&AUDIO_OUTPUT);				// APU renders straight into the output's ring blocks
+			core1_sched_set_poll(CORE1_PRIO_AUDIO, apu_core1_service);	// Synthesise audio when no line is waiting
 		#endif
 
-		#if ENABLE_SDCARD
-			/* Load Save File. */
-			//WKM read_cart_ram_file(&gb);
+		multicore_launch_core1(main_core1);				// Start Core1, which processes requests to the LCD and the APU
+
+		#if ENABLE_SAVES
+			/* Load Save File. It stays open, so that saving is a write in place. */
+			read_cart_ram_file(&gb);
 		#endif
 
 		uint_fast32_t frames = 0;
 		uint64_t start_time = time_us_64();
+
+		/* Count bus accesses to the APB and fast peripherals, to measure
+		 * the load put on the bus fabric by audio DMA, and the accesses to
+		 * one SRAM bank and how many of them had to wait. */
+		uint_fast8_t bus_sram = 0;
+		bus_ctrl_hw->counter[0].sel = arbiter_apb_perf_event_access;
+		bus_ctrl_hw->counter[1].sel = arbiter_fastperi_perf_event_access;
+		bus_sram_select(bus_sram);
+		bus_ctrl_hw->counter[0].value = 0;
+		bus_ctrl_hw->counter[1].value = 0;
+		uint64_t bus_start_time = time_us_64();
 		while(1)
 		{
 			int input;
 
+			uint32_t emu_us, storage_start;
+			uint_fast8_t tflags = gb.direct.frame_skip ? TELEMETRY_FRAME_SKIP : 0;
+
 			gb.gb_frame = 0;
 			
+			emu_us = time_us_32();
+			pc_sample_resume();
 			do {
+				PROFILE_BEGIN(PROFILE_CPU);
 				__gb_step_cpu(&gb);
+				PROFILE_END(PROFILE_CPU);
 				tight_loop_contents();
 			} while(HEDLEY_LIKELY(gb.gb_frame == 0));
-
+			pc_sample_pause();
+			emu_us = time_us_32() - emu_us;
+			profile_frame();
+			cpu_hist_frame();
+
+			#if ENABLE_FRAME_PIPELINE
+				lcd_frame_stats.emu_last_us = emu_us;
+				if(lcd_frame_stats.emu_last_us > lcd_frame_stats.emu_max_us)
+					lcd_frame_stats.emu_max_us = lcd_frame_stats.emu_last_us;
+				lcd_frame_flip();							// VBLANK: show the frame just rendered
+			#endif
 			frames++;
 			#if ENABLE_SOUND
-				if(!gb.direct.frame_skip) {
-					audio_callback(NULL, stream, 2048);
-					//audio_callback(NULL, stream, 1098);
-					//UpdateAudioBuffer(stream, AUDIO_SAMPLES);
+				apu_core1_end_frame();						// Core1 finishes the frame's samples
+			#endif
 
-					#if USE_GB3_AUDIO_LIB
-						serviceAudio();
-					#else
-						audio_mixer_step();
-					#endif
-					//i2s_dma_write(&i2s_config, stream);
-					//audio_play_once(stream, AUDIO_SAMPLES);
-					//audio_mixer_step();
-					//pwm_set_gpio_level(GPIO_AUDIO, stream[sample_rate]);
-					//sample_rate++;
-					//uint slice_num = slice_number;			//Do this once, less math
-					//uint chan = chan_nummber;
-
-					//pwm_set_clkdiv_int_frac(slice_num, 1, 0);
-					//pwm_set_wrap(slice_num, 8000);
-					//pwm_set_chan_level(slice_num, chan, *stream);
-					//pwm_set_enabled(slice_num, true);
-					
+			storage_start = time_us_32();
+			#if ENABLE_SAVES
+				/* Write changed cart RAM to the save file a few sectors per
+				 * frame, once the game has stopped writing to it. */
+				if(time_us_32()-save_write_time>=SAVE_FLUSH_QUIET_MS*1000) {
+					if(save_flush_busy()) {
+						/* the last flush is still being written */
+					} else if(save_is_dirty()) {
+						if(flush_cart_ram(&gb,SAVE_FLUSH_MAX_SECTORS,true))
+							tflags |= TELEMETRY_SAVE_FLUSH;
+					}
 				}
 			#endif
 
+			frame_telemetry(emu_us, time_us_32() - storage_start, tflags);
+			if(lcd_overlay_on)
+				overlay_frame();
+
 			/* Update buttons state */
 			prev_joypad_bits.up=gb.direct.joypad_bits.up;
 			prev_joypad_bits.down=gb.direct.joypad_bits.down;
@@ -470,15 +1024,15 @@ int main(void)
 				#if ENABLE_SOUND
 					if(!gb.direct.joypad_bits.up && prev_joypad_bits.up) {
 						/* select + up: increase sound volume */
-						//i2s_increase_volume(&i2s_config);
-						volume+=16;
-						//audio_source_set_volume(0, volume);
+						if(volume < 512)
+							volume+=16;
+						AUDIO_OUTPUT.set_volume(volume);
 					}
 					if(!gb.direct.joypad_bits.down && prev_joypad_bits.down) {
 						/* select + down: decrease sound volume */
-						//i2s_decrease_volume(&i2s_config);
-						volume-=16;
-						//audio_source_set_volume(0, volume);
+						if(volume > 0)
+							volume-=16;
+						AUDIO_OUTPUT.set_volume(volume);
 					}
 				#endif
 				if(!gb.direct.joypad_bits.right && prev_joypad_bits.right) {
@@ -497,9 +1051,6 @@ int main(void)
 				}
 				if(!gb.direct.joypad_bits.start && prev_joypad_bits.start) {
 					/* select + start: save ram and resets to the game selection menu */
-					#if ENABLE_SDCARD				
-						write_cart_ram_file(&gb);
-					#endif				
 					goto out;
 				}
 				if(!gb.direct.joypad_bits.a && prev_joypad_bits.a) {
@@ -508,12 +1059,25 @@ int main(void)
 					printf("I gb.direct.frame_skip = %d\n",gb.direct.frame_skip);
 				}
 				if (!gb.direct.joypad_bits.b && prev_joypad_bits.b) {
-					/* select + B: Toggle Scaling */
-					while (lcd_line_busy) {true; };
+					/* select + B: cycle through scaled, unscaled, and
+					 * unscaled with the performance overlay in the border */
+					#if ENABLE_FRAME_PIPELINE
+						lcd_frame_drain();			// Let core1 finish the frame it is sending
+					#else
+						lcd_line_queue_drain();			// Let core1 finish the lines already queued
+					#endif
+					lcd_overlay_drain();
 					st7789_fill(0x0000);				// Clear the screen
-					lcd_scaling++;
-					if (lcd_scaling > 1) lcd_scaling = 0;	// Toggle scaling
-					printf("I scaling toggled\n");
+					if (lcd_scaling) {
+						lcd_scaling = 0;
+					} else if (!lcd_overlay_on) {
+						lcd_overlay_on = true;
+						overlay_restart(time_us_32());
+					} else {
+						lcd_overlay_on = false;
+						lcd_scaling = 1;
+					}
+					printf("I scaling %u, overlay %u\n", lcd_scaling, lcd_overlay_on);
 				}	
 			}
 
@@ -544,12 +1108,136 @@ int main(void)
 						"Time: %lu us\n"
 						"FPS: %lu\n",
 						frames, diff, fps);
+					#if ENABLE_FRAME_PIPELINE
+						printf("LCD frames: %lu shown, %lu dropped\n"
+							"Emulation: last %lu us, max %lu us\n"
+							"Scan-out: last %lu us, max %lu us\n",
+							lcd_frame_shown, lcd_frame_stats.dropped,
+							lcd_frame_stats.emu_last_us, lcd_frame_stats.emu_max_us,
+							lcd_frame_stats.scan_last_us, lcd_frame_stats.scan_max_us);
+					#else
+						printf("LCD line queue: %lu of %u slots used, %lu stalls (%lu us)\n",
+							lcd_line_stats.high_water, LCD_LINE_QUEUE,
+							lcd_line_stats.stalls, lcd_line_stats.stall_us);
+					#endif
+					{
+						struct core1_sched_stats cs;
+
+						core1_sched_get_stats(&cs);
+						printf("Core1 jobs: %lu display, %lu storage, %lu telemetry, %lu not posted\n",
+							cs.run[CORE1_PRIO_DISPLAY], cs.run[CORE1_PRIO_STORAGE],
+							cs.run[CORE1_PRIO_TELEMETRY],
+							cs.full[CORE1_PRIO_DISPLAY] + cs.full[CORE1_PRIO_STORAGE]
+							+ cs.full[CORE1_PRIO_TELEMETRY]);
+					}
+					#if ENABLE_SDCARD
+					{
+						struct storage_stats ss;
+
+						storage_get_stats(&ss);
+						printf("SD clock: %lu kHz, %lu fallbacks\n",
+							ss.sck_hz/1000, ss.sck_fallbacks);
+					}
+					#endif
+					#if ENABLE_SAVES
+						printf("Save flushes: %lu (%lu bytes), last %lu us, max %lu us\n",
+							save_stats.flushes, save_stats.bytes,
+							save_stats.last_us, save_stats.max_us);
+					#endif
+					#if ENABLE_FLASH_SAVES
+					{
+						struct save_journal_stats sj;
+
+						save_journal_get_stats(&sj);
+						printf("Save journal: %lu pages written, %lu unchanged, %lu moved, %lu erases\n",
+							sj.pages_written, sj.pages_unchanged,
+							sj.pages_moved, sj.erases);
+					}
+					#endif
+					#if ENABLE_ROM_PAGING
+					{
+						struct rom_cache_stats rc;
+
+						rom_cache_get_stats(&rc);
+						printf("ROM bank misses: %lu, %lu read ahead (%lu us waiting)\n",
+							rc.misses, rc.prefetches, rc.miss_us);
+					}
+					#endif
 					stdio_flush();
 					frames = 0;
 					start_time = time_us_64();
 					break;
 				}
 
+				case 'p':
+					profile_report();		// Needs PROFILING set in CMakeLists.txt
+					break;
+
+				case 'h':
+					/* Dump and restart the opcode, page and ROM bank counts,
+					 * for tools/cpu_hist.py. Needs CPU_HISTOGRAMS set in
+					 * CMakeLists.txt. */
+					if(!cpu_hist_dump())
+						puts("E CPU histograms disabled or dump already running");
+					break;
+
+				case 's':
+					/* Print the busiest addresses of the emulated code and
+					 * sample afresh. Needs PC_SAMPLING set in CMakeLists.txt. */
+					if(!pc_sample_dump())
+						puts("E PC sampling disabled or dump already running");
+					break;
+
+				case 't':
+					/* Dump the last frames' timings as CSV, for tools/telemetry.py */
+					if(!telemetry_dump())
+						puts("E a dump is already running");
+					break;
+
+				case 'a':
+				{
+					/* Counters are 24 bits and saturate, so sample
+					 * at least every few seconds. */
+					uint32_t diff = time_us_64() - bus_start_time;
+					uint32_t apb = bus_ctrl_hw->counter[0].value;
+					uint32_t fastperi = bus_ctrl_hw->counter[1].value;
+					uint32_t contested = bus_ctrl_hw->counter[2].value;
+					uint32_t sram = bus_ctrl_hw->counter[3].value;
+
+					printf("Time: %lu us\n"
+						"APB accesses: %lu (%lu/s)%s\n"
+						"Fast peripheral accesses: %lu (%lu/s)%s\n",
+						diff,
+						apb, (uint32_t)(((uint64_t)apb*1000*1000)/diff),
+						apb == 0xFFFFFF ? " saturated" : "",
+						fastperi, (uint32_t)(((uint64_t)fastperi*1000*1000)/diff),
+						fastperi == 0xFFFFFF ? " saturated" : "");
+					printf("SRAM%u accesses: %lu (%lu/s)%s, %lu contested (%lu.%lu%%)\n",
+						bus_sram, sram, (uint32_t)(((uint64_t)sram*1000*1000)/diff),
+						sram == 0xFFFFFF ? " saturated" : "", contested,
+						sram ? (uint32_t)((uint64_t)contested*100/sram) : 0,
+						sram ? (uint32_t)((uint64_t)contested*1000/sram % 10) : 0);
+					#if ENABLE_SOUND
+					{
+						struct audio_stats stats;
+
+						AUDIO_OUTPUT.get_stats(&stats);
+						printf("Audio %s: %lu blocks, %lu underruns, %lu IRQs, %lu transfers/sample\n",
+							AUDIO_OUTPUT.name, stats.blocks, stats.underruns,
+							stats.irqs, stats.transfers_per_sample);
+					}
+					#endif
+					stdio_flush();
+
+					/* Each report covers the next bank. */
+					bus_sram = (bus_sram + 1) % 6;
+					bus_sram_select(bus_sram);
+					bus_ctrl_hw->counter[0].value = 0;
+					bus_ctrl_hw->counter[1].value = 0;
+					bus_start_time = time_us_64();
+					break;
+				}
+
 				case '\n':
 				case '\r':
 				{
@@ -609,7 +1297,18 @@ int main(void)
 		}
 		out:
 			puts("\nEmulation Ended");
+			pc_sample_stop();
+			telemetry_print_stop();					// core1 must not be reset part way through a print
 			multicore_reset_core1(); 				// stop lcd task running on core 1
+			#if ENABLE_FRAME_PIPELINE
+				lcd_frame_abort();
+			#endif
+			#if ENABLE_SAVES
+				write_cart_ram_file(&gb);			// write whatever the background flush has not
+			#endif
+			#if ENABLE_FLASH_SAVES
+				save_journal_poll();				// erase journal sectors while the selector loads
+			#endif
 	}
 }
 
@@ -619,10 +1318,14 @@ int main(void)
 uint8_t gb_rom_read(struct gb_s *gb, const uint_fast32_t addr)
 {
 	(void) gb;
-	if(addr < sizeof(rom_bank0))
-		return rom_bank0[addr];
+	#if ENABLE_ROM_PAGING
+		return rom_cache_read(addr);
+	#else
+		if(addr < sizeof(rom_bank0))
+			return rom_bank0[addr];
 
-	return rom[addr];
+		return rom[addr];
+	#endif
 }
 
 /**
@@ -640,175 +1343,551 @@ uint8_t gb_cart_ram_read(struct gb_s *gb, const uint_fast32_t addr)
 void gb_cart_ram_write(struct gb_s *gb, const uint_fast32_t addr, const uint8_t val)
 {
 	ram[addr] = val;
+	#if ENABLE_SAVES
+		const uint_fast16_t sector = addr / STORAGE_SECTOR_SIZE;
+		save_dirty[sector / 32] |= 1u << (sector % 32);
+		save_write_time = time_us_32();
+	#endif
 }
-#if ENABLE_SDCARD
+#if ENABLE_SAVES
+#if ENABLE_FLASH_SAVES
 /**
- * Load a save file from the SD card
+ * Identify the game for the save journal, from its cartridge header.
  */
-void read_cart_ram_file(struct gb_s *gb) {
+static uint32_t cart_id(struct gb_s *gb) {
+	uint32_t h=2166136261u;
+	for(uint_fast16_t addr=0x134;addr<0x150;addr++) {
+		h=(h^gb_rom_read(gb,addr))*16777619u;
+	}
+	return h;
+}
+#else
+/**
+ * Open the save file on the SD card, allocating it if it does not exist.
+ * It is kept open until the next game is started.
+ */
+bool open_cart_ram_file(struct gb_s *gb) {
 	char filename[16];
 	uint_fast32_t save_size;
-	UINT br;
-	
+
 	gb_get_rom_name(gb,filename);
 	save_size=gb_get_save_size(gb);
-	if(save_size>0) {
-		sd_card_t *pSD=sd_get_by_num(0);
-		FRESULT fr=f_mount(&pSD->fatfs,pSD->pcName,1);
-		if (FR_OK!=fr) {
-			printf("E f_mount error: %s (%d)\n",FRESULT_str(fr),fr);
-			return;
+	if(save_size==0) {
+		storage_save_close();
+		return false;
+	}
+	return storage_save_open(filename,save_size);
+}
+#endif
+
+/**
+ * Returns true while a flush is being written in the background. Once it has
+ * finished, sectors it failed to write are marked changed again.
+ */
+bool save_flush_busy(void) {
+	#if ENABLE_FLASH_SAVES
+		return false;
+	#else
+		bool ok;
+
+		if(save_flight_count==0) return false;
+		if(storage_save_pending(&ok)) return true;
+		if(!ok) {
+			for(uint_fast8_t i=save_flight_first;i<save_flight_first+save_flight_count;i++) {
+				save_dirty[i/32]|=1u<<(i%32);
+			}
 		}
+		save_flight_count=0;
+		return false;
+	#endif
+}
 
-		FIL fil;
-		fr=f_open(&fil,filename,FA_READ);
-		if (fr==FR_OK) {
-			f_read(&fil,ram,f_size(&fil),&br);
-		} else {
-			printf("E f_open(%s) error: %s (%d)\n",filename,FRESULT_str(fr),fr);
+/**
+ * Write up to "max_sectors" changed sectors of cart RAM to the open save
+ * file, as one run of consecutive sectors. Returns the number written.
+ * With "background", the sectors are written by DMA while the game goes on
+ * where the save file allows it, and save_flush_busy() says when they are
+ * done. A sector the game changes meanwhile is marked changed again, so it
+ * is written again later.
+ */
+uint_fast8_t flush_cart_ram(struct gb_s *gb, uint_fast8_t max_sectors, bool background) {
+	uint_fast8_t first, n;
+
+	if(save_flush_busy()) {
+		return 0;
+	}
+
+	/* find the first changed sector */
+	for(first=0;first<save_sectors;first++) {
+		if(save_dirty[first/32] & (1u<<(first%32))) break;
+	}
+	if(first>=save_sectors) {
+		return 0;
+	}
+
+	/* and the changed sectors following it */
+	for(n=1;n<max_sectors && first+n<save_sectors;n++) {
+		if(!(save_dirty[(first+n)/32] & (1u<<((first+n)%32)))) break;
+	}
+	for(uint_fast8_t i=first;i<first+n;i++) {
+		save_dirty[i/32]&=~(1u<<(i%32));
+	}
+
+	uint32_t offset=first*STORAGE_SECTOR_SIZE;
+	uint32_t len=n*STORAGE_SECTOR_SIZE;
+	uint32_t t=time_us_32();
+	PROFILE_BEGIN(PROFILE_STORAGE);
+	#if ENABLE_FLASH_SAVES
+		bool posted=false;
+	#else
+		bool posted=background && storage_save_write_async(offset,ram+offset,len);
+	#endif
+	if(posted) {
+		save_flight_first=first;
+		save_flight_count=n;
+		save_stats.last_us=time_us_32()-t;
+		save_stats.flushes++;
+		save_stats.bytes+=len;
+		PROFILE_END(PROFILE_STORAGE);
+		return n;
+	}
+	#if ENABLE_FLASH_SAVES
+		bool ok=save_journal_write(offset,ram+offset,len);
+	#else
+		bool ok=storage_save_write(offset,ram+offset,len);
+		if(!ok) {
+			/* the file is reopened if the card had to be mounted again */
+			ok=open_cart_ram_file(gb) && storage_save_write(offset,ram+offset,len);
 		}
-		
-		fr=f_close(&fil);
-		if(fr!=FR_OK) {
-			printf("E f_close error: %s (%d)\n", FRESULT_str(fr), fr);
+	#endif
+	if(!ok) {
+		/* try again later */
+		for(uint_fast8_t i=first;i<first+n;i++) {
+			save_dirty[i/32]|=1u<<(i%32);
 		}
-		f_unmount(pSD->pcName);
+		PROFILE_END(PROFILE_STORAGE);
+		return 0;
 	}
-	printf("I read_cart_ram_file(%s) COMPLETE (%lu bytes)\n",filename,save_size);
+	PROFILE_END(PROFILE_STORAGE);
+	save_stats.last_us=time_us_32()-t;
+	if(save_stats.last_us>save_stats.max_us) {
+		save_stats.max_us=save_stats.last_us;
+	}
+	save_stats.flushes++;
+	save_stats.bytes+=len;
+	return n;
 }
 
 /**
- * Write a save file to the SD card
+ * Load a save file from the SD card, or from the journal in flash
  */
-void write_cart_ram_file(struct gb_s *gb) {
+void read_cart_ram_file(struct gb_s *gb) {
 	char filename[16];
 	uint_fast32_t save_size;
-	UINT bw;
 	
 	gb_get_rom_name(gb,filename);
 	save_size=gb_get_save_size(gb);
-	if(save_size>0) {
-		sd_card_t *pSD=sd_get_by_num(0);
-		FRESULT fr=f_mount(&pSD->fatfs,pSD->pcName,1);
-		if (FR_OK!=fr) {
-			printf("E f_mount error: %s (%d)\n",FRESULT_str(fr),fr);
-			return;
+	save_sectors=(save_size+STORAGE_SECTOR_SIZE-1)/STORAGE_SECTOR_SIZE;
+	memset(save_dirty,0,sizeof save_dirty);
+	#if ENABLE_FLASH_SAVES
+		save_size=save_journal_open(cart_id(gb),ram,save_size)*SAVE_JOURNAL_PAGE_SIZE;
+	#else
+		if(save_size>0 && open_cart_ram_file(gb)) {
+			save_size=storage_save_read(ram,save_size);
 		}
+	#endif
+	printf("I read_cart_ram_file(%s) COMPLETE (%lu bytes)\n",filename,save_size);
+}
+
+/**
+ * Write the changed parts of the save file to the SD card, or to the
+ * journal in flash
+ */
+void write_cart_ram_file(struct gb_s *gb) {
+	char filename[16];
+	uint_fast32_t written=0;
+	uint_fast8_t n;
+	
+	gb_get_rom_name(gb,filename);
+	while(save_flush_busy()) {
+		tight_loop_contents();
+	}
+	while((n=flush_cart_ram(gb,save_sectors,false))>0) {
+		written+=n*STORAGE_SECTOR_SIZE;
+	}
+	if(save_is_dirty()) {
+		printf("E write_cart_ram_file(%s) failed\n",filename);
+		return;
+	}
+	printf("I write_cart_ram_file(%s) COMPLETE (%lu bytes)\n",filename,written);
+}
+#endif
 
-		FIL fil;
-		fr=f_open(&fil,filename,FA_CREATE_ALWAYS | FA_WRITE);
-		if (fr==FR_OK) {
-			f_write(&fil,ram,save_size,&bw);
+#if ENABLE_SDCARD
+
+#if !ENABLE_ROM_PAGING
+/**
+ * CRC-32 of "len" bytes of flash at "offset", computed by the DMA sniffer
+ * while the data is read through XIP. "len" must be a multiple of 4.
+ */
+static uint32_t flash_crc32(uint32_t offset, uint32_t len) {
+	static uint32_t sink;
+	int chan=dma_claim_unused_channel(true);
+	dma_channel_config c=dma_channel_get_default_config(chan);
+	channel_config_set_transfer_data_size(&c,DMA_SIZE_32);
+	channel_config_set_read_increment(&c,true);
+	channel_config_set_write_increment(&c,false);
+	channel_config_set_sniff_enable(&c,true);
+	dma_sniffer_enable(chan,0x0,true);		/* CRC-32 (IEEE 802.3) */
+	dma_hw->sniff_data=0xFFFFFFFF;
+	dma_channel_configure(chan,&c,&sink,(const void *)(XIP_BASE+offset),len/4,true);
+	dma_channel_wait_for_finish_blocking(chan);
+	uint32_t crc=dma_hw->sniff_data;
+	dma_sniffer_disable();
+	dma_channel_unclaim(chan);
+	return crc;
+}
+
+/**
+ * Returns true if flash already holds the ROM file "filename" as described
+ * by "fno", and its contents are intact.
+ */
+static bool flash_rom_is_current(const char *filename, const FILINFO *fno) {
+	const struct flash_rom_header *hdr=(const struct flash_rom_header *)(XIP_BASE+FLASH_HEADER_OFFSET);
+
+	if(hdr->magic!=FLASH_HEADER_MAGIC || hdr->size!=fno->fsize ||
+			hdr->date_time!=((uint32_t)fno->fdate<<16 | fno->ftime) ||
+			hdr->flashed>PICO_FLASH_SIZE_BYTES-FLASH_TARGET_OFFSET ||
+			strncmp(hdr->name,filename,sizeof hdr->name)!=0) {
+		return false;
+	}
+
+	/* Catch flash that was changed or only partly programmed. */
+	return flash_crc32(FLASH_TARGET_OFFSET,hdr->flashed)==hdr->crc;
+}
+
+/**
+ * ROM loader pipeline. Core0 reads the next block of the ROM from the SD card
+ * while core1 writes the previous one to flash, so neither waits for the
+ * other. Blocks are FLASH_BLOCK_SIZE so that a block that has to be
+ * rewritten completely can use a single 64 KiB erase.
+ */
+#define LOAD_BLOCK_SIZE FLASH_BLOCK_SIZE
+#define LOAD_SECTORS (LOAD_BLOCK_SIZE/FLASH_SECTOR_SIZE)
+static uint8_t *load_buffer[2];
+static volatile uint32_t load_flash_us;
+
+/**
+ * Write "len" bytes of "buf" to flash at "offset", which is block aligned.
+ * Sectors that already hold the right data are left alone. Returns the
+ * number of sectors written in bits 0-7, the number skipped in bits 8-15 and
+ * bit 16 set if verification failed.
+ */
+static uint32_t load_flash_block(uint32_t offset, const uint8_t *buf, uint32_t len) {
+	const uint32_t sectors=(len+FLASH_SECTOR_SIZE-1)/FLASH_SECTOR_SIZE;
+	const uint32_t *flash=(const uint32_t *)(XIP_BASE+offset);
+	const uint32_t *data=(const uint32_t *)buf;
+	uint32_t changed=0, written=0;
+	bool mismatch=false;
+
+	/* Find the sectors that differ */
+	for(uint32_t sector=0;sector<sectors;sector++) {
+		for(uint32_t i=sector*FLASH_SECTOR_SIZE/4;i<(sector+1)*FLASH_SECTOR_SIZE/4;i++) {
+			if(flash[i]!=data[i]) {
+				changed|=1u<<sector;
+				written++;
+				break;
+			}
+		}
+	}
+
+	if(sectors==LOAD_SECTORS && written>=LOAD_SECTORS/2) {
+		/* Cheaper to erase the whole block and rewrite it */
+		flash_range_erase(offset,LOAD_BLOCK_SIZE);
+		flash_range_program(offset,buf,LOAD_BLOCK_SIZE);
+		changed=(1u<<LOAD_SECTORS)-1;
+		written=LOAD_SECTORS;
+	} else {
+		for(uint32_t sector=0;sector<sectors;sector++) {
+			if(changed & (1u<<sector)) {
+				flash_range_erase(offset+sector*FLASH_SECTOR_SIZE,FLASH_SECTOR_SIZE);
+				flash_range_program(offset+sector*FLASH_SECTOR_SIZE,buf+sector*FLASH_SECTOR_SIZE,FLASH_SECTOR_SIZE);
+			}
+		}
+	}
+
+	/* Read back the written sectors and check programming */
+	for(uint32_t sector=0;sector<sectors && !mismatch;sector++) {
+		if(!(changed & (1u<<sector))) continue;
+		for(uint32_t i=sector*FLASH_SECTOR_SIZE/4;i<(sector+1)*FLASH_SECTOR_SIZE/4;i++) {
+			if(flash[i]!=data[i]) {
+				mismatch=true;
+				break;
+			}
+		}
+	}
+
+	return written | (sectors-written)<<8 | (mismatch ? 1u<<16 : 0);
+}
+
+/**
+ * Core1 side of the loader: write each block handed over by core0.
+ */
+static void load_core1(void) {
+	for(;;) {
+		uint32_t offset=multicore_fifo_pop_blocking();
+		uint32_t index=multicore_fifo_pop_blocking();
+		uint32_t len=multicore_fifo_pop_blocking();
+		uint32_t start=time_us_32();
+		uint32_t result=load_flash_block(offset,load_buffer[index],len);
+		load_flash_us+=time_us_32()-start;
+		multicore_fifo_push_blocking(result);
+	}
+}
+
+/**
+ * State of the compressed ROM being loaded, if it is one.
+ */
+static struct lz4_frame load_frame;
+static uint8_t *load_lz4_block;
+static bool load_lz4_end;
+
+/**
+ * Open the LZ4 frame of the compressed ROM "fil". Returns the decompressed
+ * size, or 0 if the frame is not supported or there is no memory.
+ */
+static uint32_t load_lz4_open(FIL *fil) {
+	uint8_t header[LZ4_FRAME_HEADER_MAX];
+	UINT br;
+
+	if(f_read(fil,header,sizeof header,&br)!=FR_OK ||
+			!lz4_frame_parse(header,br,&load_frame) || load_frame.content_size==0) {
+		printf("E Not a supported LZ4 frame\n");
+		return 0;
+	}
+	load_lz4_block=malloc(LZ4_ROM_BLOCK_SIZE);
+	if(load_lz4_block==NULL) {
+		printf("E No memory for LZ4 blocks\n");
+		return 0;
+	}
+	load_lz4_end=false;
+	f_lseek(fil,load_frame.header_size);
+	return load_frame.content_size;
+}
+
+/**
+ * Decompress the next blocks of the ROM "fil" into "buf" until the next
+ * block might not fit in LOAD_BLOCK_SIZE bytes or the frame ends. Sets "br"
+ * to the number of bytes decompressed, 0 at the end of the ROM.
+ */
+static FRESULT load_lz4_read(FIL *fil, uint8_t *buf, UINT *br) {
+	FRESULT fr=FR_OK;
+	uint32_t out=0;
+	UINT n;
+
+	while(!load_lz4_end && out+LZ4_ROM_BLOCK_SIZE<=LOAD_BLOCK_SIZE) {
+		uint8_t word[4];
+		uint32_t w, size;
+		int32_t len;
+
+		fr=f_read(fil,word,sizeof word,&n);
+		if(fr!=FR_OK) break;
+		w=n==sizeof word ? word[0] | word[1]<<8 | word[2]<<16 | (uint32_t)word[3]<<24 : 0;
+		if(w==0) {
+			load_lz4_end=true;		/* End mark */
+			break;
+		}
+
+		size=w & ~LZ4_BLOCK_UNCOMPRESSED;
+		if(size>LZ4_ROM_BLOCK_SIZE) {
+			printf("E Blocks larger than %u bytes, compress with tools/romlz4.py\n",LZ4_ROM_BLOCK_SIZE);
+			return FR_INT_ERR;
+		}
+		if(w & LZ4_BLOCK_UNCOMPRESSED) {
+			fr=f_read(fil,buf+out,size,&n);
+			len=n;
 		} else {
-			printf("E f_open(%s) error: %s (%d)\n",filename,FRESULT_str(fr),fr);
+			fr=f_read(fil,load_lz4_block,size,&n);
+			len=lz4_block_decompress(load_lz4_block,n,buf+out,LZ4_ROM_BLOCK_SIZE,false);
 		}
-		
-		fr=f_close(&fil);
-		if(fr!=FR_OK) {
-			printf("E f_close error: %s (%d)\n", FRESULT_str(fr), fr);
+		if(fr!=FR_OK) break;
+		if(n!=size || len<0) {
+			printf("E Corrupt LZ4 block\n");
+			return FR_INT_ERR;
+		}
+		out+=len;
+
+		/* Checksums are not verified */
+		if(load_frame.block_checksum) {
+			fr=f_lseek(fil,f_tell(fil)+4);
+			if(fr!=FR_OK) break;
 		}
-		f_unmount(pSD->pcName);
 	}
-	printf("I write_cart_ram_file(%s) COMPLETE (%lu bytes)\n",filename,save_size);
+
+	*br=out;
+	return fr;
 }
 
 /**
- * Load a .gb rom file in flash from the SD card 
+ * Load a .gb rom file in flash from the SD card. Compressed ROMs
+ * (*.gbz, *.gb.lz4) are decompressed on the way.
+ * Sectors that already hold the right data are not erased or programmed,
+ * and if the header shows the same ROM is in flash nothing is written.
  */ 
 void load_cart_rom_file(char *filename) {
 	UINT br;
-	uint8_t buffer[FLASH_SECTOR_SIZE];
+	uint_fast16_t programmed=0, skipped=0;
+	uint32_t rom_size=0;
 	bool mismatch=false;
-	sd_card_t *pSD=sd_get_by_num(0);
-	FRESULT fr=f_mount(&pSD->fatfs,pSD->pcName,1);
-	if (FR_OK!=fr) {
-		printf("E f_mount error: %s (%d)\n",FRESULT_str(fr),fr);
+	FILINFO fno;
+	FRESULT fr;
+	if(!storage_ready()) {
+		return;
+	}
+	fr=f_stat(filename,&fno);
+	if(fr==FR_OK && flash_rom_is_current(filename,&fno)) {
+		printf("I %s is already in flash\n",filename);
 		return;
 	}
 	FIL fil;
 	fr=f_open(&fil,filename,FA_READ);
 	if (fr==FR_OK) {
 		uint32_t flash_target_offset=FLASH_TARGET_OFFSET;
+		uint32_t start_time=time_us_32();
+		uint32_t sd_us=0;
+		uint_fast8_t buffers, in_flight=0, next=0;
+		bool compressed=lz4_is_rom_name(filename);
+		load_lz4_block=NULL;
+		rom_size=compressed ? load_lz4_open(&fil) : f_size(&fil);
+		if(rom_size==0) {
+			free(load_lz4_block);
+			f_close(&fil);
+			return;
+		}
+		#if ENABLE_FLASH_SAVES
+			if(rom_size>SAVE_JOURNAL_OFFSET-FLASH_TARGET_OFFSET) {
+				printf("E %s does not fit below the save journal\n",filename);
+				free(load_lz4_block);
+				f_close(&fil);
+				return;
+			}
+		#endif
+
+		/* rom_bank0 is refilled from flash once the ROM is loaded, so it
+		 * can hold one block. Without room for a second block, reads
+		 * and writes take turns. */
+		load_buffer[0]=rom_bank0;
+		load_buffer[1]=malloc(LOAD_BLOCK_SIZE);
+		buffers=(load_buffer[1]!=NULL) ? 2 : 1;
+
+		/* Invalidate the header first, so that an interrupted load is
+		 * never mistaken for a complete one. */
+		flash_range_erase(FLASH_HEADER_OFFSET,FLASH_SECTOR_SIZE);
+
+		load_flash_us=0;
+		multicore_reset_core1();
+		multicore_launch_core1(load_core1);
+
 		for(;;) {
-			f_read(&fil,buffer,sizeof buffer,&br);
-			if(br==0) break; /* end of file */
+			/* Wait for core1 to finish with this buffer */
+			if(in_flight==buffers) {
+				uint32_t result=multicore_fifo_pop_blocking();
+				programmed+=result & 0xFF;
+				skipped+=(result>>8) & 0xFF;
+				mismatch|=(result>>16) & 1;
+				in_flight--;
+			}
 
-			printf("I Erasing target region...\n");
-			flash_range_erase(flash_target_offset,FLASH_SECTOR_SIZE);
-			printf("I Programming target region...\n");
-			flash_range_program(flash_target_offset,buffer,FLASH_SECTOR_SIZE);
-			
-			/* Read back target region and check programming */
-			printf("I Done. Reading back target region...\n");
-			for(uint32_t i=0;i<FLASH_SECTOR_SIZE;i++) {
-				if(rom[flash_target_offset+i]!=buffer[i]) {
-					mismatch=true;
-				}
+			uint32_t t=time_us_32();
+			if(compressed) {
+				fr=load_lz4_read(&fil,load_buffer[next],&br);
+			} else {
+				fr=f_read(&fil,load_buffer[next],LOAD_BLOCK_SIZE,&br);
+			}
+			sd_us+=time_us_32()-t;
+			if(fr!=FR_OK) {
+				printf("E f_read error: %s (%d)\n",FRESULT_str(fr),fr);
+				mismatch=true;
+				break;
 			}
+			if(br==0) break; /* end of file */
+
+			/* Pad the last sector */
+			uint32_t len=(br+FLASH_SECTOR_SIZE-1) & ~(FLASH_SECTOR_SIZE-1);
+			memset(load_buffer[next]+br,0xFF,len-br);
+
+			multicore_fifo_push_blocking(flash_target_offset);
+			multicore_fifo_push_blocking(next);
+			multicore_fifo_push_blocking(len);
+			in_flight++;
 
-			/* Next sector */
-			flash_target_offset+=FLASH_SECTOR_SIZE;
+			/* Next block */
+			flash_target_offset+=len;
+			next=(next+1)%buffers;
 		}
+		while(in_flight>0) {
+			uint32_t result=multicore_fifo_pop_blocking();
+			programmed+=result & 0xFF;
+			skipped+=(result>>8) & 0xFF;
+			mismatch|=(result>>16) & 1;
+			in_flight--;
+		}
+		multicore_reset_core1();
+		free(load_buffer[1]);
+		free(load_lz4_block);
+
+		uint32_t total_us=time_us_32()-start_time;
+		uint32_t rate=total_us ? (uint32_t)(((uint64_t)rom_size*100)/total_us) : 0;
+		printf("I Loaded %lu bytes in %lu ms, %lu.%02lu MB/s (SD %lu ms, flash %lu ms)\n",
+			rom_size,total_us/1000,rate/100,rate%100,sd_us/1000,load_flash_us/1000);
+
 		if(mismatch) {
-	        printf("I Programming successful!\n");
-		} else {
 			printf("E Programming failed!\n");
+		} else {
+			/* Record what is now in flash */
+			struct flash_rom_header hdr;
+			memset(&hdr,0xFF,sizeof hdr);
+			hdr.magic=FLASH_HEADER_MAGIC;
+			hdr.size=fno.fsize;
+			hdr.date_time=(uint32_t)fno.fdate<<16 | fno.ftime;
+			hdr.flashed=flash_target_offset-FLASH_TARGET_OFFSET;
+			hdr.crc=flash_crc32(FLASH_TARGET_OFFSET,hdr.flashed);
+			strncpy(hdr.name,filename,sizeof hdr.name);
+			flash_range_program(FLASH_HEADER_OFFSET,(const uint8_t *)&hdr,sizeof hdr);
+			printf("I Programming successful! %u sectors written, %u unchanged\n",programmed,skipped);
 		}
 	} else {
 		printf("E f_open(%s) error: %s (%d)\n",filename,FRESULT_str(fr),fr);
+		storage_error(fr);
 	}
 	
 	fr=f_close(&fil);
 	if(fr!=FR_OK) {
 		printf("E f_close error: %s (%d)\n", FRESULT_str(fr), fr);
 	}
-	f_unmount(pSD->pcName);
 
-	printf("I load_cart_rom_file(%s) COMPLETE (%lu bytes)\n",filename,br);
+	printf("I load_cart_rom_file(%s) COMPLETE (%lu bytes)\n",filename,rom_size);
 }
+#endif
 
 /**
  * Function used by the rom file selector to display one page of .gb rom files
  */
-uint16_t rom_file_selector_display_page(char filename[22][256],uint16_t num_page) {
-	sd_card_t *pSD=sd_get_by_num(0);
-    DIR dj;
-    FILINFO fno;
-    FRESULT fr;
-
-    fr=f_mount(&pSD->fatfs,pSD->pcName,1);
-    if (FR_OK!=fr) {
-        printf("E f_mount error: %s (%d)\n",FRESULT_str(fr),fr);
-        return 0;
-    }
+uint16_t rom_file_selector_display_page(char filename[22][ROM_CATALOG_NAME_LEN],uint16_t num_page) {
+	struct rom_catalog_entry entry;
 
 	/* clear the filenames array */
 	for(uint8_t ifile=0;ifile<22;ifile++) {
 		strcpy(filename[ifile],"");
 	}
 
-    /* search *.gb files */
+	/* store the filenames of this page from the catalogue */
 	uint16_t num_file=0;
-	fr=f_findfirst(&dj, &fno, "\\gb", "*.gb");
-
-	/* skip the first N pages */
-	if(num_page>0) {
-		while(num_file<num_page*22 && fr == FR_OK && fno.fname[0]) {
-			num_file++;
-			fr=f_findnext(&dj, &fno);
-		}
+	while(num_file<22 && rom_catalog_get(num_page*22+num_file,&entry)) {
+		strcpy(filename[num_file],entry.name);
+		num_file++;
 	}
 
-	/* store the filenames of this page */
-	num_file=0;
-    while(num_file<22 && fr == FR_OK && fno.fname[0]) {
-		strcpy(filename[num_file],fno.fname);
-        num_file++;
-        fr=f_findnext(&dj, &fno);
-    }
-	f_closedir(&dj);
-	f_unmount(pSD->pcName);
-
 	/* display *.gb rom files on screen */
 	st7789_fill(0x0000);
 	for(uint8_t ifile=0;ifile<num_file;ifile++) {
@@ -820,19 +1899,26 @@ uint16_t rom_file_selector_display_page(char filename[22][256],uint16_t num_page
 /**
  * The ROM selector displays pages of up to 22 rom files
  * allowing the user to select which rom file to start
- * Copy your *.gb rom files to the root directory of the SD card
+ * Copy your *.gb rom files to the gb directory of the SD card
  */
 void rom_file_selector() {
-    uint16_t num_page;
-	char filename[22][256];
+    uint16_t num_page=0;
+	char filename[22][ROM_CATALOG_NAME_LEN];
 	uint16_t num_file;
-	
+
+	/* list the roms once, rebuilding the catalogue if they have changed */
+	bool listed=rom_catalog_open();
+
 	/* display the first page with up to 22 rom files */
 	num_file=rom_file_selector_display_page(filename,num_page);
 
 	/* select the first rom */
 	uint8_t selected=0;
-	st7789_text(filename[selected],0,selected*8,0xFFFF,0xF800);
+	if(listed) {
+		st7789_text(filename[selected],0,selected*8,0xFFFF,0xF800);
+	} else {
+		st7789_text("SD card error",0,0,0xFFFF,0xF800);
+	}
 
 	/* get user's input */
 	bool up,down,left,right,a,b,select,start;
@@ -847,11 +1933,35 @@ void rom_file_selector() {
 		start=gpio_get(GPIO_START);
 		if(!start) {
 			/* re-start the last game (no need to reprogram flash) */
+			#if ENABLE_ROM_PAGING
+				if(!rom_cache_reopen()) { sleep_ms(150); continue; }
+			#endif
 			break;
 		}
-		if(!a | !b) {
-			/* copy the rom from the SD card to flash and start the game */
-			load_cart_rom_file(strcat("\\gb\\", filename[selected]));
+		if(!listed && (!a || !b || !select || !up || !down || !left || !right)) {
+			/* try again, in case a card has been inserted */
+			listed=rom_catalog_open();
+			num_file=rom_file_selector_display_page(filename,num_page);
+			if(listed) {
+				st7789_text(filename[selected],0,selected*8,0xFFFF,0xF800);
+			} else {
+				st7789_text("SD card error",0,0,0xFFFF,0xF800);
+			}
+			sleep_ms(150);
+			continue;
+		}
+		if((!a | !b) && num_file>0) {
+			struct rom_catalog_entry entry;
+			char path[sizeof ROM_CATALOG_DIR + FF_LFN_BUF + 2];
+			if(!rom_catalog_get(num_page*22+selected,&entry)) { sleep_ms(150); continue; }
+			rom_catalog_path(&entry,path,sizeof path);
+			#if ENABLE_ROM_PAGING
+				/* open the rom on the SD card and start the game */
+				if(!rom_cache_open(path)) { sleep_ms(150); continue; }
+			#else
+				/* copy the rom from the SD card to flash and start the game */
+				load_cart_rom_file(path);
+			#endif
 			break;
 		}
 		if(!down) {
@@ -873,15 +1983,10 @@ void rom_file_selector() {
 			st7789_text(filename[selected],0,selected*8,0xFFFF,0xF800);
 			sleep_ms(150);
 		}
-		if(!right) {
+		if((!right) && (num_page+1)*22<rom_catalog_count()) {
 			/* select the next page */
 			num_page++;
 			num_file=rom_file_selector_display_page(filename,num_page);
-			if(num_file==0) {
-				/* no files in this page, go to the previous page */
-				num_page--;
-				num_file=rom_file_selector_display_page(filename,num_page);
-			}
 			/* select the first file */
 			selected=0;
 			st7789_text(filename[selected],0,selected*8,0xFFFF,0xF800);
@@ -898,6 +2003,7 @@ void rom_file_selector() {
 		}
 		tight_loop_contents();
 	}
+	rom_catalog_close();
 }
 
 #endif
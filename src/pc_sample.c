@@ -0,0 +1,160 @@
+/**
+ * Timer interrupt sampling of the emulated program counter.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <pico/stdlib.h>
+#include <pico/time.h>
+#include <hardware/sync.h>
+
+#include "pc_sample.h"
+#include "telemetry.h"
+
+#if PC_SAMPLING
+
+/* Buckets tried before a sample is dropped. */
+#define PROBES		8
+#define KEY_USED	0x80000000u
+
+struct bucket {
+	uint32_t key;						// KEY_USED | bank << 16 | address, or 0
+	uint32_t count;
+};
+
+volatile bool pc_sample_running;
+
+static struct bucket buckets[PC_SAMPLE_BUCKETS];
+static uint32_t samples;					// Counted in the table
+static uint32_t idle;						// Taken while not emulating
+static uint32_t dropped;					// Found no free bucket
+static const volatile uint16_t *sample_pc;
+static const volatile uint16_t *sample_bank;
+static repeating_timer_t timer;
+static bool timer_added;
+
+/* Busiest addresses of the last dump, printed by core1. */
+static struct bucket top[PC_SAMPLE_TOP];
+static uint32_t top_samples;
+
+static bool sample(repeating_timer_t *t)
+{
+	uint32_t pc, key, h;
+
+	(void)t;
+	if(!pc_sample_running)
+	{
+		idle++;
+		return true;
+	}
+
+	/* Only the switchable bank tells routines at the same address apart. */
+	pc = *sample_pc;
+	key = KEY_USED | pc;
+	if(pc >= 0x4000 && pc < 0x8000)
+		key |= (uint32_t)*sample_bank << 16;
+
+	h = (key * 2654435761u) >> 16;
+	for(uint_fast8_t i = 0; i < PROBES; i++)
+	{
+		struct bucket *b = &buckets[(h + i) & (PC_SAMPLE_BUCKETS - 1)];
+
+		if(b->key == 0)
+			b->key = key;
+		else if(b->key != key)
+			continue;
+
+		b->count++;
+		samples++;
+		return true;
+	}
+
+	dropped++;
+	return true;
+}
+
+static void clear(void)
+{
+	memset(buckets, 0, sizeof(buckets));
+	samples = 0;
+	idle = 0;
+	dropped = 0;
+}
+
+void pc_sample_start(const volatile uint16_t *pc, const volatile uint16_t *bank)
+{
+	pc_sample_stop();
+	clear();
+	sample_pc = pc;
+	sample_bank = bank;
+
+	/* A negative delay keeps the period from drifting with the callback. */
+	timer_added = add_repeating_timer_us(-PC_SAMPLE_PERIOD_US, sample, NULL, &timer);
+	if(!timer_added)
+		puts("E PC sampling timer not available");
+}
+
+void pc_sample_stop(void)
+{
+	if(timer_added)
+		cancel_repeating_timer(&timer);
+
+	timer_added = false;
+	pc_sample_running = false;
+}
+
+/**
+ * Core1: print entry "i" of the top table.
+ */
+static uint32_t print_top(uint32_t i)
+{
+	const struct bucket *b = &top[i];
+	const uint32_t permille = (uint32_t)((uint64_t)b->count * 1000 / top_samples);
+
+	printf("%3lu:%04lX %8lu %3lu.%lu%%\n",
+		(unsigned long)((b->key >> 16) & 0x1FF), (unsigned long)(b->key & 0xFFFF),
+		(unsigned long)b->count, (unsigned long)(permille / 10),
+		(unsigned long)(permille % 10));
+	return i + 1;
+}
+
+bool pc_sample_dump(void)
+{
+	uint32_t n = 0;
+	uint32_t saved;
+
+	if(!timer_added || telemetry_printing())
+		return false;
+
+	/* The sampling interrupt runs on this core, so at worst a count is one
+	 * short of the table's. */
+	for(uint_fast16_t i = 0; i < PC_SAMPLE_BUCKETS; i++)
+	{
+		const struct bucket b = buckets[i];
+		uint32_t pos;
+
+		if(b.count == 0 || (n == PC_SAMPLE_TOP && b.count <= top[n - 1].count))
+			continue;
+
+		pos = (n < PC_SAMPLE_TOP) ? n++ : n - 1;
+		for(; pos > 0 && top[pos - 1].count < b.count; pos--)
+			top[pos] = top[pos - 1];
+		top[pos] = b;
+	}
+
+	top_samples = samples;
+	printf("# pc samples: %lu emulating, %lu idle, %lu dropped\n",
+		(unsigned long)samples, (unsigned long)idle, (unsigned long)dropped);
+	puts("# bank:addr  samples  share");
+
+	saved = save_and_disable_interrupts();
+	clear();
+	restore_interrupts(saved);
+
+	return telemetry_print(print_top, 0, n, NULL);
+}
+
+#endif
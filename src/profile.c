@@ -0,0 +1,74 @@
+/**
+ * Per-frame totals of the profiled spans.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "profile.h"
+
+#if PROFILING
+
+struct profile_totals profile_running[2];
+
+static const char *const names[PROFILE_COUNT] = {
+	[PROFILE_CPU]		= "cpu",
+	[PROFILE_PPU_LINE]	= "ppu line",
+	[PROFILE_LCD_QUEUE]	= "lcd queue",
+	[PROFILE_LCD_SEND]	= "lcd send",
+	[PROFILE_APU]		= "apu",
+	[PROFILE_ROM_BANK]	= "rom bank",
+	[PROFILE_STORAGE]	= "storage",
+};
+
+static struct profile_totals seen[2];				// Running totals at the last frame
+static struct profile_totals last[2];				// Totals of the last frame
+static uint32_t max_us[2][PROFILE_COUNT];			// Largest frame total since the report
+static uint32_t frames;
+
+void profile_frame(void)
+{
+	for(uint_fast8_t c = 0; c < 2; c++)
+	{
+		for(uint_fast8_t i = 0; i < PROFILE_COUNT; i++)
+		{
+			/* Core1 may be adding to its totals meanwhile. Any span
+			 * that is missed counts towards the next frame. */
+			const uint32_t us = __atomic_load_n(&profile_running[c].us[i], __ATOMIC_RELAXED);
+			const uint32_t calls = __atomic_load_n(&profile_running[c].calls[i], __ATOMIC_RELAXED);
+
+			last[c].us[i] = us - seen[c].us[i];
+			last[c].calls[i] = calls - seen[c].calls[i];
+			seen[c].us[i] = us;
+			seen[c].calls[i] = calls;
+
+			if(last[c].us[i] > max_us[c][i])
+				max_us[c][i] = last[c].us[i];
+		}
+	}
+
+	frames++;
+}
+
+void profile_report(void)
+{
+	printf("Profile over %lu frames, last frame / worst frame:\n", (unsigned long)frames);
+	for(uint_fast8_t c = 0; c < 2; c++)
+	{
+		for(uint_fast8_t i = 0; i < PROFILE_COUNT; i++)
+		{
+			if(max_us[c][i] == 0 && last[c].calls[i] == 0)
+				continue;
+
+			printf("  core%u %-10s %6lu us %6lu calls / %6lu us\n",
+				c, names[i], (unsigned long)last[c].us[i],
+				(unsigned long)last[c].calls[i], (unsigned long)max_us[c][i]);
+		}
+	}
+
+	memset(max_us, 0, sizeof(max_us));
+	frames = 0;
+}
+
+#endif
@@ -0,0 +1,480 @@
+/**
+ * Demand paged ROM banks read from the SD card into an LRU cache.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <pico/stdlib.h>
+
+#include "ff.h"
+#include "f_util.h"
+#include "storage.h"
+#include "lz4_frame.h"
+#include "rom_cache.h"
+#include "profile.h"
+#include "sram.h"
+
+/* Entries in the fast seek cluster link map. Enough for a ROM split into
+ * (ROM_CACHE_CLMT_SIZE / 2) - 1 fragments. */
+#define ROM_CACHE_CLMT_SIZE	64
+
+#define NO_SLOT			0xFF
+#define NO_BANK			0xFFFF
+
+uint8_t rom_cache_bank0[ROM_CACHE_BANK_SIZE];
+/* Read on every access to the switchable bank. */
+uint_fast16_t rom_cache_bank CORE0_DATA("rom_cache");
+const uint8_t *rom_cache_slot CORE0_DATA("rom_cache");
+
+static uint8_t slots[ROM_CACHE_SLOTS][ROM_CACHE_BANK_SIZE];
+static uint16_t slot_bank[ROM_CACHE_SLOTS];			// Bank held in each slot
+static uint32_t slot_used[ROM_CACHE_SLOTS];			// Last time each slot was selected
+static uint8_t bank_slot[ROM_CACHE_MAX_BANKS];			// Slot holding each bank
+static uint32_t use_count;
+
+/* Bank being read ahead into a slot by the SD card, set from the interrupt
+ * that finishes the read. While it is in progress the slot holds no bank. */
+static uint_fast16_t pending_bank = NO_BANK;
+static uint_fast8_t pending_slot;
+static volatile bool pending_busy;
+static volatile bool pending_ok;
+
+static FIL fil;
+static bool fil_open = false;
+static uint32_t fil_mount;					// storage_mount_count() when opened
+static DWORD clmt[ROM_CACHE_CLMT_SIZE];
+static char rom_path[FF_MAX_LFN + 8];
+static struct rom_cache_stats stats;
+
+/* For a compressed ROM, where each bank's LZ4 block starts in the file, and
+ * its size with bit 15 set if it is stored uncompressed. */
+static bool compressed;
+static uint32_t block_offset[ROM_CACHE_MAX_BANKS];
+static uint16_t block_size[ROM_CACHE_MAX_BANKS];
+static uint_fast16_t block_count;
+static uint32_t rom_size;
+static uint8_t *block_buf;
+
+#define BLOCK_STORED		0x8000
+
+static bool open_file(void);
+
+/**
+ * Returns true if the ROM file is open on the current mount of the card,
+ * opening it again if the card has been remounted since.
+ */
+static bool file_ready(void)
+{
+	if(!storage_ready())
+		return false;
+
+	if(fil_open && fil_mount == storage_mount_count())
+		return true;
+
+	/* The remount invalidated the old file object. */
+	fil_open = false;
+	return open_file();
+}
+
+/**
+ * Read "bank" from the open ROM file into "dst", setting "read" to the
+ * number of bytes read.
+ */
+static FRESULT try_read_bank(uint_fast16_t bank, uint8_t *dst, UINT *read)
+{
+	UINT br = 0;
+	FRESULT fr = FR_OK;
+
+	if(compressed)
+	{
+		if(bank < block_count)
+		{
+			const UINT size = block_size[bank] & ~BLOCK_STORED;
+			const bool stored = (block_size[bank] & BLOCK_STORED) != 0;
+
+			fr = f_lseek(&fil, block_offset[bank]);
+			if(fr == FR_OK)
+				fr = f_read(&fil, stored ? dst : block_buf, size, &br);
+			if(fr == FR_OK && !stored)
+			{
+				const int32_t n = lz4_block_decompress(block_buf, br, dst,
+					ROM_CACHE_BANK_SIZE, false);
+
+				if(n < 0)
+					printf("E rom_cache bank %u: corrupt LZ4 block\n", bank);
+				br = (n < 0) ? 0 : n;
+			}
+		}
+	}
+	else
+	{
+		fr = f_lseek(&fil, (FSIZE_t)bank * ROM_CACHE_BANK_SIZE);
+		if(fr == FR_OK)
+			fr = f_read(&fil, dst, ROM_CACHE_BANK_SIZE, &br);
+	}
+
+	*read = br;
+	return fr;
+}
+
+/**
+ * Read "bank" from the ROM file into "dst". Anything past the end of the
+ * file, or that could not be read, reads as 0xFF.
+ */
+static void read_bank(uint_fast16_t bank, uint8_t *dst)
+{
+	UINT br = 0;
+	FRESULT fr = FR_NOT_READY;
+
+	/* An error may mean the card was lost, so it is remounted, the file
+	 * opened again and the read tried once more. */
+	for(uint_fast8_t tries = 0; tries < 2; tries++)
+	{
+		br = 0;
+		fr = file_ready() ? try_read_bank(bank, dst, &br) : FR_NOT_READY;
+		if(fr == FR_OK)
+			break;
+
+		printf("E rom_cache bank %u: %s (%d)\n", bank, FRESULT_str(fr), fr);
+		storage_error(fr);
+		if(fr == FR_INVALID_OBJECT)
+			fil_open = false;
+		else if(fr != FR_DISK_ERR)
+			break;
+	}
+
+	memset(dst + br, 0xFF, ROM_CACHE_BANK_SIZE - br);
+}
+
+/**
+ * Find the block holding each bank of the compressed ROM in the open file.
+ * Every block must hold one bank, as written by tools/romlz4.py.
+ */
+static bool index_blocks(void)
+{
+	uint8_t header[LZ4_FRAME_HEADER_MAX];
+	struct lz4_frame frame;
+	FSIZE_t pos;
+	UINT br;
+	FRESULT fr;
+
+	fr = f_read(&fil, header, sizeof(header), &br);
+	if(fr != FR_OK || !lz4_frame_parse(header, br, &frame))
+	{
+		printf("E %s is not a supported LZ4 frame\n", rom_path);
+		return false;
+	}
+
+	if(block_buf == NULL)
+		block_buf = malloc(LZ4_ROM_BLOCK_SIZE);
+	if(block_buf == NULL)
+	{
+		printf("E rom_cache: no memory for LZ4 blocks\n");
+		return false;
+	}
+
+	block_count = 0;
+	pos = frame.header_size;
+	for(;;)
+	{
+		uint8_t word[4];
+		uint32_t w, size;
+
+		fr = f_lseek(&fil, pos);
+		if(fr == FR_OK)
+			fr = f_read(&fil, word, sizeof(word), &br);
+		if(fr != FR_OK || br != sizeof(word))
+			break;
+
+		w = word[0] | (word[1] << 8) | (word[2] << 16) | ((uint32_t)word[3] << 24);
+		if(w == 0)
+			break;					// End mark
+
+		size = w & ~LZ4_BLOCK_UNCOMPRESSED;
+		if(size > LZ4_ROM_BLOCK_SIZE || block_count == ROM_CACHE_MAX_BANKS)
+		{
+			printf("E %s has blocks larger than a bank, compress it with tools/romlz4.py\n",
+				rom_path);
+			return false;
+		}
+
+		block_offset[block_count] = pos + 4;
+		block_size[block_count] = size |
+			((w & LZ4_BLOCK_UNCOMPRESSED) ? BLOCK_STORED : 0);
+		block_count++;
+		pos += 4 + size + (frame.block_checksum ? 4 : 0);
+	}
+
+	/* Blocks of more than a bank would decode short. */
+	rom_size = frame.content_size;
+	if(rom_size == 0 || rom_size > (uint32_t)block_count * ROM_CACHE_BANK_SIZE ||
+		rom_size <= (uint32_t)(block_count - 1) * ROM_CACHE_BANK_SIZE)
+	{
+		printf("E %s has blocks larger than a bank, compress it with tools/romlz4.py\n",
+			rom_path);
+		return false;
+	}
+
+	return fr == FR_OK;
+}
+
+static void prefetch_done(bool ok, void *context)
+{
+	(void)context;
+	pending_ok = ok;
+	pending_busy = false;
+}
+
+/**
+ * Take the bank read ahead into the cache once its read has finished. If
+ * "wait" is set, wait for it to finish first. Returns true if no read is
+ * left in progress.
+ */
+static bool finish_prefetch(bool wait)
+{
+	if(pending_bank == NO_BANK)
+		return true;
+
+	if(pending_busy)
+	{
+		if(!wait)
+			return false;
+
+		while(pending_busy)
+			tight_loop_contents();
+	}
+
+	/* A failed read leaves the slot empty, to be read again when the bank
+	 * is used. */
+	if(pending_ok)
+	{
+		slot_bank[pending_slot] = pending_bank;
+		bank_slot[pending_bank] = pending_slot;
+	}
+	else
+		printf("E rom_cache bank %u: read ahead failed\n", pending_bank);
+
+	pending_bank = NO_BANK;
+	return true;
+}
+
+/**
+ * Returns the slot to read a bank into, the least recently used one, and
+ * drops the bank it held. Empty slots have never been used, so are taken
+ * first. A bank read ahead but not used yet keeps the age of the bank it
+ * replaced, so a bank number the game only passed through is the next to go.
+ */
+static uint_fast8_t evict(void)
+{
+	uint_fast8_t slot = 0;
+
+	for(uint_fast8_t i = 1; i < ROM_CACHE_SLOTS; i++)
+	{
+		if(slot_used[i] < slot_used[slot])
+			slot = i;
+	}
+
+	if(slot_bank[slot] != NO_BANK)
+		bank_slot[slot_bank[slot]] = NO_SLOT;
+	slot_bank[slot] = NO_BANK;
+
+	return slot;
+}
+
+/**
+ * Start reading "bank" into the cache without waiting for it. Only done for
+ * an uncompressed ROM whose bank is contiguous on the card, and only if the
+ * card is free.
+ */
+static void prefetch(uint_fast16_t bank)
+{
+	const FSIZE_t offset = (FSIZE_t)bank * ROM_CACHE_BANK_SIZE;
+	uint_fast8_t slot;
+	LBA_t lba;
+
+	if(!fil_open || fil_mount != storage_mount_count() || compressed ||
+		offset + ROM_CACHE_BANK_SIZE > rom_size || !finish_prefetch(false))
+		return;
+
+	lba = storage_file_lba(&fil, offset, ROM_CACHE_BANK_SIZE);
+	if(lba == 0)
+		return;
+
+	slot = evict();
+	pending_bank = bank;
+	pending_slot = slot;
+	pending_busy = true;
+	if(!storage_read_async(lba, slots[slot], ROM_CACHE_BANK_SIZE / STORAGE_SECTOR_SIZE,
+		prefetch_done, NULL))
+	{
+		pending_busy = false;
+		pending_bank = NO_BANK;
+		return;
+	}
+
+	stats.prefetches++;
+}
+
+/**
+ * Open the ROM file at rom_path, set up fast seek and, for a compressed ROM,
+ * index its blocks. The card must be mounted.
+ */
+static bool open_file(void)
+{
+	FRESULT fr;
+
+	fr = f_open(&fil, rom_path, FA_READ);
+	if(fr != FR_OK)
+	{
+		printf("E f_open(%s) error: %s (%d)\n", rom_path, FRESULT_str(fr), fr);
+		storage_error(fr);
+		return false;
+	}
+	fil_open = true;
+	fil_mount = storage_mount_count();
+
+	/* Use fast seek, so seeking to a bank is done from the link map
+	 * instead of by following the FAT. */
+	fil.cltbl = clmt;
+	clmt[0] = ROM_CACHE_CLMT_SIZE;
+	fr = f_lseek(&fil, CREATE_LINKMAP);
+	if(fr != FR_OK)
+	{
+		printf("W fast seek unavailable for %s: %s (%d)\n", rom_path, FRESULT_str(fr), fr);
+		fil.cltbl = NULL;
+	}
+
+	/* A compressed ROM is read a block at a time, from an index of where
+	 * each bank's block starts. */
+	compressed = lz4_is_rom_name(rom_path);
+	rom_size = f_size(&fil);
+	if(compressed && !index_blocks())
+	{
+		f_close(&fil);
+		fil_open = false;
+		return false;
+	}
+
+	if(rom_size > (uint32_t)ROM_CACHE_MAX_BANKS * ROM_CACHE_BANK_SIZE)
+		printf("W %s is larger than %u banks\n", rom_path, ROM_CACHE_MAX_BANKS);
+
+	return true;
+}
+
+bool rom_cache_open(const char *path)
+{
+	if(path != rom_path)
+	{
+		strncpy(rom_path, path, sizeof(rom_path) - 1);
+		rom_path[sizeof(rom_path) - 1] = '\0';
+	}
+
+	/* The slot being read into is about to be dropped. */
+	finish_prefetch(true);
+
+	if(fil_open)
+	{
+		f_close(&fil);
+		fil_open = false;
+	}
+
+	/* Drop the cached banks. */
+	memset(bank_slot, NO_SLOT, sizeof(bank_slot));
+	for(uint_fast8_t i = 0; i < ROM_CACHE_SLOTS; i++)
+	{
+		slot_bank[i] = NO_BANK;
+		slot_used[i] = 0;
+	}
+	use_count = 0;
+	rom_cache_bank = 0;
+	rom_cache_slot = NULL;
+	stats.misses = 0;
+	stats.miss_us = 0;
+	stats.prefetches = 0;
+
+	if(!storage_ready() || !open_file())
+		return false;
+
+	read_bank(0, rom_cache_bank0);
+	printf("I rom_cache_open(%s) COMPLETE (%lu bytes%s)\n", rom_path, rom_size,
+		compressed ? ", compressed" : "");
+	return true;
+}
+
+bool rom_cache_reopen(void)
+{
+	if(rom_path[0] == '\0')
+		return false;
+
+	return rom_cache_open(rom_path);
+}
+
+/**
+ * Make "slot" the current bank's.
+ */
+static void use_slot(uint_fast16_t bank, uint_fast8_t slot)
+{
+	slot_used[slot] = ++use_count;
+	rom_cache_bank = bank;
+	rom_cache_slot = slots[slot];
+}
+
+void rom_cache_select(uint_fast16_t bank)
+{
+	/* Bank 0 is always in RAM. */
+	if(bank == 0 || bank == rom_cache_bank)
+		return;
+
+	if(bank >= ROM_CACHE_MAX_BANKS)
+		bank &= ROM_CACHE_MAX_BANKS - 1;
+
+	/* The game may set the bank number a part at a time, so only read the
+	 * bank ahead here. It is made current when it is first read from. */
+	finish_prefetch(false);
+	if(bank_slot[bank] == NO_SLOT && bank != pending_bank)
+		prefetch(bank);
+}
+
+void rom_cache_load(uint_fast16_t bank)
+{
+	uint_fast8_t slot;
+	uint32_t start;
+
+	if(bank >= ROM_CACHE_MAX_BANKS)
+		bank &= ROM_CACHE_MAX_BANKS - 1;
+
+	finish_prefetch(false);
+	slot = bank_slot[bank];
+	if(slot == NO_SLOT)
+	{
+		/* The card can only do one read at a time, so whether or not
+		 * the read ahead is of this bank, it has to finish first. */
+		PROFILE_BEGIN(PROFILE_ROM_BANK);
+		start = time_us_32();
+		finish_prefetch(true);
+
+		slot = bank_slot[bank];
+		if(slot == NO_SLOT)
+		{
+			slot = evict();
+			read_bank(bank, slots[slot]);
+			stats.misses++;
+
+			slot_bank[slot] = bank;
+			bank_slot[bank] = slot;
+		}
+		stats.miss_us += time_us_32() - start;
+		PROFILE_END(PROFILE_ROM_BANK);
+	}
+
+	use_slot(bank, slot);
+}
+
+void rom_cache_get_stats(struct rom_cache_stats *s)
+{
+	*s = stats;
+}
@@ -0,0 +1,615 @@
+/**
+ * Catalogue of the ROMs on the SD card, kept in a file next to them.
+ */
+
+#include <ctype.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include <pico/stdlib.h>
+
+#include "ff.h"
+#include "f_util.h"
+#include "storage.h"
+#include "lz4_frame.h"
+#include "rom_catalog.h"
+
+#define ROM_CATALOG_MAGIC	0x58444E49	/* "INDX" */
+#define ROM_CATALOG_VERSION	2
+
+/* Leading characters of the name compared when sorting. Names that share
+ * them are put in order from the full names afterwards. */
+#define SORT_KEY_LEN		12
+
+/* Cartridge header fields read from each ROM. */
+#define HEADER_START		0x134
+#define HEADER_END		0x150
+
+/* Bytes of the first block of a compressed ROM read to decode its header. */
+#define LZ4_PREFIX		512
+
+struct rom_catalog_header {
+	uint32_t magic;
+	uint16_t version;
+	uint16_t count;				// Records in the file
+	uint32_t dir_date_time;			// Timestamp of ROM_CATALOG_DIR
+	uint32_t dir_hash;			// Hash of the names, sizes and timestamps of the ROMs
+};
+
+struct sort_key {
+	char key[SORT_KEY_LEN];
+	uint16_t record;
+};
+
+static FIL fil;
+static bool fil_open = false;
+static uint16_t *order;
+static uint16_t count;
+
+/* Without a catalogue file, as on a full or write-protected card, ROMs are
+ * found by walking the directory, in directory order. */
+static bool walking = false;
+static DIR walk_dir;
+static bool walk_open = false;
+static uint16_t walk_next;					// Index of the next ROM in walk_dir
+
+static FSIZE_t record_offset(uint16_t record)
+{
+	return sizeof(struct rom_catalog_header) +
+		(FSIZE_t)record * sizeof(struct rom_catalog_entry);
+}
+
+static bool read_record(uint16_t record, struct rom_catalog_entry *entry)
+{
+	UINT br;
+	FRESULT fr;
+
+	fr = f_lseek(&fil, record_offset(record));
+	if(fr == FR_OK)
+		fr = f_read(&fil, entry, sizeof(*entry), &br);
+
+	if(fr != FR_OK || br != sizeof(*entry))
+	{
+		printf("E rom_catalog record %u: %s (%d)\n", record, FRESULT_str(fr), fr);
+		return false;
+	}
+
+	return true;
+}
+
+/**
+ * FNV-1a over the fields of a directory entry that change when a ROM is
+ * added, removed, renamed or replaced.
+ */
+static uint32_t hash_entry(uint32_t h, const FILINFO *fno)
+{
+	const uint32_t fields[2] = {
+		(uint32_t)fno->fsize,
+		((uint32_t)fno->fdate << 16) | fno->ftime
+	};
+	const uint8_t *p;
+
+	for(p = (const uint8_t *)fno->fname; *p; p++)
+		h = (h ^ *p) * 16777619u;
+
+	p = (const uint8_t *)fields;
+	for(size_t i = 0; i < sizeof(fields); i++)
+		h = (h ^ p[i]) * 16777619u;
+
+	return h;
+}
+
+/**
+ * Returns true for the directory entries listed: files named *.gb, or
+ * compressed ROMs.
+ */
+static bool is_rom(const FILINFO *fno)
+{
+	const size_t len = strlen(fno->fname);
+
+	if(fno->fattrib & AM_DIR)
+		return false;
+
+	return (len > 3 && strcasecmp(fno->fname + len - 3, ".gb") == 0) ||
+		lz4_is_rom_name(fno->fname);
+}
+
+/**
+ * Fill in the directory timestamp, ROM count and hash that a catalogue of
+ * the current directory must have. Only reads the directory.
+ */
+static bool scan_dir(struct rom_catalog_header *h)
+{
+	DIR dj;
+	FILINFO fno;
+	FRESULT fr;
+
+	memset(h, 0, sizeof(*h));
+	h->magic = ROM_CATALOG_MAGIC;
+	h->version = ROM_CATALOG_VERSION;
+	h->dir_hash = 2166136261u;
+
+	fr = f_stat(ROM_CATALOG_DIR, &fno);
+	if(fr != FR_OK)
+	{
+		printf("E f_stat(%s) error: %s (%d)\n", ROM_CATALOG_DIR, FRESULT_str(fr), fr);
+		return false;
+	}
+	h->dir_date_time = ((uint32_t)fno.fdate << 16) | fno.ftime;
+
+	fr = f_findfirst(&dj, &fno, ROM_CATALOG_DIR, ROM_CATALOG_PATTERN);
+	while(fr == FR_OK && fno.fname[0] && h->count < ROM_CATALOG_MAX_ENTRIES)
+	{
+		if(is_rom(&fno))
+		{
+			h->dir_hash = hash_entry(h->dir_hash, &fno);
+			h->count++;
+		}
+		fr = f_findnext(&dj, &fno);
+	}
+	f_closedir(&dj);
+
+	return fr == FR_OK;
+}
+
+/**
+ * Read the cartridge header of the compressed ROM open in "rom" by decoding
+ * the start of its first block. Sets the decompressed size in "entry".
+ */
+static bool read_lz4_header(FIL *rom, struct rom_catalog_entry *entry,
+	uint8_t header[HEADER_END - HEADER_START])
+{
+	static uint8_t src[LZ4_PREFIX];
+	static uint8_t dst[HEADER_END];
+	struct lz4_frame frame;
+	uint32_t w, size;
+	int32_t n;
+	UINT br;
+
+	if(f_read(rom, src, sizeof(src), &br) != FR_OK ||
+		!lz4_frame_parse(src, br, &frame) || frame.content_size == 0 ||
+		br < frame.header_size + 4)
+		return false;
+
+	entry->size = frame.content_size;
+
+	w = src[frame.header_size] | (src[frame.header_size + 1] << 8) |
+		(src[frame.header_size + 2] << 16) |
+		((uint32_t)src[frame.header_size + 3] << 24);
+	size = w & ~LZ4_BLOCK_UNCOMPRESSED;
+	if(size > br - frame.header_size - 4)
+		size = br - frame.header_size - 4;
+
+	if(w & LZ4_BLOCK_UNCOMPRESSED)
+	{
+		n = (size < sizeof(dst)) ? size : sizeof(dst);
+		memcpy(dst, src + frame.header_size + 4, n);
+	}
+	else
+	{
+		n = lz4_block_decompress(src + frame.header_size + 4, size, dst,
+			sizeof(dst), true);
+	}
+
+	if(n < HEADER_END)
+		return false;
+
+	memcpy(header, dst + HEADER_START, HEADER_END - HEADER_START);
+	return true;
+}
+
+/**
+ * Fill in the fields of the record for the ROM described by "fno" that come
+ * from its directory entry.
+ */
+static void name_record(const FILINFO *fno, struct rom_catalog_entry *entry)
+{
+	memset(entry, 0, sizeof(*entry));
+
+	strncpy(entry->name, fno->fname, sizeof(entry->name) - 1);
+	if(strlen(fno->fname) >= sizeof(entry->name))
+		entry->flags |= ROM_CATALOG_TRUNCATED;
+	strncpy(entry->altname, fno->altname, sizeof(entry->altname) - 1);
+	if(lz4_is_rom_name(fno->fname))
+		entry->flags |= ROM_CATALOG_COMPRESSED;
+	entry->size = fno->fsize;
+}
+
+/**
+ * Fill in the record for the ROM described by "fno", reading its cartridge
+ * header.
+ */
+static void make_record(const FILINFO *fno, struct rom_catalog_entry *entry)
+{
+	char path[sizeof(ROM_CATALOG_DIR) + FF_LFN_BUF + 2];
+	uint8_t header[HEADER_END - HEADER_START];
+	FIL rom;
+	UINT br = 0;
+	bool ok;
+
+	name_record(fno, entry);
+
+	snprintf(path, sizeof(path), "%s\\%s", ROM_CATALOG_DIR, fno->fname);
+	if(f_open(&rom, path, FA_READ) != FR_OK)
+		return;
+
+	if(entry->flags & ROM_CATALOG_COMPRESSED)
+	{
+		ok = read_lz4_header(&rom, entry, header);
+	}
+	else
+	{
+		ok = f_lseek(&rom, HEADER_START) == FR_OK &&
+			f_read(&rom, header, sizeof(header), &br) == FR_OK &&
+			br == sizeof(header);
+	}
+
+	if(ok)
+	{
+		/* The title is up to 16 characters, padded with zeros. Newer
+		 * cartridges reuse the last few for the manufacturer code and
+		 * CGB flag, which are not printable. */
+		for(uint_fast8_t i = 0; i < 16; i++)
+		{
+			const uint8_t c = header[i];
+
+			if(c < 0x20 || c > 0x7E)
+				break;
+			entry->title[i] = c;
+		}
+		entry->cart_type = header[0x147 - HEADER_START];
+		entry->checksum = (header[0x14E - HEADER_START] << 8) |
+			header[0x14F - HEADER_START];
+	}
+
+	f_close(&rom);
+}
+
+static void sort_key_of(const char *name, struct sort_key *k, uint16_t record)
+{
+	uint_fast8_t i;
+
+	for(i = 0; i < SORT_KEY_LEN && name[i]; i++)
+		k->key[i] = tolower((unsigned char)name[i]);
+	for(; i < SORT_KEY_LEN; i++)
+		k->key[i] = '\0';
+	k->record = record;
+}
+
+static int sort_key_cmp(const void *a, const void *b)
+{
+	const struct sort_key *ka = a;
+	const struct sort_key *kb = b;
+	const int c = memcmp(ka->key, kb->key, SORT_KEY_LEN);
+
+	if(c != 0)
+		return c;
+
+	return (int)ka->record - (int)kb->record;
+}
+
+/**
+ * Put "n" records whose names share their sort key in order of their full
+ * names. Runs are short, so an insertion sort is used.
+ */
+static void sort_run(struct sort_key *run, uint16_t n)
+{
+	char (*names)[ROM_CATALOG_NAME_LEN];
+	struct rom_catalog_entry entry;
+
+	names = malloc(n * sizeof(*names));
+	if(names == NULL)
+		return;
+
+	for(uint16_t i = 0; i < n; i++)
+	{
+		names[i][0] = '\0';
+		if(read_record(run[i].record, &entry))
+			memcpy(names[i], entry.name, sizeof(names[i]));
+	}
+
+	for(uint16_t i = 1; i < n; i++)
+	{
+		for(uint16_t j = i; j > 0 && strcasecmp(names[j - 1], names[j]) > 0; j--)
+		{
+			char name[ROM_CATALOG_NAME_LEN];
+			const uint16_t record = run[j].record;
+
+			memcpy(name, names[j], sizeof(name));
+			memcpy(names[j], names[j - 1], sizeof(name));
+			memcpy(names[j - 1], name, sizeof(name));
+			run[j].record = run[j - 1].record;
+			run[j - 1].record = record;
+		}
+	}
+
+	free(names);
+}
+
+/**
+ * Write a new catalogue of the directory, which "expect" was scanned from.
+ * Leaves the file open.
+ */
+static bool build(const struct rom_catalog_header *expect)
+{
+	struct rom_catalog_header h = *expect;
+	struct rom_catalog_entry entry;
+	struct sort_key *keys = NULL;
+	DIR dj;
+	FILINFO fno;
+	FRESULT fr;
+	UINT bw;
+	uint32_t start = time_us_32();
+
+	fr = f_open(&fil, ROM_CATALOG_FILE, FA_CREATE_ALWAYS | FA_WRITE | FA_READ);
+	if(fr != FR_OK)
+	{
+		printf("E f_open(%s) error: %s (%d)\n", ROM_CATALOG_FILE, FRESULT_str(fr), fr);
+		return false;
+	}
+	fil_open = true;
+
+	if(expect->count > 0)
+	{
+		keys = malloc(expect->count * sizeof(*keys));
+		if(keys == NULL)
+			printf("W rom_catalog: no memory to sort %u ROMs\n", expect->count);
+	}
+
+	/* Written with a bad magic number until the catalogue is complete. */
+	h.magic = 0;
+	h.count = 0;
+	h.dir_hash = 2166136261u;
+	fr = f_write(&fil, &h, sizeof(h), &bw);
+
+	if(fr == FR_OK)
+		fr = f_findfirst(&dj, &fno, ROM_CATALOG_DIR, ROM_CATALOG_PATTERN);
+	while(fr == FR_OK && fno.fname[0] && h.count < expect->count)
+	{
+		if(is_rom(&fno))
+		{
+			make_record(&fno, &entry);
+			fr = f_write(&fil, &entry, sizeof(entry), &bw);
+			if(fr != FR_OK)
+				break;
+
+			if(keys != NULL)
+				sort_key_of(entry.name, &keys[h.count], h.count);
+			h.dir_hash = hash_entry(h.dir_hash, &fno);
+			h.count++;
+		}
+		fr = f_findnext(&dj, &fno);
+	}
+	f_closedir(&dj);
+
+	if(fr != FR_OK)
+	{
+		printf("E rom_catalog build error: %s (%d)\n", FRESULT_str(fr), fr);
+		free(keys);
+		return false;
+	}
+
+	/* Sort on the leading characters, then settle any ties on the full
+	 * names read back from the file. Without the memory to sort, the
+	 * directory order is kept. */
+	if(keys != NULL)
+	{
+		qsort(keys, h.count, sizeof(*keys), sort_key_cmp);
+
+		for(uint16_t i = 0, j; i < h.count; i = j)
+		{
+			for(j = i + 1; j < h.count &&
+				memcmp(keys[i].key, keys[j].key, SORT_KEY_LEN) == 0; j++)
+				;
+			if(j - i > 1 && keys[i].key[SORT_KEY_LEN - 1] != '\0')
+				sort_run(&keys[i], j - i);
+		}
+	}
+
+	fr = f_lseek(&fil, record_offset(h.count));
+	for(uint16_t i = 0; i < h.count && fr == FR_OK; i++)
+	{
+		const uint16_t record = (keys != NULL) ? keys[i].record : i;
+
+		fr = f_write(&fil, &record, sizeof(record), &bw);
+	}
+	free(keys);
+
+	if(fr == FR_OK)
+	{
+		h.magic = ROM_CATALOG_MAGIC;
+		fr = f_lseek(&fil, 0);
+	}
+	if(fr == FR_OK)
+		fr = f_write(&fil, &h, sizeof(h), &bw);
+	if(fr == FR_OK)
+		fr = f_sync(&fil);
+
+	if(fr != FR_OK)
+	{
+		printf("E rom_catalog build error: %s (%d)\n", FRESULT_str(fr), fr);
+		return false;
+	}
+
+	printf("I rom_catalog built %u entries in %lu ms\n", h.count,
+		(time_us_32() - start) / 1000);
+	return true;
+}
+
+/**
+ * Check the open catalogue against "expect" and load its sort order.
+ */
+static bool load(const struct rom_catalog_header *expect)
+{
+	struct rom_catalog_header h;
+	UINT br;
+	FRESULT fr;
+
+	fr = f_lseek(&fil, 0);
+	if(fr == FR_OK)
+		fr = f_read(&fil, &h, sizeof(h), &br);
+	if(fr != FR_OK || br != sizeof(h))
+		return false;
+
+	if(h.magic != ROM_CATALOG_MAGIC || h.version != ROM_CATALOG_VERSION ||
+		h.count != expect->count ||
+		h.dir_date_time != expect->dir_date_time ||
+		h.dir_hash != expect->dir_hash)
+		return false;
+
+	if(f_size(&fil) != record_offset(h.count) + h.count * sizeof(uint16_t))
+		return false;
+
+	count = 0;
+	if(h.count == 0)
+		return true;
+
+	order = malloc(h.count * sizeof(*order));
+	if(order == NULL)
+		return false;
+
+	fr = f_lseek(&fil, record_offset(h.count));
+	if(fr == FR_OK)
+		fr = f_read(&fil, order, h.count * sizeof(*order), &br);
+	if(fr != FR_OK || br != h.count * sizeof(*order))
+	{
+		free(order);
+		order = NULL;
+		return false;
+	}
+
+	for(uint16_t i = 0; i < h.count; i++)
+	{
+		if(order[i] >= h.count)
+			order[i] = i;
+	}
+
+	count = h.count;
+	return true;
+}
+
+bool rom_catalog_open(void)
+{
+	struct rom_catalog_header expect;
+	FRESULT fr;
+
+	rom_catalog_close();
+
+	if(!storage_ready())
+		return false;
+
+	if(!scan_dir(&expect))
+		return false;
+
+	fr = f_open(&fil, ROM_CATALOG_FILE, FA_READ);
+	if(fr == FR_OK)
+	{
+		fil_open = true;
+		if(load(&expect))
+		{
+			printf("I rom_catalog_open %u entries\n", count);
+			return true;
+		}
+		f_close(&fil);
+		fil_open = false;
+	}
+
+	if(build(&expect) && load(&expect))
+		return true;
+
+	rom_catalog_close();
+	walking = true;
+	count = expect.count;
+	printf("W rom_catalog: no catalogue, walking %u entries\n", count);
+	return true;
+}
+
+void rom_catalog_close(void)
+{
+	if(fil_open)
+	{
+		f_close(&fil);
+		fil_open = false;
+	}
+
+	if(walk_open)
+	{
+		f_closedir(&walk_dir);
+		walk_open = false;
+	}
+
+	free(order);
+	order = NULL;
+	count = 0;
+	walking = false;
+}
+
+/**
+ * Find the "index"th ROM in directory order. Only the directory entry is
+ * read, so the cartridge header fields are left empty.
+ */
+static bool walk_get(uint16_t index, struct rom_catalog_entry *entry)
+{
+	FILINFO fno;
+	FRESULT fr;
+
+	/* A page reads its ROMs in order, so carry on from the last one. */
+	if(!walk_open || index < walk_next)
+	{
+		if(walk_open)
+			f_closedir(&walk_dir);
+
+		fr = f_opendir(&walk_dir, ROM_CATALOG_DIR);
+		walk_open = (fr == FR_OK);
+		if(!walk_open)
+		{
+			printf("E f_opendir(%s) error: %s (%d)\n", ROM_CATALOG_DIR, FRESULT_str(fr), fr);
+			return false;
+		}
+		walk_next = 0;
+	}
+
+	do
+	{
+		fr = f_readdir(&walk_dir, &fno);
+		if(fr != FR_OK || fno.fname[0] == '\0')
+		{
+			f_closedir(&walk_dir);
+			walk_open = false;
+			return false;
+		}
+	} while(!is_rom(&fno) || walk_next++ != index);
+
+	name_record(&fno, entry);
+	return true;
+}
+
+uint16_t rom_catalog_count(void)
+{
+	return count;
+}
+
+bool rom_catalog_get(uint16_t index, struct rom_catalog_entry *entry)
+{
+	if(index >= count)
+		return false;
+
+	if(walking)
+		return walk_get(index, entry);
+
+	return read_record(order[index], entry);
+}
+
+void rom_catalog_path(const struct rom_catalog_entry *entry, char *path, size_t len)
+{
+	const char *name = entry->name;
+
+	if((entry->flags & ROM_CATALOG_TRUNCATED) && entry->altname[0])
+		name = entry->altname;
+
+	snprintf(path, len, "%s\\%s", ROM_CATALOG_DIR, name);
+}
@@ -0,0 +1,476 @@
+/**
+ * Cart RAM journal in on-board flash.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <pico/stdlib.h>
+#include <hardware/flash.h>
+#include <hardware/regs/addressmap.h>
+
+#include "save_journal.h"
+
+#define SECTORS			(SAVE_JOURNAL_SIZE / FLASH_SECTOR_SIZE)
+#define SLOTS			(FLASH_SECTOR_SIZE / SAVE_JOURNAL_PAGE_SIZE - 1)
+#define MAX_PAGES		(SAVE_JOURNAL_MAX_RAM / SAVE_JOURNAL_PAGE_SIZE)
+
+/* Erased sectors save_journal_poll() tries to keep in hand. */
+#define SPARE_SECTORS		4
+
+#define HEADER_MAGIC		0x4C4E524A	/* "JRNL" */
+
+#define NO_SECTOR		0xFF
+#define NO_LOC			0xFFFF
+
+/* A sector is freed by moving the pages it holds the newest copy of into
+ * the head sector. The sector holding the fewest has at most this many,
+ * which must fit in a fresh head sector. */
+_Static_assert(MAX_PAGES / (SECTORS - 1) < SLOTS, "SAVE_JOURNAL_SIZE too small");
+_Static_assert(SECTORS < NO_SECTOR, "SAVE_JOURNAL_SIZE too large");
+
+enum sector_state {
+	SECTOR_ERASED,
+	SECTOR_USED,				// Holds pages of this game
+	SECTOR_STALE				// Holds anything else, needs erasing
+};
+
+struct journal_header {
+	uint32_t magic;
+	uint32_t game_id;
+	uint32_t seq;				// Order in which sectors were started
+	uint32_t check;				// ~(magic ^ game_id ^ seq)
+};
+
+struct journal_entry {
+	uint32_t seq;				// Order in which pages were written
+	uint16_t page;				// Cart RAM page held in the slot
+	uint16_t reserved;
+	uint32_t crc;				// CRC-32 of the page
+	uint32_t check;				// ~(seq ^ page ^ crc)
+};
+
+_Static_assert(sizeof(struct journal_header) +
+	SLOTS * sizeof(struct journal_entry) == SAVE_JOURNAL_PAGE_SIZE,
+	"journal entries must fill the first page of a sector");
+
+static uint32_t game;
+static uint_fast16_t pages;				// Pages of cart RAM in use
+static bool opened = false;
+
+static uint8_t state[SECTORS];
+static uint32_t sector_seq[SECTORS];
+static uint_fast8_t erased_count;
+static uint_fast8_t head = NO_SECTOR;			// Sector being filled
+static uint_fast8_t head_slot;				// Next free slot in it
+static uint32_t last_sector_seq;
+static uint32_t last_entry_seq;
+static bool compacting = false;
+
+/* Sector * 16 + slot of the newest copy of each page. */
+static uint16_t loc[MAX_PAGES];
+
+/* Flash is programmed from RAM. */
+static uint8_t entry_page[SAVE_JOURNAL_PAGE_SIZE];
+static uint8_t move_page[SAVE_JOURNAL_PAGE_SIZE];
+
+static struct save_journal_stats stats;
+
+static uint32_t crc32(const uint8_t *p, size_t len)
+{
+	uint32_t crc = 0xFFFFFFFF;
+
+	while(len--)
+	{
+		crc ^= *p++;
+		for(uint_fast8_t i = 0; i < 8; i++)
+			crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+	}
+
+	return ~crc;
+}
+
+static uint32_t sector_offset(uint_fast8_t sector)
+{
+	return SAVE_JOURNAL_OFFSET + sector * FLASH_SECTOR_SIZE;
+}
+
+static const struct journal_header *sector_header(uint_fast8_t sector)
+{
+	return (const struct journal_header *)(XIP_BASE + sector_offset(sector));
+}
+
+static const struct journal_entry *sector_entries(uint_fast8_t sector)
+{
+	return (const struct journal_entry *)(sector_header(sector) + 1);
+}
+
+static const uint8_t *slot_data(uint16_t l)
+{
+	return (const uint8_t *)(XIP_BASE + sector_offset(l / 16) +
+		(l % 16 + 1) * SAVE_JOURNAL_PAGE_SIZE);
+}
+
+static bool is_erased(const void *p, size_t len)
+{
+	const uint32_t *w = p;
+
+	for(size_t i = 0; i < len / 4; i++)
+	{
+		if(w[i] != 0xFFFFFFFF)
+			return false;
+	}
+
+	return true;
+}
+
+static bool header_valid(const struct journal_header *h)
+{
+	return h->magic == HEADER_MAGIC &&
+		h->check == ~(h->magic ^ h->game_id ^ h->seq);
+}
+
+static bool entry_valid(const struct journal_entry *e)
+{
+	return e->check == ~(e->seq ^ e->page ^ e->crc);
+}
+
+static void erase_sector(uint_fast8_t sector)
+{
+	flash_range_erase(sector_offset(sector), FLASH_SECTOR_SIZE);
+	state[sector] = SECTOR_ERASED;
+	erased_count++;
+	stats.erases++;
+}
+
+/**
+ * Number of pages each sector holds the newest copy of.
+ */
+static void count_live(uint_fast8_t live[SECTORS])
+{
+	memset(live, 0, SECTORS);
+	for(uint_fast16_t p = 0; p < pages; p++)
+	{
+		if(loc[p] != NO_LOC)
+			live[loc[p] / 16]++;
+	}
+}
+
+/**
+ * The sector that is cheapest to free: the one holding the fewest newest
+ * copies, and of those the oldest.
+ */
+static uint_fast8_t pick_victim(uint_fast8_t *victim_live)
+{
+	uint_fast8_t live[SECTORS];
+	uint_fast8_t victim = NO_SECTOR;
+
+	count_live(live);
+	for(uint_fast8_t s = 0; s < SECTORS; s++)
+	{
+		if(s == head || state[s] == SECTOR_ERASED)
+			continue;
+
+		if(state[s] == SECTOR_STALE)
+			live[s] = 0;
+
+		if(victim == NO_SECTOR || live[s] < live[victim] ||
+			(live[s] == live[victim] && sector_seq[s] < sector_seq[victim]))
+			victim = s;
+	}
+
+	if(victim != NO_SECTOR)
+		*victim_live = live[victim];
+	return victim;
+}
+
+static bool append(uint16_t page, const uint8_t *data);
+
+/**
+ * Move the newest copies out of "victim" and erase it.
+ */
+static bool compact(uint_fast8_t victim)
+{
+	bool ok = true;
+
+	compacting = true;
+	for(uint_fast16_t p = 0; p < pages && state[victim] == SECTOR_USED; p++)
+	{
+		if(loc[p] == NO_LOC || loc[p] / 16 != victim)
+			continue;
+
+		memcpy(move_page, slot_data(loc[p]), sizeof(move_page));
+		if(!append(p, move_page))
+		{
+			ok = false;
+			break;
+		}
+		stats.pages_moved++;
+	}
+	compacting = false;
+
+	if(ok && state[victim] != SECTOR_ERASED)
+		erase_sector(victim);
+
+	return ok;
+}
+
+/**
+ * Free a sector when none is left erased. Only happens after a power loss
+ * part way through freeing one, or when another game's pages fill the
+ * journal. The victim's pages must fit in what is left of the head sector.
+ */
+static bool recover(void)
+{
+	const uint_fast8_t free_slots = (head == NO_SECTOR) ? 0 : SLOTS - head_slot;
+	uint_fast8_t victim, victim_live;
+
+	victim = pick_victim(&victim_live);
+	return victim != NO_SECTOR && victim_live <= free_slots && compact(victim);
+}
+
+/**
+ * Start writing to the next erased sector round the ring, keeping one
+ * erased sector in hand for the next time.
+ */
+static bool advance_head(void)
+{
+	struct journal_header h;
+	uint_fast8_t s, victim, victim_live;
+
+	if(erased_count == 0 && (compacting || !recover()))
+		return false;
+
+	s = (head == NO_SECTOR) ? 0 : head;
+	do
+	{
+		s = (s + 1) % SECTORS;
+	} while(state[s] != SECTOR_ERASED);
+
+	h.magic = HEADER_MAGIC;
+	h.game_id = game;
+	h.seq = ++last_sector_seq;
+	h.check = ~(h.magic ^ h.game_id ^ h.seq);
+	memset(entry_page, 0xFF, sizeof(entry_page));
+	memcpy(entry_page, &h, sizeof(h));
+	flash_range_program(sector_offset(s), entry_page, sizeof(entry_page));
+
+	state[s] = SECTOR_USED;
+	sector_seq[s] = h.seq;
+	erased_count--;
+	head = s;
+	head_slot = 0;
+
+	if(erased_count == 0 && !compacting)
+	{
+		victim = pick_victim(&victim_live);
+		if(victim != NO_SECTOR)
+			compact(victim);
+	}
+
+	return true;
+}
+
+/**
+ * Write "data" as the newest copy of "page": the data first, then the
+ * entry that makes it valid.
+ */
+static bool append(uint16_t page, const uint8_t *data)
+{
+	struct journal_entry e;
+	uint32_t offset;
+
+	if(head == NO_SECTOR || head_slot == SLOTS)
+	{
+		if(!advance_head())
+		{
+			printf("E save_journal: no free sector\n");
+			return false;
+		}
+	}
+
+	offset = sector_offset(head);
+	flash_range_program(offset + (head_slot + 1) * SAVE_JOURNAL_PAGE_SIZE,
+		data, SAVE_JOURNAL_PAGE_SIZE);
+
+	e.seq = ++last_entry_seq;
+	e.page = page;
+	e.reserved = 0;
+	e.crc = crc32(data, SAVE_JOURNAL_PAGE_SIZE);
+	e.check = ~(e.seq ^ e.page ^ e.crc);
+
+	/* Bytes left at 0xFF are not changed by programming, so the page is
+	 * written again with only this entry set. */
+	memset(entry_page, 0xFF, sizeof(entry_page));
+	memcpy(entry_page + sizeof(struct journal_header) + head_slot * sizeof(e),
+		&e, sizeof(e));
+	flash_range_program(offset, entry_page, sizeof(entry_page));
+
+	loc[page] = head * 16 + head_slot;
+	head_slot++;
+	return true;
+}
+
+uint_fast16_t save_journal_open(uint32_t game_id, uint8_t *ram, uint32_t size)
+{
+	static uint32_t page_seq[MAX_PAGES];
+	uint_fast16_t restored = 0;
+
+	game = game_id;
+	pages = size / SAVE_JOURNAL_PAGE_SIZE;
+	if(pages > MAX_PAGES)
+		pages = MAX_PAGES;
+
+	memset(loc, 0xFF, sizeof(loc));
+	erased_count = 0;
+	head = NO_SECTOR;
+	head_slot = 0;
+	last_sector_seq = 0;
+	last_entry_seq = 0;
+	compacting = false;
+
+	for(uint_fast8_t s = 0; s < SECTORS; s++)
+	{
+		const struct journal_header *h = sector_header(s);
+		const struct journal_entry *e = sector_entries(s);
+
+		sector_seq[s] = 0;
+
+		if(!header_valid(h))
+		{
+			if(is_erased((const void *)h, FLASH_SECTOR_SIZE))
+			{
+				state[s] = SECTOR_ERASED;
+				erased_count++;
+			}
+			else
+				state[s] = SECTOR_STALE;
+			continue;
+		}
+
+		if(h->seq > last_sector_seq)
+			last_sector_seq = h->seq;
+
+		if(h->game_id != game_id)
+		{
+			state[s] = SECTOR_STALE;
+			continue;
+		}
+
+		state[s] = SECTOR_USED;
+		sector_seq[s] = h->seq;
+		if(head == NO_SECTOR || h->seq > sector_seq[head])
+			head = s;
+
+		for(uint_fast8_t i = 0; i < SLOTS; i++)
+		{
+			const uint16_t l = s * 16 + i;
+
+			/* An entry cut short by power loss fails its check, and
+			 * data cut short fails its CRC. */
+			if(is_erased(&e[i], sizeof(e[i])) || !entry_valid(&e[i]))
+				continue;
+
+			if(e[i].seq > last_entry_seq)
+				last_entry_seq = e[i].seq;
+
+			if(e[i].page >= pages)
+				continue;
+			if(loc[e[i].page] != NO_LOC && e[i].seq <= page_seq[e[i].page])
+				continue;
+			if(crc32(slot_data(l), SAVE_JOURNAL_PAGE_SIZE) != e[i].crc)
+				continue;
+
+			loc[e[i].page] = l;
+			page_seq[e[i].page] = e[i].seq;
+		}
+	}
+
+	/* New entries go after the last slot used in the newest sector. A
+	 * slot whose data was written but not its entry is used too, as its
+	 * page can no longer be programmed. */
+	if(head != NO_SECTOR)
+	{
+		const struct journal_entry *e = sector_entries(head);
+
+		head_slot = SLOTS;
+		while(head_slot > 0 && is_erased(&e[head_slot - 1], sizeof(e[0])) &&
+			is_erased(slot_data(head * 16 + head_slot - 1), SAVE_JOURNAL_PAGE_SIZE))
+			head_slot--;
+	}
+
+	/* Finish freeing a sector now, while the head sector has room for
+	 * the pages still to move. */
+	if(erased_count == 0)
+		recover();
+
+	for(uint_fast16_t p = 0; p < pages; p++)
+	{
+		if(loc[p] == NO_LOC)
+			continue;
+
+		memcpy(ram + p * SAVE_JOURNAL_PAGE_SIZE, slot_data(loc[p]),
+			SAVE_JOURNAL_PAGE_SIZE);
+		restored++;
+	}
+
+	opened = true;
+	save_journal_poll();
+	printf("I save_journal_open %u pages restored, %u sectors erased\n",
+		(unsigned)restored, (unsigned)erased_count);
+	return restored;
+}
+
+bool save_journal_write(uint32_t offset, const uint8_t *data, uint32_t len)
+{
+	if(!opened)
+		return false;
+
+	for(uint32_t o = 0; o < len; o += SAVE_JOURNAL_PAGE_SIZE)
+	{
+		const uint_fast16_t p = (offset + o) / SAVE_JOURNAL_PAGE_SIZE;
+
+		if(p >= pages)
+			return false;
+
+		if(loc[p] != NO_LOC &&
+			memcmp(slot_data(loc[p]), data + o, SAVE_JOURNAL_PAGE_SIZE) == 0)
+		{
+			stats.pages_unchanged++;
+			continue;
+		}
+
+		if(!append(p, data + o))
+			return false;
+		stats.pages_written++;
+	}
+
+	return true;
+}
+
+void save_journal_poll(void)
+{
+	uint_fast8_t victim, victim_live;
+
+	if(!opened)
+		return;
+
+	/* Moving pages may start a new head sector, so a pass can free none
+	 * overall. Going round the ring once is always enough. */
+	for(uint_fast8_t i = 0; i < SECTORS; i++)
+	{
+		if(erased_count >= SPARE_SECTORS || erased_count == 0)
+			break;
+
+		victim = pick_victim(&victim_live);
+		if(victim == NO_SECTOR || !compact(victim))
+			break;
+	}
+}
+
+void save_journal_get_stats(struct save_journal_stats *s)
+{
+	*s = stats;
+}
@@ -0,0 +1,361 @@
+/**
+ * SD card storage session: the mounted volume and the open save file.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <pico/stdlib.h>
+
+#include "ff.h"
+#include "diskio.h"
+#include "f_util.h"
+#include "sd_card.h"
+#include "hw_config.h"
+#include "storage.h"
+
+/* Link map entries needed to describe a file in one fragment: the table
+ * size, one count and start cluster pair, and the terminator. */
+#define CONTIGUOUS_CLMT_SIZE	4
+
+static bool mounted = false;
+
+static FIL save;
+static bool save_open = false;
+static uint32_t save_size;
+static LBA_t save_lba;					// First sector, or 0 if not contiguous
+static DWORD save_clmt[CONTIGUOUS_CLMT_SIZE];
+
+static struct storage_stats stats;
+
+/* Result of the write started by storage_save_write_async(), set from the
+ * interrupt that finishes it. */
+static volatile bool save_async_busy = false;
+static volatile int save_async_status = SD_BLOCK_DEVICE_ERROR_NONE;
+
+/* Caller of the read started by storage_read_async(). */
+static storage_read_done_t read_async_done;
+static void *read_async_context;
+
+static bool mount(void)
+{
+	sd_card_t *pSD = sd_get_by_num(0);
+	FRESULT fr;
+
+	fr = f_mount(&pSD->fatfs, pSD->pcName, 1);
+	if(fr != FR_OK)
+	{
+		printf("E f_mount error: %s (%d)\n", FRESULT_str(fr), fr);
+		return false;
+	}
+
+	stats.mounts++;
+	mounted = true;
+	return true;
+}
+
+bool storage_init(void)
+{
+	return mount();
+}
+
+bool storage_ready(void)
+{
+	sd_card_t *pSD = sd_get_by_num(0);
+
+	if(mounted && !(disk_status(pSD->fatfs.pdrv) & (STA_NOINIT | STA_NODISK)))
+		return true;
+
+	/* Anything open on the old mount is no longer valid. */
+	save_open = false;
+	mounted = false;
+
+	/* Force the card to be initialised again. */
+	pSD->m_Status |= STA_NOINIT;
+	return mount();
+}
+
+uint32_t storage_mount_count(void)
+{
+	return stats.mounts;
+}
+
+void storage_error(FRESULT fr)
+{
+	switch(fr)
+	{
+		case FR_DISK_ERR:
+		case FR_NOT_READY:
+		case FR_NOT_ENABLED:
+		case FR_NO_FILESYSTEM:
+			mounted = false;
+			break;
+
+		default:
+			break;
+	}
+}
+
+/**
+ * Find the first sector of the open save file if it is stored in one
+ * fragment, by asking fast seek for its link map.
+ */
+static LBA_t contiguous_lba(void)
+{
+	FATFS *fs = save.obj.fs;
+	FRESULT fr;
+
+	save.cltbl = save_clmt;
+	save_clmt[0] = CONTIGUOUS_CLMT_SIZE;
+	fr = f_lseek(&save, CREATE_LINKMAP);
+	save.cltbl = NULL;
+
+	if(fr != FR_OK || save_clmt[0] != CONTIGUOUS_CLMT_SIZE)
+		return 0;
+
+	return fs->database + (LBA_t)fs->csize * (save_clmt[2] - 2);
+}
+
+bool storage_save_open(const char *path, uint32_t size)
+{
+	FSIZE_t pos;
+	FRESULT fr;
+
+	storage_save_close();
+
+	if(!storage_ready())
+		return false;
+
+	fr = f_open(&save, path, FA_OPEN_ALWAYS | FA_READ | FA_WRITE);
+	if(fr != FR_OK)
+	{
+		printf("E f_open(%s) error: %s (%d)\n", path, FRESULT_str(fr), fr);
+		storage_error(fr);
+		return false;
+	}
+	save_open = true;
+
+	/* A new file is allocated in one piece. A file from elsewhere keeps its
+	 * clusters, and is grown if it is too short. */
+	pos = f_size(&save);
+	if(pos == 0)
+	{
+		fr = f_expand(&save, size, 1);
+		if(fr != FR_OK)
+			printf("W f_expand(%s) error: %s (%d)\n", path, FRESULT_str(fr), fr);
+	}
+
+	/* The new part of the file is filled with zeros, as cart RAM starts
+	 * out, rather than whatever the clusters held before. */
+	if(pos < size)
+	{
+		static const uint8_t zeros[STORAGE_SECTOR_SIZE];
+		UINT bw;
+
+		fr = f_lseek(&save, pos);
+		while(fr == FR_OK && pos < size)
+		{
+			const UINT n = (size - pos < sizeof(zeros)) ? size - pos : sizeof(zeros);
+
+			fr = f_write(&save, zeros, n, &bw);
+			pos += n;
+		}
+		if(fr != FR_OK || f_size(&save) < size)
+		{
+			printf("E %s could not be grown to %lu bytes\n", path, size);
+			storage_error(fr);
+			storage_save_close();
+			return false;
+		}
+	}
+	f_sync(&save);
+
+	save_size = size;
+	save_lba = contiguous_lba();
+	if(save_lba == 0)
+		printf("W %s is fragmented, saves go through the file system\n", path);
+
+	f_lseek(&save, 0);
+	return true;
+}
+
+uint32_t storage_save_read(void *buf, uint32_t len)
+{
+	UINT br = 0;
+	FRESULT fr;
+
+	if(!save_open)
+		return 0;
+
+	fr = f_lseek(&save, 0);
+	if(fr == FR_OK)
+		fr = f_read(&save, buf, len, &br);
+	if(fr != FR_OK)
+	{
+		printf("E f_read error: %s (%d)\n", FRESULT_str(fr), fr);
+		storage_error(fr);
+	}
+
+	return br;
+}
+
+bool storage_save_write(uint32_t offset, const void *data, uint32_t len)
+{
+	UINT bw;
+	FRESULT fr;
+
+	if(!save_open || offset + len > save_size)
+		return false;
+
+	stats.save_writes++;
+
+	if(save_lba != 0 && offset % STORAGE_SECTOR_SIZE == 0 &&
+		len % STORAGE_SECTOR_SIZE == 0)
+	{
+		DRESULT dr = disk_write(save.obj.fs->pdrv, data,
+			save_lba + offset / STORAGE_SECTOR_SIZE,
+			len / STORAGE_SECTOR_SIZE);
+
+		if(dr != RES_OK)
+		{
+			printf("E disk_write error: %d\n", dr);
+			storage_error(FR_DISK_ERR);
+			return false;
+		}
+
+		stats.save_bytes += len;
+		return true;
+	}
+
+	fr = f_lseek(&save, offset);
+	if(fr == FR_OK)
+		fr = f_write(&save, data, len, &bw);
+	if(fr == FR_OK)
+		fr = f_sync(&save);
+	if(fr != FR_OK)
+	{
+		printf("E f_write error: %s (%d)\n", FRESULT_str(fr), fr);
+		storage_error(fr);
+		return false;
+	}
+
+	stats.save_bytes += len;
+	return true;
+}
+
+static void save_write_done(int status, void *context)
+{
+	(void)context;
+	save_async_status = status;
+	save_async_busy = false;
+}
+
+bool storage_save_write_async(uint32_t offset, const void *data, uint32_t len)
+{
+	sd_card_t *pSD = sd_get_by_num(0);
+	int status;
+
+	if(!save_open || save_lba == 0 || save_async_busy ||
+		offset + len > save_size || offset % STORAGE_SECTOR_SIZE != 0 ||
+		len % STORAGE_SECTOR_SIZE != 0)
+		return false;
+
+	save_async_busy = true;
+	status = sd_write_blocks_async(pSD, data, save_lba + offset / STORAGE_SECTOR_SIZE,
+		len / STORAGE_SECTOR_SIZE, save_write_done, NULL);
+	if(status != SD_BLOCK_DEVICE_ERROR_NONE)
+	{
+		save_async_busy = false;
+		return false;
+	}
+
+	stats.save_writes++;
+	stats.save_bytes += len;
+	return true;
+}
+
+bool storage_save_pending(bool *ok)
+{
+	if(save_async_busy)
+		return true;
+
+	*ok = save_async_status == SD_BLOCK_DEVICE_ERROR_NONE;
+	if(!*ok)
+	{
+		printf("E sd_write_blocks_async error: %d\n", save_async_status);
+		save_async_status = SD_BLOCK_DEVICE_ERROR_NONE;
+		storage_error(FR_DISK_ERR);
+	}
+	return false;
+}
+
+LBA_t storage_file_lba(FIL *fp, FSIZE_t offset, FSIZE_t len)
+{
+	FATFS *fs = fp->obj.fs;
+	const FSIZE_t csize = (FSIZE_t)fs->csize * STORAGE_SECTOR_SIZE;
+	DWORD cl = offset / csize;				// Cluster within the file
+	const DWORD last = (offset + len - 1) / csize;
+	const DWORD *tbl;
+
+	if(fp->cltbl == NULL || len == 0)
+		return 0;
+
+	/* The link map is a list of fragments, each a cluster count and the
+	 * first cluster, ending with a count of 0. */
+	for(tbl = fp->cltbl + 1; tbl[0] != 0; tbl += 2)
+	{
+		if(cl < tbl[0])
+		{
+			if(last - (offset / csize) >= tbl[0] - cl)
+				return 0;			// Runs into the next fragment
+
+			return fs->database + (LBA_t)fs->csize * (tbl[1] + cl - 2) +
+				(offset % csize) / STORAGE_SECTOR_SIZE;
+		}
+
+		cl -= tbl[0];
+	}
+
+	return 0;
+}
+
+static void read_done(int status, void *context)
+{
+	(void)context;
+	read_async_done(status == SD_BLOCK_DEVICE_ERROR_NONE, read_async_context);
+}
+
+bool storage_read_async(LBA_t lba, void *buf, uint32_t count,
+	storage_read_done_t done, void *context)
+{
+	sd_card_t *pSD = sd_get_by_num(0);
+
+	/* Starting a transfer waits for the one in progress. */
+	if(!mounted || sd_async_busy(pSD))
+		return false;
+
+	read_async_done = done;
+	read_async_context = context;
+	return sd_read_blocks_async(pSD, buf, lba, count, read_done, NULL) ==
+		SD_BLOCK_DEVICE_ERROR_NONE;
+}
+
+void storage_save_close(void)
+{
+	if(!save_open)
+		return;
+
+	f_close(&save);
+	save_open = false;
+}
+
+void storage_get_stats(struct storage_stats *s)
+{
+	sd_card_t *pSD = sd_get_by_num(0);
+
+	*s = stats;
+	s->sck_hz = pSD->sck_hz;
+	s->sck_fallbacks = pSD->sck_fallbacks;
+}
@@ -0,0 +1,149 @@
+/**
+ * Per-frame performance records, dumped as CSV by core1.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <pico/stdlib.h>
+
+#include "core1_sched.h"
+#include "telemetry.h"
+
+static struct telemetry_frame ring[TELEMETRY_FRAMES];
+static uint32_t count;						// Records committed, core0 only
+static uint32_t frame;						// Current frame number, core0 only
+static uint32_t missed;						// Frames not recorded during dumps
+
+/* Dump being printed by core1. */
+static telemetry_print_fn print_fn;
+static telemetry_done_fn print_done;
+static uint32_t print_end;
+static uint32_t printing;					// Set by core0, cleared by core1 when done
+static uint32_t print_stop;					// Set by core0 to cut the dump short
+
+void telemetry_reset(void)
+{
+	count = 0;
+	frame = 0;
+	missed = 0;
+}
+
+struct telemetry_frame *telemetry_begin(void)
+{
+	struct telemetry_frame *r;
+
+	if(telemetry_printing())
+	{
+		missed++;
+		frame++;
+		return NULL;
+	}
+
+	r = &ring[count & (TELEMETRY_FRAMES - 1)];
+	memset(r, 0, sizeof(*r));
+	r->frame = frame;
+	return r;
+}
+
+void telemetry_commit(void)
+{
+	count++;
+	frame++;
+}
+
+/**
+ * Core1 job: print the next lines of the dump from "pos", then queue the
+ * rest.
+ */
+static void print_job(uint32_t pos, uint32_t unused)
+{
+	bool complete;
+
+	(void)unused;
+	if(!__atomic_load_n(&print_stop, __ATOMIC_ACQUIRE))
+	{
+		pos = print_fn(pos);
+
+		/* Higher priority jobs run between two of these. A stdio write
+		 * to a host that does not read still blocks core1 for up to the
+		 * stdio timeout, display jobs included. */
+		if(pos != print_end && core1_sched_post(CORE1_PRIO_TELEMETRY, print_job, pos, 0))
+			return;
+	}
+
+	complete = (pos == print_end);
+	puts(complete ? "# end" : "# end, cut short");
+	if(print_done != NULL)
+		print_done(complete);
+	__atomic_store_n(&printing, 0, __ATOMIC_RELEASE);
+}
+
+bool telemetry_print(telemetry_print_fn print, uint32_t pos, uint32_t end,
+	telemetry_done_fn done)
+{
+	if(telemetry_printing())
+		return false;
+
+	if(pos == end)
+	{
+		puts("# end");
+		if(done != NULL)
+			done(true);
+		return true;
+	}
+
+	print_fn = print;
+	print_done = done;
+	print_end = end;
+	print_stop = 0;
+	printing = 1;
+	if(!core1_sched_post(CORE1_PRIO_TELEMETRY, print_job, pos, 0))
+	{
+		printing = 0;
+		return false;
+	}
+
+	return true;
+}
+
+bool telemetry_printing(void)
+{
+	return __atomic_load_n(&printing, __ATOMIC_ACQUIRE) != 0;
+}
+
+void telemetry_print_stop(void)
+{
+	__atomic_store_n(&print_stop, 1, __ATOMIC_RELEASE);
+	while(telemetry_printing())
+		tight_loop_contents();
+}
+
+/**
+ * Core1: print record "pos".
+ */
+static uint32_t print_record(uint32_t pos)
+{
+	const struct telemetry_frame *r = &ring[pos & (TELEMETRY_FRAMES - 1)];
+
+	printf("%lu,%lu,%lu,%lu,%lu,%lu,%u,%u\n",
+		r->frame, r->emu_us, r->ppu_us, r->lcd_wait_us,
+		r->apu_us, r->storage_us, r->audio_queued, r->flags);
+	return pos + 1;
+}
+
+bool telemetry_dump(void)
+{
+	const uint32_t n = count < TELEMETRY_FRAMES ? count : TELEMETRY_FRAMES;
+
+	if(telemetry_printing())
+		return false;
+
+	printf("# telemetry: %lu frames, %lu not recorded during dumps\n", n, missed);
+	puts("frame,emu_us,ppu_us,lcd_wait_us,apu_us,storage_us,audio_queued,flags");
+	missed = 0;
+
+	return telemetry_print(print_record, count - n, count, NULL);
+}
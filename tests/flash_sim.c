@@ -0,0 +1,116 @@
+/**
+ * Simulated NOR flash for host tests.
+ */
+
+#include <setjmp.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <pico/stdlib.h>
+#include <hardware/flash.h>
+
+#include "flash_sim.h"
+
+uint8_t flash_sim_mem[PICO_FLASH_SIZE_BYTES];
+jmp_buf flash_sim_power_cut;
+uint32_t flash_sim_ops;
+bool flash_sim_overwrite;
+
+static uint32_t cut_in;					// Operations until the cut, 0 if none
+static uint32_t rng = 1;
+
+uint32_t flash_sim_random(void)
+{
+	/* xorshift32 */
+	rng ^= rng << 13;
+	rng ^= rng >> 17;
+	rng ^= rng << 5;
+	return rng;
+}
+
+void flash_sim_reset(uint32_t seed)
+{
+	memset(flash_sim_mem, 0xFF, sizeof(flash_sim_mem));
+	flash_sim_ops = 0;
+	flash_sim_overwrite = false;
+	cut_in = 0;
+	rng = seed ? seed : 1;
+}
+
+void flash_sim_arm(uint32_t n)
+{
+	cut_in = n;
+}
+
+/**
+ * Returns true if the power goes during this operation.
+ */
+static bool cut_now(void)
+{
+	flash_sim_ops++;
+	if(cut_in == 0)
+		return false;
+
+	return --cut_in == 0;
+}
+
+static void check_range(uint32_t offs, size_t count, size_t align)
+{
+	if(offs % align != 0 || count % align != 0 ||
+		offs + count > sizeof(flash_sim_mem))
+	{
+		fprintf(stderr, "flash_sim: bad range %08lx+%zu\n",
+			(unsigned long)offs, count);
+		abort();
+	}
+}
+
+void flash_range_erase(uint32_t flash_offs, size_t count)
+{
+	uint8_t *p = flash_sim_mem + flash_offs;
+
+	check_range(flash_offs, count, FLASH_SECTOR_SIZE);
+	if(!cut_now())
+	{
+		memset(p, 0xFF, count);
+		return;
+	}
+
+	/* An erase cut short leaves bits set at random. */
+	for(size_t i = 0; i < count; i++)
+		p[i] |= flash_sim_random();
+
+	longjmp(flash_sim_power_cut, 1);
+}
+
+void flash_range_program(uint32_t flash_offs, const uint8_t *data, size_t count)
+{
+	uint8_t *p = flash_sim_mem + flash_offs;
+	size_t n = count;
+
+	check_range(flash_offs, count, FLASH_PAGE_SIZE);
+	/* Bytes of 0xFF leave flash as it is. Any other byte must land on
+	 * erased flash. */
+	for(size_t i = 0; i < count; i++)
+	{
+		if(data[i] != 0xFF && p[i] != 0xFF)
+			flash_sim_overwrite = true;
+	}
+
+	if(cut_now())
+		n = flash_sim_random() % count;
+
+	for(size_t i = 0; i < n; i++)
+		p[i] &= data[i];
+
+	if(n == count)
+		return;
+
+	/* The byte being programmed when the power went gets some of its
+	 * bits. */
+	p[n] &= data[n] | flash_sim_random();
+	longjmp(flash_sim_power_cut, 1);
+}
@@ -0,0 +1,45 @@
+#ifndef FLASH_SIM_H
+#define FLASH_SIM_H
+
+#include <setjmp.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * Simulated NOR flash for host tests.
+ *
+ * flash_range_erase() and flash_range_program() act on flash_sim_mem, which
+ * XIP_BASE points at, with the rules of the real part: erasing sets every
+ * bit of a 4 KiB sector, and programming a 256-byte page can only clear
+ * bits. A power cut can be armed to happen part way through a later erase
+ * or program. The sim then leaves that operation half done and jumps to
+ * flash_sim_power_cut.
+ */
+
+extern jmp_buf flash_sim_power_cut;
+
+/* Programs and erases done since flash_sim_reset(). */
+extern uint32_t flash_sim_ops;
+
+/* Set when a program wrote a byte other than 0xFF to flash that was not
+ * erased. */
+extern bool flash_sim_overwrite;
+
+/**
+ * Erase the whole array, disarm any power cut and seed the generator that
+ * decides how far a cut operation gets.
+ */
+void flash_sim_reset(uint32_t seed);
+
+/**
+ * Cut the power during the "n"th erase or program from now, 1 being the
+ * next one. 0 disarms it.
+ */
+void flash_sim_arm(uint32_t n);
+
+/**
+ * Returns a pseudo-random number from the sim's generator.
+ */
+uint32_t flash_sim_random(void);
+
+#endif /* FLASH_SIM_H */
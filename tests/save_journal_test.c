@@ -0,0 +1,175 @@
+/**
+ * Power-loss test of the flash save journal against simulated flash.
+ *
+ * Random runs of cart RAM pages are written to the journal, with
+ * save_journal_poll() in between, and the power is cut part way through a
+ * random erase or program. The journal is then replayed and every page must
+ * hold the newest copy written, except the pages of the write that was cut,
+ * which may hold that copy or the one before it. Writing then carries on
+ * from the replayed journal, so later cuts also land in sectors being
+ * freed and in journals left behind by earlier cuts.
+ *
+ * Usage: save_journal_test [seed [cuts]]
+ */
+
+#include <setjmp.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "flash_sim.h"
+#include "save_journal.h"
+
+#define GAME_ID		0x47414D45
+#define OTHER_GAME_ID	0x4F544852
+#define RAM_SIZE	SAVE_JOURNAL_MAX_RAM
+#define PAGE_SIZE	SAVE_JOURNAL_PAGE_SIZE
+#define PAGES		(RAM_SIZE / PAGE_SIZE)
+
+/* Pages most writes go to, so that sectors hold a mix of newest and old
+ * copies. */
+#define HOT_PAGES	8
+
+static uint8_t saved[RAM_SIZE];				// Newest copy the journal accepted
+static uint8_t trying[RAM_SIZE];			// Copy being written
+static bool in_flight[PAGES];				// Pages of the write in progress
+static uint8_t ram[RAM_SIZE];
+static unsigned failures;
+
+/**
+ * Replay the journal and check it against what was written.
+ */
+static void replay_and_check(const char *when)
+{
+	unsigned bad = 0;
+
+	/* Cart RAM starts out as zeros, and so does saved[]. */
+	memset(ram, 0, sizeof(ram));
+	save_journal_open(GAME_ID, ram, sizeof(ram));
+
+	for(uint_fast16_t p = 0; p < PAGES; p++)
+	{
+		const uint32_t o = p * PAGE_SIZE;
+
+		if(memcmp(ram + o, saved + o, PAGE_SIZE) == 0)
+			continue;
+
+		/* The cut write got as far as this page. */
+		if(in_flight[p] && memcmp(ram + o, trying + o, PAGE_SIZE) == 0)
+		{
+			memcpy(saved + o, trying + o, PAGE_SIZE);
+			continue;
+		}
+
+		bad++;
+		memcpy(saved + o, ram + o, PAGE_SIZE);		// Report each loss once
+	}
+
+	memset(in_flight, 0, sizeof(in_flight));
+	if(bad != 0)
+	{
+		printf("E %s: %u pages lost\n", when, bad);
+		failures++;
+	}
+}
+
+/**
+ * Write "steps" runs of pages, as the background flush does.
+ */
+static void run_writes(uint32_t steps)
+{
+	for(uint32_t i = 0; i < steps; i++)
+	{
+		uint32_t first, n, r = flash_sim_random();
+
+		first = (r & 1) ? (r >> 1) % HOT_PAGES : (r >> 1) % PAGES;
+		n = 1 + (r >> 24) % 4;
+		if(first + n > PAGES)
+			n = PAGES - first;
+
+		memcpy(trying + first * PAGE_SIZE, saved + first * PAGE_SIZE,
+			n * PAGE_SIZE);
+		for(uint32_t p = first; p < first + n; p++)
+		{
+			/* Some pages are written unchanged, as a whole flush run
+			 * is, and must not take up a slot. */
+			if(flash_sim_random() % 4 != 0)
+			{
+				for(uint32_t b = 0; b < PAGE_SIZE; b += 4)
+				{
+					const uint32_t w = flash_sim_random();
+
+					memcpy(trying + p * PAGE_SIZE + b, &w, 4);
+				}
+			}
+			in_flight[p] = true;
+		}
+
+		if(!save_journal_write(first * PAGE_SIZE, trying + first * PAGE_SIZE,
+			n * PAGE_SIZE))
+		{
+			printf("E write of pages %lu+%lu refused\n",
+				(unsigned long)first, (unsigned long)n);
+			failures++;
+		}
+
+		memcpy(saved + first * PAGE_SIZE, trying + first * PAGE_SIZE,
+			n * PAGE_SIZE);
+		memset(in_flight, 0, sizeof(in_flight));
+
+		if(i % 8 == 7)
+			save_journal_poll();
+	}
+}
+
+int main(int argc, char **argv)
+{
+	const uint32_t seed = (argc > 1) ? strtoul(argv[1], NULL, 0) : 1;
+	const uint32_t cuts = (argc > 2) ? strtoul(argv[2], NULL, 0) : 1000;
+	struct save_journal_stats stats;
+
+	flash_sim_reset(seed);
+	memset(saved, 0, sizeof(saved));
+	replay_and_check("blank journal");
+
+	/* Go round the ring several times. */
+	run_writes(2000);
+	replay_and_check("without power cuts");
+
+	for(uint32_t c = 0; c < cuts; c++)
+	{
+		char when[32];
+
+		flash_sim_arm(1 + flash_sim_random() % 64);
+		if(setjmp(flash_sim_power_cut) == 0)
+			run_writes(1000);
+		flash_sim_arm(0);
+
+		snprintf(when, sizeof(when), "power cut %lu", (unsigned long)c);
+		replay_and_check(when);
+	}
+
+	/* Another game sees none of this one's pages. */
+	memset(ram, 0, sizeof(ram));
+	if(save_journal_open(OTHER_GAME_ID, ram, sizeof(ram)) != 0)
+	{
+		printf("E another game's pages were restored\n");
+		failures++;
+	}
+
+	if(flash_sim_overwrite)
+	{
+		printf("E a flash page was programmed twice\n");
+		failures++;
+	}
+
+	save_journal_get_stats(&stats);
+	printf("I seed %lu: %lu flash operations, %lu pages written, %lu moved, %lu erases, %u failures\n",
+		(unsigned long)seed, (unsigned long)flash_sim_ops,
+		(unsigned long)stats.pages_written, (unsigned long)stats.pages_moved,
+		(unsigned long)stats.erases, failures);
+
+	return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,14 @@
+#ifndef TEST_STUB_HARDWARE_FLASH_H
+#define TEST_STUB_HARDWARE_FLASH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define FLASH_PAGE_SIZE		256
+#define FLASH_SECTOR_SIZE	4096
+
+/* Implemented by flash_sim.c. */
+void flash_range_erase(uint32_t flash_offs, size_t count);
+void flash_range_program(uint32_t flash_offs, const uint8_t *data, size_t count);
+
+#endif
@@ -0,0 +1,10 @@
+#ifndef TEST_STUB_HARDWARE_REGS_ADDRESSMAP_H
+#define TEST_STUB_HARDWARE_REGS_ADDRESSMAP_H
+
+#include <stdint.h>
+
+/* Flash reads go to the simulated array. */
+extern uint8_t flash_sim_mem[];
+#define XIP_BASE	((uintptr_t)flash_sim_mem)
+
+#endif
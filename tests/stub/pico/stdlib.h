@@ -0,0 +1,11 @@
+#ifndef TEST_STUB_PICO_STDLIB_H
+#define TEST_STUB_PICO_STDLIB_H
+
+/* Host build: the parts of the Pico SDK the code under test uses. */
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define PICO_FLASH_SIZE_BYTES	(2 * 1024 * 1024)
+
+#endif
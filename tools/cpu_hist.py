@@ -0,0 +1,178 @@
+#!/usr/bin/env python3
+"""
+Add up the emulator's CPU execution histograms.
+
+Reads the CSV printed by the 'h' serial command, either straight from the
+board's USB serial port (which needs pyserial) or from files it was saved
+to, along with the files appended to by host builds. The counts of every
+dump found are added together, so that the histograms of many ROMs may be
+combined, and the most frequent opcodes, CB opcodes, memory pages and ROM
+banks are listed.
+
+Usage: cpu_hist.py --port /dev/ttyACM0
+       cpu_hist.py dump.csv [more.csv ...] [--top 20] [--csv total.csv]
+"""
+
+import argparse
+import sys
+import time
+from collections import Counter, defaultdict
+
+KINDS = [
+    ("op", "opcodes"),
+    ("cb", "CB opcodes"),
+    ("rd", "reads per page"),
+    ("wr", "writes per page"),
+    ("bank", "switches to ROM bank"),
+]
+
+REGIONS = [
+    (0x00, "ROM0"),
+    (0x40, "ROMX"),
+    (0x80, "VRAM"),
+    (0xA0, "cart RAM"),
+    (0xC0, "WRAM"),
+    (0xE0, "echo"),
+    (0xFE, "OAM"),
+    (0xFF, "I/O, HRAM"),
+]
+
+
+def read_port(port, timeout):
+    """Ask the board for a dump and return its lines."""
+    import serial
+
+    lines = []
+    with serial.Serial(port, 115200, timeout=1) as s:
+        s.reset_input_buffer()
+        s.write(b"h")
+        deadline = time.monotonic() + timeout
+        started = False
+        while time.monotonic() < deadline:
+            line = s.readline().decode("ascii", "replace").strip()
+            if not line:
+                continue
+            if line.startswith("# cpu histogram"):
+                started = True
+            if not started:
+                continue
+            lines.append(line)
+            if line.startswith("# end"):
+                break
+        else:
+            raise SystemExit("timed out waiting for the dump")
+    return lines
+
+
+def parse(lines, totals):
+    """Add the counts of the dumps in lines to totals. Returns the number of
+    dumps and frames found."""
+    dumps = frames = 0
+    for line in lines:
+        line = line.strip()
+        if line.startswith("# cpu histogram:"):
+            dumps += 1
+            try:
+                frames += int(line.split(":")[1].split()[0])
+            except (IndexError, ValueError):
+                pass
+            continue
+        fields = line.split(",")
+        if len(fields) != 3 or fields[0] not in totals:
+            continue        # Headers, and lines from other commands mixed in
+        try:
+            totals[fields[0]][int(fields[1], 16)] += int(fields[2])
+        except ValueError:
+            continue
+    return dumps, frames
+
+
+def region(page):
+    name = REGIONS[0][1]
+    for start, n in REGIONS:
+        if page >= start:
+            name = n
+    return name
+
+
+def label(kind, index):
+    if kind == "op":
+        return "%02X" % index
+    if kind == "cb":
+        return "CB %02X" % index
+    if kind in ("rd", "wr"):
+        return "%02X00 %s" % (index, region(index))
+    return "bank %d" % index
+
+
+def summarise(totals, top):
+    for kind, title in KINDS:
+        counts = totals[kind]
+        total = sum(counts.values())
+        if not total:
+            continue
+        print("\n%s: %d" % (title, total))
+        for index, n in counts.most_common(top):
+            print("  %-16s %12d %6.2f%%" % (label(kind, index), n, 100.0 * n / total))
+
+    for kind in ("rd", "wr"):
+        by_region = Counter()
+        for page, n in totals[kind].items():
+            by_region[region(page)] += n
+        total = sum(by_region.values())
+        if total:
+            print("\n%s by region:" % ("reads" if kind == "rd" else "writes"))
+            for name, n in by_region.most_common():
+                print("  %-16s %12d %6.2f%%" % (name, n, 100.0 * n / total))
+
+
+def write_csv(totals, path):
+    with open(path, "w") as f:
+        f.write("kind,index,count\n")
+        for kind, _ in KINDS:
+            for index in sorted(totals[kind]):
+                f.write("%s,%03x,%d\n" % (kind, index, totals[kind][index]))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split("\n\n")[0])
+    parser.add_argument("files", nargs="*", help="saved dumps, or - for stdin")
+    parser.add_argument("-p", "--port", help="read a dump from this serial port")
+    parser.add_argument("-t", "--timeout", type=float, default=30,
+                        help="seconds to wait for a dump from the port")
+    parser.add_argument("-n", "--top", type=int, default=20,
+                        help="number of entries to list of each histogram")
+    parser.add_argument("--csv", help="also write the added up counts to this file")
+    args = parser.parse_args()
+
+    totals = defaultdict(Counter, {kind: Counter() for kind, _ in KINDS})
+    dumps = frames = 0
+
+    sources = []
+    if args.port:
+        sources.append(read_port(args.port, args.timeout))
+    for name in args.files:
+        if name == "-":
+            sources.append(sys.stdin.read().splitlines())
+        else:
+            with open(name) as f:
+                sources.append(f.read().splitlines())
+    if not sources:
+        parser.error("give dump files or --port")
+
+    for lines in sources:
+        d, fr = parse(lines, totals)
+        dumps += d
+        frames += fr
+    if not dumps:
+        raise SystemExit("no histograms found")
+
+    print("%d dumps, %d frames" % (dumps, frames))
+    summarise(totals, args.top)
+    if args.csv:
+        write_csv(totals, args.csv)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,163 @@
+#!/usr/bin/env python3
+"""
+Compress Game Boy ROMs for the emulator's compressed ROM support.
+
+Writes an LZ4 frame with independent blocks of one 16 KiB ROM bank each and
+the decompressed size in the header, so that the emulator can decompress any
+bank on its own straight into its bank cache. The output is a standard LZ4
+frame and can also be decompressed with "lz4 -d".
+
+Usage: romlz4.py ROM.gb [ROM.gb ...]
+Writes ROM.gb.lz4 next to each ROM, or to the file given with -o.
+"""
+
+import argparse
+import struct
+import sys
+
+BANK_SIZE = 0x4000
+FRAME_MAGIC = 0x184D2204
+
+MIN_MATCH = 4
+LAST_LITERALS = 5       # The last 5 bytes of a block are always literals
+MFLIMIT = 12            # A match may not start within 12 bytes of the end
+MAX_OFFSET = 0xFFFF
+HASH_BITS = 14
+
+PRIME32_1 = 0x9E3779B1
+PRIME32_2 = 0x85EBCA77
+PRIME32_3 = 0xC2B2AE3D
+PRIME32_4 = 0x27D4EB2F
+PRIME32_5 = 0x165667B1
+
+
+def rotl32(x, r):
+    return ((x << r) | (x >> (32 - r))) & 0xFFFFFFFF
+
+
+def xxh32(data, seed=0):
+    """xxHash32, used for the frame header checksum."""
+    n = len(data)
+    i = 0
+    if n >= 16:
+        v = [(seed + PRIME32_1 + PRIME32_2) & 0xFFFFFFFF,
+             (seed + PRIME32_2) & 0xFFFFFFFF,
+             seed & 0xFFFFFFFF,
+             (seed - PRIME32_1) & 0xFFFFFFFF]
+        while i + 16 <= n:
+            for j in range(4):
+                lane = struct.unpack_from("<I", data, i + j * 4)[0]
+                v[j] = (rotl32((v[j] + lane * PRIME32_2) & 0xFFFFFFFF, 13) * PRIME32_1) & 0xFFFFFFFF
+            i += 16
+        h = (rotl32(v[0], 1) + rotl32(v[1], 7) + rotl32(v[2], 12) + rotl32(v[3], 18)) & 0xFFFFFFFF
+    else:
+        h = (seed + PRIME32_5) & 0xFFFFFFFF
+    h = (h + n) & 0xFFFFFFFF
+    while i + 4 <= n:
+        h = (h + struct.unpack_from("<I", data, i)[0] * PRIME32_3) & 0xFFFFFFFF
+        h = (rotl32(h, 17) * PRIME32_4) & 0xFFFFFFFF
+        i += 4
+    while i < n:
+        h = (h + data[i] * PRIME32_5) & 0xFFFFFFFF
+        h = (rotl32(h, 11) * PRIME32_1) & 0xFFFFFFFF
+        i += 1
+    h ^= h >> 15
+    h = (h * PRIME32_2) & 0xFFFFFFFF
+    h ^= h >> 13
+    h = (h * PRIME32_3) & 0xFFFFFFFF
+    h ^= h >> 16
+    return h
+
+
+def write_length(out, n):
+    while n >= 255:
+        out.append(255)
+        n -= 255
+    out.append(n)
+
+
+def write_sequence(out, literals, offset, match_len):
+    lit = len(literals)
+    token = (min(lit, 15) << 4)
+    if match_len:
+        token |= min(match_len - MIN_MATCH, 15)
+    out.append(token)
+    if lit >= 15:
+        write_length(out, lit - 15)
+    out += literals
+    if match_len:
+        out += struct.pack("<H", offset)
+        if match_len - MIN_MATCH >= 15:
+            write_length(out, match_len - MIN_MATCH - 15)
+
+
+def compress_block(src):
+    """Greedy LZ4 block compression with a single-entry hash table."""
+    n = len(src)
+    out = bytearray()
+    table = {}
+    anchor = 0
+    i = 0
+    limit = n - MFLIMIT
+    while i < limit:
+        key = src[i:i + MIN_MATCH]
+        cand = table.get(key)
+        table[key] = i
+        if cand is None or i - cand > MAX_OFFSET:
+            i += 1
+            continue
+        # Extend the match, leaving the last literals alone
+        end = n - LAST_LITERALS
+        length = MIN_MATCH
+        while i + length < end and src[cand + length] == src[i + length]:
+            length += 1
+        write_sequence(out, src[anchor:i], i - cand, length)
+        i += length
+        anchor = i
+    write_sequence(out, src[anchor:], 0, 0)
+    return bytes(out)
+
+
+def compress_rom(rom):
+    flg = 0x40 | 0x20 | 0x08        # Version 1, independent blocks, content size
+    bd = 4 << 4                     # 64 KiB maximum block size, the smallest allowed
+    descriptor = bytes([flg, bd]) + struct.pack("<Q", len(rom))
+    out = bytearray(struct.pack("<I", FRAME_MAGIC))
+    out += descriptor
+    out.append((xxh32(descriptor) >> 8) & 0xFF)
+
+    for start in range(0, len(rom), BANK_SIZE):
+        bank = rom[start:start + BANK_SIZE]
+        block = compress_block(bank)
+        if len(block) < len(bank):
+            out += struct.pack("<I", len(block)) + block
+        else:
+            out += struct.pack("<I", len(bank) | 0x80000000) + bank
+
+    out += struct.pack("<I", 0)     # End mark
+    return bytes(out)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split("\n\n")[0])
+    parser.add_argument("roms", nargs="+", help="ROM files to compress")
+    parser.add_argument("-o", "--output", help="output file, with a single ROM")
+    args = parser.parse_args()
+
+    if args.output and len(args.roms) > 1:
+        parser.error("-o needs a single ROM")
+
+    for path in args.roms:
+        with open(path, "rb") as f:
+            rom = f.read()
+        data = compress_rom(rom)
+        out = args.output or path + ".lz4"
+        with open(out, "wb") as f:
+            f.write(data)
+        print("%s: %d -> %d bytes (%.1f%%)" % (out, len(rom), len(data),
+              100.0 * len(data) / max(len(rom), 1)))
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,165 @@
+#!/usr/bin/env python3
+"""
+Summarise the emulator's per-frame telemetry.
+
+Reads the CSV printed by the 't' serial command, either straight from the
+board's USB serial port (which needs pyserial) or from a file it was saved
+to, and prints percentiles of each timing along with the frames that took
+longest. With --plot, the timings are also plotted per frame and as
+cumulative distributions (which needs matplotlib).
+
+Usage: telemetry.py --port /dev/ttyACM0
+       telemetry.py dump.csv [--plot] [--save frames.png]
+"""
+
+import argparse
+import csv
+import io
+import sys
+import time
+
+COLUMNS = ["emu_us", "ppu_us", "lcd_wait_us", "apu_us", "storage_us", "audio_queued"]
+PERCENTILES = [50, 90, 99]
+
+FLAGS = [
+    (0x01, "frame skip"),
+    (0x02, "dropped"),
+    (0x04, "save flush"),
+    (0x08, "ROM miss"),
+    (0x10, "audio underrun"),
+]
+
+
+def read_port(port, timeout):
+    """Ask the board for a dump and return its lines."""
+    import serial
+
+    lines = []
+    with serial.Serial(port, 115200, timeout=1) as s:
+        s.reset_input_buffer()
+        s.write(b"t")
+        deadline = time.monotonic() + timeout
+        started = False
+        while time.monotonic() < deadline:
+            line = s.readline().decode("ascii", "replace").strip()
+            if not line:
+                continue
+            if line.startswith("# telemetry"):
+                started = True
+            if not started:
+                continue
+            lines.append(line)
+            if line.startswith("# end"):
+                break
+        else:
+            raise SystemExit("timed out waiting for the dump")
+    return lines
+
+
+def parse(lines):
+    """Return the records of a dump as a list of dicts of ints."""
+    body = [l for l in lines if l and not l.startswith("#")]
+    records = []
+    for row in csv.DictReader(io.StringIO("\n".join(body))):
+        try:
+            records.append({k: int(v) for k, v in row.items()})
+        except (TypeError, ValueError):
+            continue        # Lines from other commands mixed in
+    return records
+
+
+def percentile(values, p):
+    """Nearest-rank percentile of a sorted list."""
+    if not values:
+        return 0
+    k = max(0, min(len(values) - 1, (p * len(values) + 99) // 100 - 1))
+    return values[k]
+
+
+def summarise(records, worst):
+    print("%d frames" % len(records))
+    print("%-14s %8s %8s %8s %8s %8s" % (("column",) +
+          tuple("p%d" % p for p in PERCENTILES) + ("max", "mean")))
+    for col in COLUMNS:
+        values = sorted(r[col] for r in records)
+        mean = sum(values) / len(values)
+        print("%-14s %8d %8d %8d %8d %8.1f" % ((col,) +
+              tuple(percentile(values, p) for p in PERCENTILES) +
+              (values[-1], mean)))
+
+    counts = ["%s %d" % (name, sum(1 for r in records if r["flags"] & bit))
+              for bit, name in FLAGS]
+    print("flags: " + ", ".join(counts))
+
+    print("\nslowest frames:")
+    for r in sorted(records, key=lambda r: r["emu_us"], reverse=True)[:worst]:
+        names = [name for bit, name in FLAGS if r["flags"] & bit]
+        print("  frame %6d: emu %6d us, ppu %6d us, lcd wait %6d us, storage %6d us %s" %
+              (r["frame"], r["emu_us"], r["ppu_us"], r["lcd_wait_us"],
+               r["storage_us"], ", ".join(names)))
+
+
+def plot(records, save):
+    import matplotlib
+    if save:
+        matplotlib.use("Agg")
+    import matplotlib.pyplot as plt
+
+    frames = [r["frame"] for r in records]
+    fig, (series, cdf) = plt.subplots(2, 1, figsize=(10, 8))
+    for col in COLUMNS[:-1]:
+        values = [r[col] for r in records]
+        series.plot(frames, values, label=col, linewidth=0.8)
+        ordered = sorted(values)
+        cdf.plot(ordered, [100.0 * (i + 1) / len(ordered) for i in range(len(ordered))],
+                 label=col)
+    series.axhline(16743, color="grey", linestyle=":", label="59.73 Hz frame")
+    series.set_xlabel("frame")
+    series.set_ylabel("us")
+    series.legend(fontsize="small")
+    cdf.set_xlabel("us")
+    cdf.set_ylabel("% of frames")
+    cdf.grid(True, alpha=0.3)
+    cdf.legend(fontsize="small")
+    fig.tight_layout()
+
+    if save:
+        fig.savefig(save)
+    else:
+        plt.show()
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split("\n\n")[0])
+    parser.add_argument("file", nargs="?", help="saved dump, or - for stdin")
+    parser.add_argument("-p", "--port", help="read a dump from this serial port")
+    parser.add_argument("-t", "--timeout", type=float, default=30,
+                        help="seconds to wait for a dump from the port")
+    parser.add_argument("-w", "--worst", type=int, default=10,
+                        help="number of slowest frames to list")
+    parser.add_argument("--plot", action="store_true", help="plot the timings")
+    parser.add_argument("--save", help="save the plot to this file instead of showing it")
+    args = parser.parse_args()
+
+    if args.port:
+        lines = read_port(args.port, args.timeout)
+    elif args.file and args.file != "-":
+        with open(args.file) as f:
+            lines = f.read().splitlines()
+    elif args.file == "-":
+        lines = sys.stdin.read().splitlines()
+    else:
+        parser.error("give a dump file or --port")
+
+    records = parse([l.strip() for l in lines])
+    if not records:
+        raise SystemExit("no telemetry records found")
+
+    summarise(records, args.worst)
+    if args.plot or args.save:
+        plot(records, args.save)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())